@@ -0,0 +1,48 @@
+#pragma once
+
+#include <cstddef>
+
+/*
+	The block compressed formats, which store 4x4 pixels in 8 or 16 bytes.
+*/
+enum BlockFormat
+{
+	// RGB, 8 bytes per block.
+	BLOCK_FORMAT_BC1,
+	// RGBA, with BC1 color and BC4 alpha, 16 bytes per block.
+	BLOCK_FORMAT_BC3,
+	// R, 8 bytes per block.
+	BLOCK_FORMAT_BC4,
+	// RG as two BC4 blocks, 16 bytes per block.
+	BLOCK_FORMAT_BC5,
+	// RGBA, 16 bytes per block.
+	BLOCK_FORMAT_BC7
+};
+
+/*
+	Returns the number of bytes of each 4x4 block of the format.
+*/
+size_t GetBlockSize(BlockFormat format);
+
+/*
+	Returns the number of bytes of an image of the format. Partial blocks at the right and bottom edges are whole
+	blocks.
+*/
+size_t GetCompressedSize(BlockFormat format, unsigned int width, unsigned int height);
+
+/*
+	Compress an image of 4 byte RGBA pixels into blocks, row of blocks after row of blocks. Pixels past the right and
+	bottom edges repeat the last column and row. BC4 takes the red channel and BC5 red and green, and BC1 ignores
+	alpha. BC7 blocks are all written in mode 6, a single RGBA endpoint pair with 16 interpolation steps.
+
+	The endpoints of each block are fitted along the principal axis of its colors and refined with a least squares
+	fit. The rows of blocks are split over thread_count threads, zero using one thread per hardware thread.
+*/
+void EncodeBlocks(BlockFormat format, const unsigned char* pixels, unsigned int width, unsigned int height, unsigned char* blocks, unsigned int thread_count = 0);
+
+/*
+	Decompress blocks into 4 byte RGBA pixels, the way the GPU samples them. BC4 gives (r, 0, 0, 255) and BC5
+	(r, g, 0, 255). Returns false if a BC7 block uses one of the partitioned modes, 0 to 3 and 7, which are not
+	supported. Modes 4 to 6, including everything EncodeBlocks writes, are.
+*/
+bool DecodeBlocks(BlockFormat format, const unsigned char* blocks, unsigned int width, unsigned int height, unsigned char* pixels);
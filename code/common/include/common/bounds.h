@@ -0,0 +1,31 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+/*
+	Axis aligned bounding box.
+*/
+struct AABB
+{
+	glm::vec3 min;
+	glm::vec3 max;
+};
+
+struct BoundingSphere
+{
+	glm::vec3 center;
+	float radius;
+};
+
+/*
+	Compute the bounding box of a set of positions, and a bounding sphere centered on the box. Both passes over the
+	positions process four of them at a time with SSE. An empty set gets an empty box and sphere at the origin.
+*/
+void ComputeBounds(const glm::vec3* positions, size_t count, AABB& aabb, BoundingSphere& sphere);
+
+/*
+	Test a box against the inward pointing planes from Camera::GetFrustumPlanes. Returns false if the box is entirely
+	outside one of the planes. The test is conservative: some boxes near the frustum corners pass without being
+	inside it.
+*/
+bool IntersectsFrustum(const AABB& aabb, const glm::vec4 planes[6]);
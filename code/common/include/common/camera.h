@@ -34,6 +34,12 @@ public:
 	const glm::mat4& GetProjection() const;
 	const glm::mat4& GetProjectionView() const;
 
+	/*
+		Extract the left, right, bottom, top, near and far planes of the view frustum from the projection view matrix.
+		The planes are normalized and point inwards: a point p is inside a plane if dot(plane, vec4(p, 1)) >= 0.
+	*/
+	void GetFrustumPlanes(glm::vec4 planes[6]) const;
+
 	void RecalculateMatrices();
 private:
 	glm::vec3 position;
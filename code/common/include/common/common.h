@@ -1,6 +1,16 @@
 #pragma once
 
+#include "blockcompression.h"
+#include "bounds.h"
 #include "camera.h"
+#include "fileio.h"
+#include "filewatcher.h"
+#include "jobqueue.h"
+#include "mesh.h"
+#include "meshlet.h"
 #include "model.h"
+#include "resourcecache.h"
 #include "shader.h"
-#include "timer.h"
\ No newline at end of file
+#include "texture.h"
+#include "timer.h"
+#include "vertexformat.h"
\ No newline at end of file
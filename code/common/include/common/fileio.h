@@ -0,0 +1,66 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/*
+	A file mapped read-only into memory, so loaders can parse it in place instead of copying it into buffers.
+	Empty files are opened with a valid, empty view.
+*/
+class MappedFile
+{
+public:
+	MappedFile();
+	~MappedFile();
+
+	/*
+		Map a whole file, closing the file mapped before. Returns false if the file can not be opened or mapped.
+	*/
+	bool Open(const std::string& filepath);
+
+	void Close();
+
+	const char* GetData() const;
+	size_t GetSize() const;
+private:
+	const char* data;
+	size_t size;
+
+	MappedFile(const MappedFile&);
+	MappedFile& operator=(const MappedFile&);
+};
+
+/*
+	Read a whole file into contents with a single read into a buffer sized up front.
+	Returns false if the file can not be read.
+*/
+bool LoadFile(const std::string& filepath, std::string& contents);
+
+/*
+	A file read or mapped through this layer. The time, in microseconds, covers opening the file and reading it.
+	For a mapped file the pages are only read when first touched, so it covers opening and mapping.
+*/
+struct FileRead
+{
+	std::string filepath;
+	size_t size;
+	int64_t time;
+	bool mapped;
+};
+
+/*
+	Start or stop recording the files read or mapped, on any thread. Recording is off by default, so reads are only
+	kept while something collects them. Stopping drops the reads that were not collected.
+*/
+void SetFileReadRecording(bool enabled);
+
+/*
+	Append the files read or mapped since the previous call, while recording, in the order they were done.
+*/
+void CollectFileReads(std::vector<FileRead>& reads);
+
+/*
+	Collect the file reads and print them to std::cout, one line per file with its size and time.
+*/
+void PrintFileReads();
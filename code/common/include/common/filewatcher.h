@@ -0,0 +1,33 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/*
+	Detects changes to a set of files by comparing their modification times and sizes, which is cheap enough to do
+	every frame for the handful of files a lab watches.
+*/
+class FileWatcher
+{
+public:
+	/*
+		Start watching a file. Watching the same file twice has no effect.
+	*/
+	void Watch(const std::string& filepath);
+
+	/*
+		Append the watched files that changed since the previous call, or since they were watched.
+		A file that can not be found is skipped until it reappears.
+	*/
+	void Poll(std::vector<std::string>& changed);
+private:
+	struct WatchedFile
+	{
+		std::string filepath;
+		int64_t modification_time;
+		int64_t size;
+	};
+
+	std::vector<WatchedFile> files;
+};
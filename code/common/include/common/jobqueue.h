@@ -0,0 +1,68 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/*
+	A pool of worker threads for loading assets in the background.
+
+	Each job has a work function, run on a worker thread, and an optional finish function, run on the thread that
+	calls Update() once the work is done. The work function reads, parses and decodes, and the finish function does
+	what has to happen on the render thread, such as the OpenGL uploads. Finish functions may push new jobs.
+*/
+class JobQueue
+{
+public:
+	/*
+		Start thread_count worker threads. Zero starts one less than the number of hardware threads, but at least one.
+	*/
+	explicit JobQueue(unsigned int thread_count = 0);
+
+	/*
+		Stop the workers. Jobs that have not started are dropped and finish functions that have not run are never run.
+	*/
+	~JobQueue();
+
+	/*
+		Queue work to be run on a worker thread, followed by finish on the thread calling Update().
+	*/
+	void Push(const std::function<void()>& work, const std::function<void()>& finish = nullptr);
+
+	/*
+		Run the finish functions of completed jobs, in the order their work completed, until budget microseconds
+		have passed. At least one is run per call, if any is ready, so loading always progresses.
+		An exception thrown by the work function of a job is rethrown here instead of running its finish function.
+	*/
+	void Update(int64_t budget);
+
+	/*
+		Returns true when no job is queued, running or waiting for its finish function.
+	*/
+	bool IsIdle() const;
+private:
+	struct Job
+	{
+		std::function<void()> work;
+		std::function<void()> finish;
+		std::exception_ptr error;
+	};
+
+	std::vector<std::thread> workers;
+	std::deque<Job> queued;
+	std::deque<Job> completed;
+	size_t running;
+	bool stopping;
+	mutable std::mutex mutex;
+	std::condition_variable condition;
+
+	JobQueue(const JobQueue&);
+	JobQueue& operator=(const JobQueue&);
+
+	void RunWorker();
+};
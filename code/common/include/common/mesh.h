@@ -0,0 +1,102 @@
+#pragma once
+
+#include "model.h"
+#include <vector>
+#include <glm/glm.hpp>
+
+/*
+	An indexed triangle mesh. The submesh ranges refer to the index buffer (first index and index count).
+*/
+struct IndexedMesh
+{
+	std::vector<glm::vec3> positions;
+	std::vector<glm::vec3> normals;
+	std::vector<glm::vec2> texcoords;
+	std::vector<unsigned int> indices;
+	std::vector<OBJSubmesh> submeshes;
+};
+
+/*
+	Vertex cache efficiency of an index buffer, simulated with a FIFO cache of VERTEX_CACHE_SIZE entries.
+
+	acmr: average cache miss ratio, transformed vertices per triangle (0.5 is ideal for large meshes, 3 is worst).
+	atvr: average transform to vertex ratio, transformed vertices per referenced vertex (1 is ideal).
+*/
+struct VertexCacheStatistics
+{
+	float acmr;
+	float atvr;
+};
+
+struct MeshOptimizationStatistics
+{
+	VertexCacheStatistics before;
+	VertexCacheStatistics after;
+};
+
+/*
+	A level of detail of an indexed mesh. The submeshes match those of the mesh one to one, but refer to the
+	simplified ranges in the shared index buffer. The error is the simplification error in model units.
+*/
+struct MeshLOD
+{
+	std::vector<OBJSubmesh> submeshes;
+	float error;
+};
+
+const int VERTEX_CACHE_SIZE = 16;
+
+/*
+	Build an indexed mesh from a non-indexed model by merging identical vertices. The submeshes are preserved.
+*/
+void BuildIndexedMesh(const OBJ& model, IndexedMesh& mesh);
+
+VertexCacheStatistics AnalyzeVertexCache(const unsigned int* indices, size_t index_count, size_t vertex_count);
+
+/*
+	Reorder the triangles for post-transform vertex cache reuse, using Tom Forsyth's linear-speed algorithm.
+*/
+void OptimizeVertexCache(unsigned int* indices, size_t index_count, size_t vertex_count);
+
+/*
+	Reorder clusters of triangles so that the triangles most likely to occlude others are drawn first, reducing
+	overdraw. Expects a cache optimized index buffer and only splits it where the vertex cache efficiency stays
+	within threshold (for example 1.05) of the input.
+*/
+void OptimizeOverdraw(unsigned int* indices, size_t index_count, const glm::vec3* positions, size_t vertex_count, float threshold);
+
+/*
+	Reorder the vertices in the order they are first referenced by the index buffer, for vertex fetch locality.
+*/
+void OptimizeVertexFetch(IndexedMesh& mesh);
+
+/*
+	Run the vertex cache, overdraw and vertex fetch optimizations on each submesh of the mesh, keeping the submesh
+	ranges intact. Vertex cache statistics before and after are written to statistics if it is not null.
+*/
+void OptimizeMesh(IndexedMesh& mesh, MeshOptimizationStatistics* statistics);
+
+/*
+	Simplify a triangle list to at most target_index_count indices using quadric error metric edge collapses, and
+	write the result to destination. Vertices are collapsed onto their neighbours, so the vertex buffer is shared with
+	the input. Mesh borders are only collapsed along the border, and UV/normal seams only along the seam with both
+	sides collapsed together, so no cracks open up. Returns the resulting error in model units.
+*/
+float SimplifyMesh(const unsigned int* indices, size_t index_count, const glm::vec3* positions, size_t vertex_count, size_t target_index_count, std::vector<unsigned int>& destination);
+
+/*
+	Generate a chain of simplified levels of detail, one for each triangle ratio (for example 0.5, 0.25, 0.125).
+	Each submesh is simplified separately and the results are appended to the index buffer of the mesh. The first
+	level of the chain is the mesh itself. The chain ends early if seams or borders keep a level from removing any
+	more triangles than the previous one.
+*/
+void BuildMeshLODs(IndexedMesh& mesh, const float* ratios, size_t ratio_count, std::vector<MeshLOD>& lods);
+
+/*
+	Select the coarsest level of detail whose error, projected to the screen, is at most max_pixel_error pixels.
+
+	distance: Distance from the camera to the mesh.
+	pixels_per_unit: Size in pixels of one model unit at distance 1, viewport_height / (2 * tan(fovY / 2)) times the
+	scale of the model matrix.
+*/
+int SelectMeshLOD(const std::vector<MeshLOD>& lods, float distance, float pixels_per_unit, float max_pixel_error);
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <vector>
+#include <glm/glm.hpp>
+
+const unsigned int MESHLET_MAX_VERTICES = 64;
+const unsigned int MESHLET_MAX_TRIANGLES = 124;
+
+/*
+	A small cluster of triangles with its own local vertex list.
+
+	The vertices of the meshlet are meshlet_vertices[vertex_offset] onwards, as indices into the mesh vertex buffer.
+	The triangles are meshlet_triangles[triangle_offset] onwards, three bytes per triangle indexing the local vertices.
+
+	center, radius: Bounding sphere of the triangles.
+	cone_apex, cone_axis, cone_cutoff: Normal cone. The whole meshlet faces away from a camera at c if
+	dot(normalize(cone_apex - c), cone_axis) >= cone_cutoff. A cutoff above 1 means the meshlet can not be back-face culled.
+*/
+struct Meshlet
+{
+	unsigned int vertex_offset;
+	unsigned int triangle_offset;
+	unsigned int vertex_count;
+	unsigned int triangle_count;
+	glm::vec3 center;
+	float radius;
+	glm::vec3 cone_apex;
+	glm::vec3 cone_axis;
+	float cone_cutoff;
+};
+
+/*
+	Partition a triangle list into meshlets of at most MESHLET_MAX_VERTICES vertices and MESHLET_MAX_TRIANGLES
+	triangles, in index buffer order. The index buffer should be optimized for the vertex cache first, so neighbouring
+	triangles end up in the same meshlet.
+*/
+void BuildMeshlets(const unsigned int* indices, size_t index_count, const glm::vec3* positions, size_t vertex_count,
+	std::vector<Meshlet>& meshlets, std::vector<unsigned int>& meshlet_vertices, std::vector<unsigned char>& meshlet_triangles);
+
+/*
+	Collect the meshlets that are inside the frustum and not facing away from the camera. The planes and the camera
+	position are in the same space as the meshlet bounds, see Camera::GetFrustumPlanes. Returns the number of
+	triangles in the visible meshlets.
+*/
+size_t CullMeshlets(const std::vector<Meshlet>& meshlets, const glm::vec4 planes[6], const glm::vec3& camera_position, std::vector<unsigned int>& visible);
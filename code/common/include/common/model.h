@@ -1,18 +1,70 @@
 #pragma once
 
+#include <string>
 #include <vector>
 #include <glm/glm.hpp>
+#include "bounds.h"
 
+/*
+	A contiguous range of triangle vertices in an OBJ that share the same object/group name and material.
+*/
+struct OBJSubmesh
+{
+	std::string name;
+	std::string material;
+	unsigned int first;
+	unsigned int count;
+};
+
+/*
+	A triangulated, non-indexed model. Every three consecutive vertices form a triangle.
+*/
 struct OBJ
 {
 	std::vector<glm::vec3> positions;
 	std::vector<glm::vec3> normals;
 	std::vector<glm::vec2> texcoords;
+	std::vector<OBJSubmesh> submeshes;
+	std::string mtllib;
+	AABB aabb;
+	BoundingSphere bounding_sphere;
+};
+
+/*
+	A batch of indexed triangles streamed from an OBJ file. The indices refer to the vertices of the batch.
+
+	All triangles of a batch belong to the same submesh. submesh counts the o, g and usemtl statements that were
+	followed by faces, so consecutive batches with the same submesh number continue the same submesh.
+
+	position_indices holds the index of each vertex in the v table of the file, and face_normals is non-zero for the
+	vertices whose corner had no vn and got the face normal, so smooth normals can be generated once the whole file
+	is known.
+*/
+struct OBJBatch
+{
+	std::vector<glm::vec3> positions;
+	std::vector<glm::vec3> normals;
+	std::vector<glm::vec2> texcoords;
+	std::vector<unsigned int> position_indices;
+	std::vector<unsigned char> face_normals;
+	std::vector<unsigned int> indices;
+	unsigned int submesh;
+	std::string name;
+	std::string material;
 	std::string mtllib;
 };
 
+/*
+	Called by StreamOBJ for every batch. Return false to stop loading.
+*/
+typedef bool (*OBJBatchCallback)(const OBJBatch& batch, void* user_data);
+
+// The batch size LoadOBJ uses.
+const size_t OBJ_STREAM_BATCH_VERTICES = 1 << 16;
+
 struct MTL
 {
+	std::string name;
 	glm::vec3 Ka;
 	glm::vec3 Kd;
 	glm::vec3 Ks;
@@ -20,7 +72,63 @@ struct MTL
 	std::string map_Ka;
 	std::string map_Kd;
 	std::string map_Ks;
+
+	MTL();
+};
+
+/*
+	A set of materials sharing the same render state (diffuse texture and specular color), along with the vertex
+	ranges that use them. All ranges of a batch can be drawn with one texture bind and one glMultiDrawArrays call,
+	or one glMultiDrawElements call using offsets, the byte offsets of the ranges in a GL_UNSIGNED_INT index buffer.
+*/
+struct MaterialBatch
+{
+	int material;
+	std::vector<int> firsts;
+	std::vector<int> counts;
+	std::vector<const void*> offsets;
 };
 
+/*
+	Load a Wavefront OBJ file.
+
+	Faces may be triangles, quads or n-gons (fan-triangulated) and each corner may be given as v, v/vt, v//vn or
+	v/vt/vn, with positive or negative (relative) indices. Corners without a texture coordinate get (0, 0) and
+	corners without a normal get a smooth normal, the area weighted average of the normals of all triangles sharing
+	the position. A new submesh is started on every o, g or usemtl statement. The bounds of the model are computed
+	as well.
+*/
 bool LoadOBJ(const char* filepath, OBJ& model);
-bool LoadMTL(const char* filepath, MTL& material);
+
+/*
+	Load a Wavefront OBJ file in batches of at most max_batch_vertices vertices and 2 * max_batch_vertices triangles,
+	handing each batch to the callback, for files too large to keep in memory as a whole. The file is mapped and
+	parsed in place, so only the pages being parsed need to be resident. Only the v, vt and vn tables are kept for
+	the whole file, since faces may refer to any earlier entry. Faces are handled as in LoadOBJ, except that corners
+	without a normal get the face normal. Returns false if the file could not be read or parsed, or if the callback
+	stopped the loading.
+*/
+bool StreamOBJ(const char* filepath, size_t max_batch_vertices, OBJBatchCallback callback, void* user_data);
+
+/*
+	Load all materials of a Wavefront MTL library, in the order they are declared.
+*/
+bool LoadMTL(const char* filepath, std::vector<MTL>& materials);
+
+/*
+	Returns the index of the named material, or -1 if the library does not contain it.
+*/
+int FindMaterial(const std::vector<MTL>& materials, const std::string& name);
+
+/*
+	Reorder the vertices of the model so that all faces using the same material are contiguous, in library order,
+	and merge the submeshes into one submesh per material. Submeshes referring to a material that is not in the
+	library are assigned the first material.
+*/
+void SortOBJByMaterial(OBJ& model, const std::vector<MTL>& materials);
+
+/*
+	Group the submeshes of a model or mesh into batches of materials that share the same render state.
+	Each batch refers to its first material for the render state. Nothing is generated for an empty library.
+*/
+void BuildMaterialBatches(const std::vector<OBJSubmesh>& submeshes, const std::vector<MTL>& materials, std::vector<MaterialBatch>& batches);
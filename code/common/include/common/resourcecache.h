@@ -0,0 +1,160 @@
+#pragma once
+
+#define NOMINMAX
+#include <GL/gl3w.h>
+#include "filewatcher.h"
+#include "shader.h"
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+enum ResourceType
+{
+	RESOURCE_TEXTURE,
+	RESOURCE_BUFFER,
+	RESOURCE_PROGRAM
+};
+
+/*
+	An OpenGL texture, buffer or program shared through a ResourceCache.
+	The object is deleted along with the last handle to it, so handles must be released while the context is current.
+*/
+struct Resource
+{
+	ResourceType type;
+	GLuint name;
+	// The parameters and source data the resource was created from, and their hash. The hash finds candidates to
+	// share, which are only shared when the identities match as well.
+	uint64_t hash;
+	std::string identity;
+
+	Resource(ResourceType type, GLuint name, const std::string& identity);
+	~Resource();
+private:
+	Resource(const Resource&);
+	Resource& operator=(const Resource&);
+};
+
+typedef std::shared_ptr<const Resource> ResourceHandle;
+
+struct ShaderFile
+{
+	GLenum type;
+	std::string filepath;
+};
+
+/*
+	The shader files of a program, and the defines added to each of them. Programs built from the same files with
+	different defines are different permutations and are cached separately.
+*/
+struct ProgramFiles
+{
+	const ShaderFile* shaders;
+	size_t count;
+	const ShaderDefine* defines;
+	size_t define_count;
+};
+
+struct ResourceCacheStatistics
+{
+	// Resources created from scratch.
+	unsigned int loads;
+	// Requests for a path and parameters that were already loaded.
+	unsigned int path_hits;
+	// Requests for a new path whose contents and parameters match a loaded resource.
+	unsigned int content_hits;
+	// Programs loaded from a binary saved on an earlier run instead of being compiled.
+	unsigned int binary_loads;
+};
+
+const std::string FILE_EXTENSION_PROGRAM_BINARY = ".glprogram";
+
+/*
+	Shares OpenGL resources between their users. Resources loaded from files are looked up by path first and then by
+	their contents, so the same file is read once and identical files under different paths share one object. Buffers
+	are looked up by their data. Contents are found through a hash and then compared in full, so resources are never
+	shared because of a collision. Each resource keeps a copy of its contents for the comparison.
+
+	The cache only keeps weak references: a resource lives as long as some handle to it does, and is created anew
+	when requested after that. Loading throws a std::runtime_error on failure.
+
+	Linked programs can also be kept across runs. Their binaries are saved in a directory, named by a hash of the
+	shader sources and the driver, and loaded instead of compiling the sources when the hash matches.
+
+	The shader files of loaded programs are watched, so programs can be rebuilt while the application runs when
+	their files are edited. The handles stay the same and refer to the new program.
+*/
+class ResourceCache
+{
+public:
+	/*
+		Program binaries are saved in program_binary_directory, which must exist and end with a slash.
+		An empty directory disables saving them.
+	*/
+	explicit ResourceCache(const std::string& program_binary_directory = "");
+
+	/*
+		Load a DDS file as a mipmapped 2D texture with the given internal format and pixel format, with unsigned
+		bytes per component. See LoadDDS and CreateTexture.
+	*/
+	ResourceHandle LoadTexture(const std::string& filepath, GLenum internal_format, GLenum format);
+
+	/*
+		Load DDS files as the layers of a mipmapped 2D array texture, in the order of the paths. The files must have
+		the same dimensions, levels and format. See CreateTextureArray.
+	*/
+	ResourceHandle LoadTextureArray(const std::string* filepaths, size_t count, GLenum internal_format, GLenum format);
+
+	/*
+		Compile and link a program from one shader file per stage, or load its binary from an earlier run.
+		The files are run through PreprocessShaderFile with the defines.
+	*/
+	ResourceHandle LoadProgram(const ShaderFile* shaders, size_t count, const ShaderDefine* defines = nullptr, size_t define_count = 0);
+
+	/*
+		Load a batch of programs as LoadProgram does, writing their handles to resources. The programs that have to be
+		compiled are compiled together with CompileProgramBatch, which fills in compile_statistics if it is not null.
+	*/
+	void LoadPrograms(const ProgramFiles* programs, size_t count, ResourceHandle* resources, ShaderBatchStatistics* compile_statistics);
+
+	/*
+		Create a buffer holding a copy of data. GL_STATIC_DRAW buffers with the same target, size and data share one
+		buffer. Buffers of any other usage can be written to, so each call creates a new one.
+	*/
+	ResourceHandle CreateBuffer(GLenum target, const void* data, size_t size, GLenum usage);
+
+	/*
+		Recompile and relink the programs whose shader files, or files they include, changed since the previous call.
+		Call it between frames.
+		A program that fails to build keeps its previous version, and the error is appended to errors.
+		Returns the number of programs that were rebuilt.
+	*/
+	unsigned int ReloadChangedPrograms(std::vector<std::string>& errors);
+
+	const ResourceCacheStatistics& GetStatistics() const;
+private:
+	struct WatchedProgram
+	{
+		std::weak_ptr<Resource> resource;
+		std::vector<ShaderFile> shaders;
+		std::vector<ShaderDefine> defines;
+		std::vector<std::string> files;
+	};
+
+	std::unordered_map<std::string, std::weak_ptr<const Resource>> paths;
+	std::unordered_map<uint64_t, std::weak_ptr<const Resource>> contents;
+	ResourceCacheStatistics statistics;
+	std::string program_binary_directory;
+	uint64_t driver_hash;
+	std::vector<WatchedProgram> watched_programs;
+	FileWatcher file_watcher;
+
+	uint64_t GetDriverHash();
+	std::string GetProgramBinaryFilepath(uint64_t hash);
+	ResourceHandle FindPath(const std::string& key);
+	ResourceHandle FindContents(const std::string& identity);
+	void Insert(const std::string& key, const ResourceHandle& resource);
+	void WatchProgram(const std::shared_ptr<Resource>& resource, const ProgramFiles& program, const std::vector<std::string>& files);
+};
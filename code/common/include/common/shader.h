@@ -2,7 +2,69 @@
 
 #define NOMINMAX
 #include <GL/gl3w.h>
+#include <cstdint>
+#include <string>
+#include <vector>
 
 GLuint CompileShaderFromFile(const char* filepath, GLenum shaderType);
 GLuint CompileShaderFromSource(const char* source, GLenum shaderType);
-GLuint LinkProgram(GLuint program);
\ No newline at end of file
+GLuint LinkProgram(GLuint program);
+
+/*
+	A preprocessor definition added to a shader, as #define name value.
+*/
+struct ShaderDefine
+{
+	std::string name;
+	std::string value;
+};
+
+/*
+	Read a shader file, resolving #include "file" directives relative to the including file and adding the defines
+	after the #version line. A file is only included the first time, later includes of it, including cyclic ones,
+	are skipped.
+
+	#line directives keep compile errors pointing at the right line, with the files numbered in the order they were
+	first read. The files, starting with filepath, are appended to files. Throws a std::runtime_error if a file can
+	not be read.
+*/
+std::string PreprocessShaderFile(const std::string& filepath, const ShaderDefine* defines, size_t define_count, std::vector<std::string>& files);
+
+/*
+	One shader stage of a program in a batch. The name is used in error messages.
+*/
+struct ShaderStage
+{
+	GLenum type;
+	const char* source;
+	const char* name;
+};
+
+struct ProgramStages
+{
+	const ShaderStage* stages;
+	size_t count;
+};
+
+struct ShaderBatchStatistics
+{
+	unsigned int program_count;
+	unsigned int shader_count;
+	// True if the driver was allowed to compile on its own threads, through GL_KHR_parallel_shader_compile or
+	// GL_ARB_parallel_shader_compile.
+	bool parallel;
+	// Time spent submitting the compile and link calls, and in total including waiting for the results, in microseconds.
+	int64_t submit_time;
+	int64_t total_time;
+};
+
+/*
+	Compile and link a batch of programs, writing the program objects to programs.
+
+	When the driver supports parallel shader compilation, every stage of every program is submitted before any status
+	is queried, so the driver can compile them at the same time. Otherwise each shader is compiled and checked in
+	turn, as with CompileShaderFromSource. If binary_retrievable is set, the programs are linked with
+	GL_PROGRAM_BINARY_RETRIEVABLE_HINT. Throws a std::runtime_error with the log of the first failing stage or program,
+	after deleting all objects of the batch.
+*/
+void CompileProgramBatch(const ProgramStages* batch, size_t count, bool binary_retrievable, GLuint* programs, ShaderBatchStatistics* statistics);
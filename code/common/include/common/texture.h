@@ -0,0 +1,102 @@
+#pragma once
+
+#define NOMINMAX
+#include <GL/gl3w.h>
+#include "blockcompression.h"
+#include <string>
+#include <vector>
+
+/*
+	A mip level of a TextureImage, starting offset bytes into its pixels.
+*/
+struct TextureLevel
+{
+	unsigned int width;
+	unsigned int height;
+	size_t offset;
+};
+
+/*
+	A 2D image of pixel_size unsigned byte components per pixel, or of blocks of block_format if it is compressed,
+	with its mip levels stored one after another.
+*/
+struct TextureImage
+{
+	std::vector<unsigned char> pixels;
+	std::vector<TextureLevel> levels;
+	unsigned int pixel_size;
+	bool compressed;
+	BlockFormat block_format;
+};
+
+/*
+	Where the pixels or blocks of the base level of a DDS image are, for reading parts of a large image in place
+	instead of loading it whole. The base level starts offset bytes into the file, and each row of pixels, or of
+	blocks if it is compressed, is pitch bytes long.
+*/
+struct DDSLayout
+{
+	unsigned int width;
+	unsigned int height;
+	unsigned int pixel_size;
+	bool compressed;
+	BlockFormat block_format;
+	size_t offset;
+	size_t pitch;
+};
+
+// The anisotropy the labs sample their surface textures with, clamped to what the driver supports.
+const float TEXTURE_ANISOTROPY_DEFAULT = 8.0f;
+
+/*
+	Decode a DDS image held in memory, either uncompressed or in one of the block compressed formats. The mip levels
+	of the file are kept. A complete chain is generated with GenerateMipmaps if an uncompressed file only has the
+	base level. Returns false if the data is not a 2D DDS image of unsigned bytes or a supported block format.
+	Does not use OpenGL, so it can run on worker threads.
+*/
+bool LoadDDS(const char* data, size_t size, TextureImage& image);
+
+/*
+	Map and decode a DDS file as LoadDDS does.
+*/
+bool LoadDDSFile(const std::string& filepath, TextureImage& image);
+
+/*
+	Read the layout of a DDS image held in memory from its header, without decoding the pixels. Returns false if
+	LoadDDS would not accept the image or the data is too short to hold its base level.
+*/
+bool ReadDDSLayout(const char* data, size_t size, DDSLayout& layout);
+
+/*
+	Decompress every level of a compressed image into 4 byte RGBA pixels with DecodeBlocks, for using compressed
+	images on the CPU. Returns false if a block can not be decoded.
+*/
+bool DecompressTextureImage(const TextureImage& image, TextureImage& decompressed);
+
+/*
+	Replace the levels of the image below the base level with a complete chain down to 1x1. Each level halves the
+	dimensions of the one above, rounding down, and filters it with a separable 6x6 Kaiser windowed sinc, using SSE.
+	Pixels past the edges repeat the edge, and a dimension that is already 1 is kept.
+*/
+void GenerateMipmaps(TextureImage& image);
+
+/*
+	Create an immutable 2D texture with glTexStorage2D and upload every level of the image, given in format.
+	Compressed images are uploaded as they are, in the internal format of their block format, and ignore
+	internal_format and format. The texture is left bound to GL_TEXTURE_2D.
+*/
+GLuint CreateTexture(const TextureImage& image, GLenum internal_format, GLenum format);
+
+/*
+	Create an immutable 2D array texture with one layer per image, as CreateTexture does for a single image, so
+	textures used together can be bound and sampled as one. The images must have the same dimensions, number of
+	levels and pixel size or block format. Returns 0 if they do not. The texture is left bound to
+	GL_TEXTURE_2D_ARRAY.
+*/
+GLuint CreateTextureArray(const TextureImage* images, size_t count, GLenum internal_format, GLenum format);
+
+/*
+	Set trilinear filtering on a sampler, and anisotropic filtering of up to max_anisotropy samples if the driver
+	supports it.
+*/
+void SetSamplerFiltering(GLuint sampler, float max_anisotropy);
@@ -0,0 +1,49 @@
+#pragma once
+
+#define NOMINMAX
+#include <GL/gl3w.h>
+#include <glm/glm.hpp>
+#include <cstdint>
+#include <vector>
+
+/*
+	A compressed, interleaved mesh vertex of 16 bytes (instead of 32 bytes for three float streams).
+
+	position: 16-bit unorm, relative to the mesh bounds. The fourth component is padding.
+	normal: octahedral encoded in 2x16-bit snorm.
+	texcoord: 2x half float.
+*/
+struct PackedVertex
+{
+	uint16_t position[4];
+	int16_t normal[2];
+	uint16_t texcoord[2];
+};
+
+/*
+	Attribute locations used by the packed vertex format. Matches the layout(location) of the mesh shaders.
+*/
+const GLuint PACKED_ATTRIBUTE_POSITION = 0;
+const GLuint PACKED_ATTRIBUTE_NORMAL = 1;
+const GLuint PACKED_ATTRIBUTE_TEXCOORD = 2;
+
+/*
+	Octahedral normal encoding. The encoded value lies in [-1, 1]^2.
+*/
+glm::vec2 EncodeOctahedral(const glm::vec3& normal);
+glm::vec3 DecodeOctahedral(const glm::vec2& encoded);
+
+/*
+	Pack the given vertex streams into the compressed format.
+
+	The returned dequantization matrix maps a decoded unorm position in [0, 1]^3 back into model space. It is a
+	uniform scale and a translation, so it can be multiplied into the model matrix (model * dequantization) without
+	affecting the normal matrix. Normals and texcoords may be null, in which case they are packed as zero.
+*/
+void PackVertices(const glm::vec3* positions, const glm::vec3* normals, const glm::vec2* texcoords, size_t count, std::vector<PackedVertex>& vertices, glm::mat4& dequantization);
+
+/*
+	Setup the vertex attribute pointers and enable the attributes of the packed format for the currently bound
+	vertex array and array buffer.
+*/
+void SetupPackedVertexAttributes();
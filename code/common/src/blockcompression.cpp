@@ -0,0 +1,735 @@
+#include "../include/common/blockcompression.h"
+#include <emmintrin.h>
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+// The weight of the second endpoint for each index of a BC1 color block in four color mode.
+static const float COLOR_WEIGHTS[4] = { 0.0f, 1.0f, 1.0f / 3.0f, 2.0f / 3.0f };
+
+// The weights of the second endpoint of BC7, in 64ths, for 2, 3 and 4 bit indices.
+static const int BC7_WEIGHTS_2[4] = { 0, 21, 43, 64 };
+static const int BC7_WEIGHTS_3[8] = { 0, 9, 18, 27, 37, 46, 55, 64 };
+static const int BC7_WEIGHTS_4[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+
+/*
+	The pixels of a 4x4 block with an array of 16 values per channel, so that four pixels can be handled at a time.
+*/
+struct BlockPixels
+{
+	float channels[4][16];
+};
+
+/*
+	Reads and writes the bits of a block from the least significant bit of the first byte on, as BC7 stores them.
+	Writing expects the block to be zeroed.
+*/
+struct BlockBits
+{
+	unsigned char* data;
+	unsigned int position;
+
+	unsigned int Read(unsigned int count)
+	{
+		unsigned int value = 0;
+		for (unsigned int i = 0; i < count; ++i, ++position)
+			value |= ((data[position >> 3] >> (position & 7)) & 1) << i;
+		return value;
+	}
+
+	void Write(unsigned int value, unsigned int count)
+	{
+		for (unsigned int i = 0; i < count; ++i, ++position)
+			data[position >> 3] |= ((value >> i) & 1) << (position & 7);
+	}
+};
+
+static void LoadBlock(const unsigned char* pixels, unsigned int width, unsigned int height, unsigned int block_x, unsigned int block_y, BlockPixels& block)
+{
+	for (unsigned int y = 0; y < 4; ++y)
+	{
+		unsigned int image_y = std::min(block_y * 4 + y, height - 1);
+		for (unsigned int x = 0; x < 4; ++x)
+		{
+			unsigned int image_x = std::min(block_x * 4 + x, width - 1);
+			const unsigned char* pixel = pixels + (image_y * width + image_x) * 4;
+			for (int c = 0; c < 4; ++c)
+				block.channels[c][y * 4 + x] = pixel[c];
+		}
+	}
+}
+
+static float Clamp(float value, float minimum, float maximum)
+{
+	return std::min(std::max(value, minimum), maximum);
+}
+
+/*
+	Find the endpoints of the line through the pixels along the principal axis of channel_count channels starting at
+	first_channel. The axis is found with a power iteration on the covariance of the channels.
+*/
+static void FindEndpoints(const BlockPixels& block, int first_channel, int channel_count, float endpoint0[4], float endpoint1[4])
+{
+	const float (*channels)[16] = block.channels + first_channel;
+
+	float mean[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+	for (int c = 0; c < channel_count; ++c)
+	{
+		for (int i = 0; i < 16; ++i)
+			mean[c] += channels[c][i];
+		mean[c] /= 16.0f;
+	}
+
+	float covariance[4][4] = {};
+	for (int c0 = 0; c0 < channel_count; ++c0)
+	{
+		for (int c1 = 0; c1 < channel_count; ++c1)
+		{
+			for (int i = 0; i < 16; ++i)
+				covariance[c0][c1] += (channels[c0][i] - mean[c0]) * (channels[c1][i] - mean[c1]);
+		}
+	}
+
+	// Start from the column of the channel that varies the most.
+	int largest = 0;
+	for (int c = 1; c < channel_count; ++c)
+	{
+		if (covariance[c][c] > covariance[largest][largest])
+			largest = c;
+	}
+
+	float axis[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+	for (int c = 0; c < channel_count; ++c)
+		axis[c] = covariance[c][largest];
+
+	for (int iteration = 0; iteration < 8; ++iteration)
+	{
+		float next[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+		float length = 0.0f;
+		for (int c0 = 0; c0 < channel_count; ++c0)
+		{
+			for (int c1 = 0; c1 < channel_count; ++c1)
+				next[c0] += covariance[c0][c1] * axis[c1];
+			length += next[c0] * next[c0];
+		}
+
+		// A block of a single color has no axis.
+		if (length < FLT_EPSILON)
+		{
+			for (int c = 0; c < channel_count; ++c)
+				endpoint0[c] = endpoint1[c] = mean[c];
+			return;
+		}
+
+		length = std::sqrt(length);
+		for (int c = 0; c < channel_count; ++c)
+			axis[c] = next[c] / length;
+	}
+
+	float minimum = FLT_MAX;
+	float maximum = -FLT_MAX;
+	for (int i = 0; i < 16; ++i)
+	{
+		float t = 0.0f;
+		for (int c = 0; c < channel_count; ++c)
+			t += (channels[c][i] - mean[c]) * axis[c];
+		minimum = std::min(minimum, t);
+		maximum = std::max(maximum, t);
+	}
+
+	for (int c = 0; c < channel_count; ++c)
+	{
+		endpoint0[c] = Clamp(mean[c] + axis[c] * minimum, 0.0f, 255.0f);
+		endpoint1[c] = Clamp(mean[c] + axis[c] * maximum, 0.0f, 255.0f);
+	}
+}
+
+/*
+	Fit the endpoints to the pixels by least squares, given the weight of the second endpoint in the palette entry
+	each pixel uses. Returns false and leaves the endpoints alone if every pixel has the same weight.
+*/
+static bool RefitEndpoints(const BlockPixels& block, int first_channel, int channel_count, const unsigned char* indices, const float* weights, float endpoint0[4], float endpoint1[4])
+{
+	const float (*channels)[16] = block.channels + first_channel;
+
+	float ss = 0.0f;
+	float st = 0.0f;
+	float tt = 0.0f;
+	float sx[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+	float tx[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+	for (int i = 0; i < 16; ++i)
+	{
+		float t = weights[indices[i]];
+		float s = 1.0f - t;
+		ss += s * s;
+		st += s * t;
+		tt += t * t;
+		for (int c = 0; c < channel_count; ++c)
+		{
+			sx[c] += s * channels[c][i];
+			tx[c] += t * channels[c][i];
+		}
+	}
+
+	float determinant = ss * tt - st * st;
+	if (std::fabs(determinant) < 1e-4f)
+		return false;
+
+	for (int c = 0; c < channel_count; ++c)
+	{
+		endpoint0[c] = Clamp((sx[c] * tt - tx[c] * st) / determinant, 0.0f, 255.0f);
+		endpoint1[c] = Clamp((tx[c] * ss - sx[c] * st) / determinant, 0.0f, 255.0f);
+	}
+
+	return true;
+}
+
+/*
+	Select the palette entry closest to each pixel, four pixels at a time, comparing channel_count channels starting
+	at first_channel with the first channel_count values of the entries. Returns the sum of the squared errors.
+*/
+static float SelectIndices(const BlockPixels& block, int first_channel, int channel_count, const float palette[][4], int palette_size, unsigned char indices[16])
+{
+	__m128 error_sum = _mm_setzero_ps();
+	for (int i = 0; i < 16; i += 4)
+	{
+		__m128 best_error = _mm_set1_ps(FLT_MAX);
+		__m128 best_index = _mm_setzero_ps();
+		for (int k = 0; k < palette_size; ++k)
+		{
+			__m128 error = _mm_setzero_ps();
+			for (int c = 0; c < channel_count; ++c)
+			{
+				__m128 difference = _mm_sub_ps(_mm_loadu_ps(&block.channels[first_channel + c][i]), _mm_set1_ps(palette[k][c]));
+				error = _mm_add_ps(error, _mm_mul_ps(difference, difference));
+			}
+
+			__m128 closer = _mm_cmplt_ps(error, best_error);
+			best_error = _mm_min_ps(error, best_error);
+			best_index = _mm_or_ps(_mm_and_ps(closer, _mm_set1_ps(static_cast<float>(k))), _mm_andnot_ps(closer, best_index));
+		}
+
+		int lanes[4];
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(lanes), _mm_cvttps_epi32(best_index));
+		for (int j = 0; j < 4; ++j)
+			indices[i + j] = static_cast<unsigned char>(lanes[j]);
+
+		error_sum = _mm_add_ps(error_sum, best_error);
+	}
+
+	float errors[4];
+	_mm_storeu_ps(errors, error_sum);
+	return errors[0] + errors[1] + errors[2] + errors[3];
+}
+
+static uint16_t PackColor565(const float color[3])
+{
+	unsigned int r = static_cast<unsigned int>(color[0] * 31.0f / 255.0f + 0.5f);
+	unsigned int g = static_cast<unsigned int>(color[1] * 63.0f / 255.0f + 0.5f);
+	unsigned int b = static_cast<unsigned int>(color[2] * 31.0f / 255.0f + 0.5f);
+	return static_cast<uint16_t>((r << 11) | (g << 5) | b);
+}
+
+static void UnpackColor565(uint16_t packed, unsigned char color[4])
+{
+	unsigned int r = (packed >> 11) & 31;
+	unsigned int g = (packed >> 5) & 63;
+	unsigned int b = packed & 31;
+	color[0] = static_cast<unsigned char>((r << 3) | (r >> 2));
+	color[1] = static_cast<unsigned char>((g << 2) | (g >> 4));
+	color[2] = static_cast<unsigned char>((b << 3) | (b >> 2));
+	color[3] = 255;
+}
+
+static void EncodeColorBlock(const BlockPixels& block, unsigned char* output)
+{
+	float endpoint0[4];
+	float endpoint1[4];
+	FindEndpoints(block, 0, 3, endpoint0, endpoint1);
+
+	// Select the indices for the quantized endpoints, refit the endpoints to them and try again.
+	uint16_t best_colors[2] = { 0, 0 };
+	unsigned char best_indices[16] = {};
+	float best_error = FLT_MAX;
+	for (int iteration = 0; iteration < 2; ++iteration)
+	{
+		uint16_t colors[2] = { PackColor565(endpoint0), PackColor565(endpoint1) };
+		unsigned char unpacked[2][4];
+		UnpackColor565(colors[0], unpacked[0]);
+		UnpackColor565(colors[1], unpacked[1]);
+
+		float palette[4][4];
+		for (int k = 0; k < 4; ++k)
+		{
+			for (int c = 0; c < 3; ++c)
+				palette[k][c] = unpacked[0][c] + COLOR_WEIGHTS[k] * (unpacked[1][c] - unpacked[0][c]);
+		}
+
+		unsigned char indices[16];
+		float error = SelectIndices(block, 0, 3, palette, 4, indices);
+		if (error < best_error)
+		{
+			best_error = error;
+			best_colors[0] = colors[0];
+			best_colors[1] = colors[1];
+			memcpy(best_indices, indices, sizeof(indices));
+		}
+
+		if (!RefitEndpoints(block, 0, 3, indices, COLOR_WEIGHTS, endpoint0, endpoint1))
+			break;
+	}
+
+	// Four color mode requires the first color to be the larger. Swapping the colors swaps entries 0 and 1, and 2
+	// and 3. Equal colors select three color mode, in which entry 0 is still the color.
+	if (best_colors[0] < best_colors[1])
+	{
+		std::swap(best_colors[0], best_colors[1]);
+		for (int i = 0; i < 16; ++i)
+			best_indices[i] ^= 1;
+	}
+	else if (best_colors[0] == best_colors[1])
+	{
+		memset(best_indices, 0, sizeof(best_indices));
+	}
+
+	uint32_t index_bits = 0;
+	for (int i = 0; i < 16; ++i)
+		index_bits |= static_cast<uint32_t>(best_indices[i]) << (2 * i);
+
+	output[0] = static_cast<unsigned char>(best_colors[0]);
+	output[1] = static_cast<unsigned char>(best_colors[0] >> 8);
+	output[2] = static_cast<unsigned char>(best_colors[1]);
+	output[3] = static_cast<unsigned char>(best_colors[1] >> 8);
+	for (int i = 0; i < 4; ++i)
+		output[4 + i] = static_cast<unsigned char>(index_bits >> (8 * i));
+}
+
+// A BC4 block of one channel, in the mode with six interpolated values.
+static void EncodeSingleChannelBlock(const BlockPixels& block, int channel, unsigned char* output)
+{
+	float minimum = 255.0f;
+	float maximum = 0.0f;
+	for (int i = 0; i < 16; ++i)
+	{
+		minimum = std::min(minimum, block.channels[channel][i]);
+		maximum = std::max(maximum, block.channels[channel][i]);
+	}
+
+	int value0 = static_cast<int>(maximum + 0.5f);
+	int value1 = static_cast<int>(minimum + 0.5f);
+	unsigned char indices[16] = {};
+	if (value0 > value1)
+	{
+		float palette[8][4];
+		palette[0][0] = static_cast<float>(value0);
+		palette[1][0] = static_cast<float>(value1);
+		for (int k = 2; k < 8; ++k)
+			palette[k][0] = ((8 - k) * value0 + (k - 1) * value1) / 7.0f;
+
+		SelectIndices(block, channel, 1, palette, 8, indices);
+	}
+
+	uint64_t index_bits = 0;
+	for (int i = 0; i < 16; ++i)
+		index_bits |= static_cast<uint64_t>(indices[i]) << (3 * i);
+
+	output[0] = static_cast<unsigned char>(value0);
+	output[1] = static_cast<unsigned char>(value1);
+	for (int i = 0; i < 6; ++i)
+		output[2 + i] = static_cast<unsigned char>(index_bits >> (8 * i));
+}
+
+/*
+	Quantize an RGBA endpoint to the 7 bits per channel and shared lowest bit of BC7 mode 6, picking the lowest bit
+	with the smaller error.
+*/
+static void QuantizeEndpointBC7(const float endpoint[4], unsigned int quantized[4], unsigned int& p_bit)
+{
+	float best_error = FLT_MAX;
+	for (unsigned int p = 0; p < 2; ++p)
+	{
+		unsigned int values[4];
+		float error = 0.0f;
+		for (int c = 0; c < 4; ++c)
+		{
+			int value = static_cast<int>((endpoint[c] - p) / 2.0f + 0.5f);
+			values[c] = static_cast<unsigned int>(std::min(std::max(value, 0), 127));
+
+			float difference = endpoint[c] - ((values[c] << 1) | p);
+			error += difference * difference;
+		}
+
+		if (error < best_error)
+		{
+			best_error = error;
+			memcpy(quantized, values, sizeof(values));
+			p_bit = p;
+		}
+	}
+}
+
+static void EncodeBC7Block(const BlockPixels& block, unsigned char* output)
+{
+	float weights[16];
+	for (int k = 0; k < 16; ++k)
+		weights[k] = BC7_WEIGHTS_4[k] / 64.0f;
+
+	float endpoint0[4];
+	float endpoint1[4];
+	FindEndpoints(block, 0, 4, endpoint0, endpoint1);
+
+	unsigned int best_endpoints[2][4] = {};
+	unsigned int best_p_bits[2] = { 0, 0 };
+	unsigned char best_indices[16] = {};
+	float best_error = FLT_MAX;
+	for (int iteration = 0; iteration < 2; ++iteration)
+	{
+		unsigned int endpoints[2][4];
+		unsigned int p_bits[2];
+		QuantizeEndpointBC7(endpoint0, endpoints[0], p_bits[0]);
+		QuantizeEndpointBC7(endpoint1, endpoints[1], p_bits[1]);
+
+		float palette[16][4];
+		for (int k = 0; k < 16; ++k)
+		{
+			for (int c = 0; c < 4; ++c)
+			{
+				int value0 = (endpoints[0][c] << 1) | p_bits[0];
+				int value1 = (endpoints[1][c] << 1) | p_bits[1];
+				palette[k][c] = static_cast<float>(((64 - BC7_WEIGHTS_4[k]) * value0 + BC7_WEIGHTS_4[k] * value1 + 32) >> 6);
+			}
+		}
+
+		unsigned char indices[16];
+		float error = SelectIndices(block, 0, 4, palette, 16, indices);
+		if (error < best_error)
+		{
+			best_error = error;
+			memcpy(best_endpoints, endpoints, sizeof(endpoints));
+			memcpy(best_p_bits, p_bits, sizeof(p_bits));
+			memcpy(best_indices, indices, sizeof(indices));
+		}
+
+		if (!RefitEndpoints(block, 0, 4, indices, weights, endpoint0, endpoint1))
+			break;
+	}
+
+	// The index of the first pixel is stored without its highest bit, so it has to be below 8.
+	if (best_indices[0] >= 8)
+	{
+		for (int c = 0; c < 4; ++c)
+			std::swap(best_endpoints[0][c], best_endpoints[1][c]);
+		std::swap(best_p_bits[0], best_p_bits[1]);
+		for (int i = 0; i < 16; ++i)
+			best_indices[i] = 15 - best_indices[i];
+	}
+
+	memset(output, 0, 16);
+	BlockBits bits = { output, 0 };
+	bits.Write(1 << 6, 7);
+	for (int c = 0; c < 4; ++c)
+	{
+		bits.Write(best_endpoints[0][c], 7);
+		bits.Write(best_endpoints[1][c], 7);
+	}
+	bits.Write(best_p_bits[0], 1);
+	bits.Write(best_p_bits[1], 1);
+	for (int i = 0; i < 16; ++i)
+		bits.Write(best_indices[i], i == 0 ? 3 : 4);
+}
+
+static void EncodeBlock(BlockFormat format, const BlockPixels& block, unsigned char* output)
+{
+	switch (format)
+	{
+	case BLOCK_FORMAT_BC1:
+		EncodeColorBlock(block, output);
+		break;
+	case BLOCK_FORMAT_BC3:
+		EncodeSingleChannelBlock(block, 3, output);
+		EncodeColorBlock(block, output + 8);
+		break;
+	case BLOCK_FORMAT_BC4:
+		EncodeSingleChannelBlock(block, 0, output);
+		break;
+	case BLOCK_FORMAT_BC5:
+		EncodeSingleChannelBlock(block, 0, output);
+		EncodeSingleChannelBlock(block, 1, output + 8);
+		break;
+	case BLOCK_FORMAT_BC7:
+		EncodeBC7Block(block, output);
+		break;
+	}
+}
+
+size_t GetBlockSize(BlockFormat format)
+{
+	return format == BLOCK_FORMAT_BC1 || format == BLOCK_FORMAT_BC4 ? 8 : 16;
+}
+
+size_t GetCompressedSize(BlockFormat format, unsigned int width, unsigned int height)
+{
+	return ((width + 3) / 4) * ((height + 3) / 4) * GetBlockSize(format);
+}
+
+void EncodeBlocks(BlockFormat format, const unsigned char* pixels, unsigned int width, unsigned int height, unsigned char* blocks, unsigned int thread_count)
+{
+	unsigned int block_columns = (width + 3) / 4;
+	unsigned int block_rows = (height + 3) / 4;
+	size_t block_size = GetBlockSize(format);
+
+	if (thread_count == 0)
+		thread_count = std::max(std::thread::hardware_concurrency(), 1u);
+	thread_count = std::min(thread_count, block_rows);
+
+	// Each thread encodes a contiguous range of block rows.
+	std::vector<std::thread> threads;
+	for (unsigned int t = 0; t < thread_count; ++t)
+	{
+		unsigned int first_row = block_rows * t / thread_count;
+		unsigned int last_row = block_rows * (t + 1) / thread_count;
+		threads.push_back(std::thread([=]()
+		{
+			BlockPixels block;
+			for (unsigned int y = first_row; y < last_row; ++y)
+			{
+				for (unsigned int x = 0; x < block_columns; ++x)
+				{
+					LoadBlock(pixels, width, height, x, y, block);
+					EncodeBlock(format, block, blocks + (y * block_columns + x) * block_size);
+				}
+			}
+		}));
+	}
+
+	for (size_t i = 0; i < threads.size(); ++i)
+		threads[i].join();
+}
+
+static void DecodeColorBlock(const unsigned char* input, bool four_color_only, unsigned char colors[16][4])
+{
+	uint16_t packed0 = static_cast<uint16_t>(input[0] | (input[1] << 8));
+	uint16_t packed1 = static_cast<uint16_t>(input[2] | (input[3] << 8));
+
+	unsigned char palette[4][4];
+	UnpackColor565(packed0, palette[0]);
+	UnpackColor565(packed1, palette[1]);
+	for (int c = 0; c < 4; ++c)
+	{
+		if (packed0 > packed1 || four_color_only)
+		{
+			palette[2][c] = static_cast<unsigned char>((2 * palette[0][c] + palette[1][c]) / 3);
+			palette[3][c] = static_cast<unsigned char>((palette[0][c] + 2 * palette[1][c]) / 3);
+		}
+		else
+		{
+			// Three color mode, with transparent black as the fourth entry.
+			palette[2][c] = static_cast<unsigned char>((palette[0][c] + palette[1][c]) / 2);
+			palette[3][c] = 0;
+		}
+	}
+
+	uint32_t index_bits = input[4] | (input[5] << 8) | (input[6] << 16) | (static_cast<uint32_t>(input[7]) << 24);
+	for (int i = 0; i < 16; ++i)
+		memcpy(colors[i], palette[(index_bits >> (2 * i)) & 3], 4);
+}
+
+static void DecodeSingleChannelBlock(const unsigned char* input, unsigned char values[16])
+{
+	int palette[8];
+	palette[0] = input[0];
+	palette[1] = input[1];
+	if (palette[0] > palette[1])
+	{
+		for (int k = 2; k < 8; ++k)
+			palette[k] = ((8 - k) * palette[0] + (k - 1) * palette[1]) / 7;
+	}
+	else
+	{
+		for (int k = 2; k < 6; ++k)
+			palette[k] = ((6 - k) * palette[0] + (k - 1) * palette[1]) / 5;
+		palette[6] = 0;
+		palette[7] = 255;
+	}
+
+	uint64_t index_bits = 0;
+	for (int i = 0; i < 6; ++i)
+		index_bits |= static_cast<uint64_t>(input[2 + i]) << (8 * i);
+	for (int i = 0; i < 16; ++i)
+		values[i] = static_cast<unsigned char>(palette[(index_bits >> (3 * i)) & 7]);
+}
+
+static int InterpolateBC7(int value0, int value1, int weight)
+{
+	return ((64 - weight) * value0 + weight * value1 + 32) >> 6;
+}
+
+// Expand a BC7 endpoint value of the given number of bits to 8 bits by repeating its highest bits.
+static int ExpandBC7(unsigned int value, unsigned int bits)
+{
+	return static_cast<int>(((value << (8 - bits)) | (value >> (2 * bits - 8))) & 255);
+}
+
+static void ReadBC7Indices(BlockBits& bits, unsigned int index_bits, unsigned int indices[16])
+{
+	// The first index is stored without its highest bit, which is zero.
+	for (int i = 0; i < 16; ++i)
+		indices[i] = bits.Read(i == 0 ? index_bits - 1 : index_bits);
+}
+
+static const int* GetBC7Weights(unsigned int index_bits)
+{
+	return index_bits == 2 ? BC7_WEIGHTS_2 : index_bits == 3 ? BC7_WEIGHTS_3 : BC7_WEIGHTS_4;
+}
+
+static bool DecodeBC7Block(const unsigned char* input, unsigned char colors[16][4])
+{
+	unsigned char data[16];
+	memcpy(data, input, sizeof(data));
+	BlockBits bits = { data, 0 };
+
+	unsigned int mode = 0;
+	while (mode < 8 && bits.Read(1) == 0)
+		++mode;
+
+	// Blocks without a mode are reserved and decode to transparent black.
+	if (mode == 8)
+	{
+		memset(colors, 0, 16 * 4);
+		return true;
+	}
+
+	if (mode == 4 || mode == 5)
+	{
+		unsigned int rotation = bits.Read(2);
+		unsigned int index_selection = mode == 4 ? bits.Read(1) : 0;
+		unsigned int color_bits = mode == 4 ? 5 : 7;
+		unsigned int alpha_bits = mode == 4 ? 6 : 8;
+
+		int endpoints[2][4];
+		for (int c = 0; c < 3; ++c)
+		{
+			endpoints[0][c] = ExpandBC7(bits.Read(color_bits), color_bits);
+			endpoints[1][c] = ExpandBC7(bits.Read(color_bits), color_bits);
+		}
+		endpoints[0][3] = ExpandBC7(bits.Read(alpha_bits), alpha_bits);
+		endpoints[1][3] = ExpandBC7(bits.Read(alpha_bits), alpha_bits);
+
+		// Mode 4 has 2 and 3 bit indices and selects which of them are the color ones, mode 5 has 2 bits for both.
+		unsigned int primary_bits = 2;
+		unsigned int secondary_bits = mode == 4 ? 3 : 2;
+		unsigned int primary[16];
+		unsigned int secondary[16];
+		ReadBC7Indices(bits, primary_bits, primary);
+		ReadBC7Indices(bits, secondary_bits, secondary);
+
+		const unsigned int* color_indices = index_selection ? secondary : primary;
+		const unsigned int* alpha_indices = index_selection ? primary : secondary;
+		const int* color_weights = GetBC7Weights(index_selection ? secondary_bits : primary_bits);
+		const int* alpha_weights = GetBC7Weights(index_selection ? primary_bits : secondary_bits);
+		for (int i = 0; i < 16; ++i)
+		{
+			for (int c = 0; c < 3; ++c)
+				colors[i][c] = static_cast<unsigned char>(InterpolateBC7(endpoints[0][c], endpoints[1][c], color_weights[color_indices[i]]));
+			colors[i][3] = static_cast<unsigned char>(InterpolateBC7(endpoints[0][3], endpoints[1][3], alpha_weights[alpha_indices[i]]));
+
+			// The rotation swaps alpha with one of the color channels.
+			if (rotation > 0)
+				std::swap(colors[i][3], colors[i][rotation - 1]);
+		}
+
+		return true;
+	}
+
+	if (mode == 6)
+	{
+		unsigned int endpoints[2][4];
+		for (int c = 0; c < 4; ++c)
+		{
+			endpoints[0][c] = bits.Read(7);
+			endpoints[1][c] = bits.Read(7);
+		}
+		unsigned int p_bit0 = bits.Read(1);
+		unsigned int p_bit1 = bits.Read(1);
+
+		unsigned int indices[16];
+		ReadBC7Indices(bits, 4, indices);
+		for (int i = 0; i < 16; ++i)
+		{
+			for (int c = 0; c < 4; ++c)
+				colors[i][c] = static_cast<unsigned char>(InterpolateBC7((endpoints[0][c] << 1) | p_bit0, (endpoints[1][c] << 1) | p_bit1, BC7_WEIGHTS_4[indices[i]]));
+		}
+
+		return true;
+	}
+
+	return false;
+}
+
+bool DecodeBlocks(BlockFormat format, const unsigned char* blocks, unsigned int width, unsigned int height, unsigned char* pixels)
+{
+	unsigned int block_columns = (width + 3) / 4;
+	unsigned int block_rows = (height + 3) / 4;
+	size_t block_size = GetBlockSize(format);
+
+	for (unsigned int block_y = 0; block_y < block_rows; ++block_y)
+	{
+		for (unsigned int block_x = 0; block_x < block_columns; ++block_x)
+		{
+			const unsigned char* input = blocks + (block_y * block_columns + block_x) * block_size;
+			unsigned char colors[16][4];
+			unsigned char values[16];
+			switch (format)
+			{
+			case BLOCK_FORMAT_BC1:
+				DecodeColorBlock(input, false, colors);
+				break;
+			case BLOCK_FORMAT_BC3:
+				DecodeColorBlock(input + 8, true, colors);
+				DecodeSingleChannelBlock(input, values);
+				for (int i = 0; i < 16; ++i)
+					colors[i][3] = values[i];
+				break;
+			case BLOCK_FORMAT_BC4:
+				DecodeSingleChannelBlock(input, values);
+				for (int i = 0; i < 16; ++i)
+				{
+					colors[i][0] = values[i];
+					colors[i][1] = 0;
+					colors[i][2] = 0;
+					colors[i][3] = 255;
+				}
+				break;
+			case BLOCK_FORMAT_BC5:
+				DecodeSingleChannelBlock(input, values);
+				for (int i = 0; i < 16; ++i)
+				{
+					colors[i][0] = values[i];
+					colors[i][2] = 0;
+					colors[i][3] = 255;
+				}
+				DecodeSingleChannelBlock(input + 8, values);
+				for (int i = 0; i < 16; ++i)
+					colors[i][1] = values[i];
+				break;
+			case BLOCK_FORMAT_BC7:
+				if (!DecodeBC7Block(input, colors))
+					return false;
+				break;
+			}
+
+			// Leave out the pixels past the edges of the image.
+			for (unsigned int y = 0; y < 4 && block_y * 4 + y < height; ++y)
+			{
+				for (unsigned int x = 0; x < 4 && block_x * 4 + x < width; ++x)
+					memcpy(pixels + ((block_y * 4 + y) * width + block_x * 4 + x) * 4, colors[y * 4 + x], 4);
+			}
+		}
+	}
+
+	return true;
+}
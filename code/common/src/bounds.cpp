@@ -0,0 +1,114 @@
+#include "../include/common/bounds.h"
+#include <algorithm>
+#include <cmath>
+#include <xmmintrin.h>
+
+/*
+	Load four consecutive positions (twelve floats) and transpose them into x, y and z vectors.
+*/
+static inline void LoadPositions4(const float* data, __m128& x, __m128& y, __m128& z)
+{
+	// a = (x0 y0 z0 x1), b = (y1 z1 x2 y2), c = (z2 x3 y3 z3)
+	__m128 a = _mm_loadu_ps(data);
+	__m128 b = _mm_loadu_ps(data + 4);
+	__m128 c = _mm_loadu_ps(data + 8);
+
+	x = _mm_shuffle_ps(_mm_shuffle_ps(a, a, _MM_SHUFFLE(3, 3, 3, 0)), _mm_shuffle_ps(b, c, _MM_SHUFFLE(1, 1, 2, 2)), _MM_SHUFFLE(2, 0, 1, 0));
+	y = _mm_shuffle_ps(_mm_shuffle_ps(a, b, _MM_SHUFFLE(0, 0, 1, 1)), _mm_shuffle_ps(b, c, _MM_SHUFFLE(2, 2, 3, 3)), _MM_SHUFFLE(2, 0, 2, 0));
+	z = _mm_shuffle_ps(_mm_shuffle_ps(a, b, _MM_SHUFFLE(1, 1, 2, 2)), _mm_shuffle_ps(c, c, _MM_SHUFFLE(3, 3, 0, 0)), _MM_SHUFFLE(2, 0, 2, 0));
+}
+
+static inline float HorizontalMin(__m128 v)
+{
+	v = _mm_min_ps(v, _mm_shuffle_ps(v, v, _MM_SHUFFLE(2, 3, 0, 1)));
+	v = _mm_min_ps(v, _mm_shuffle_ps(v, v, _MM_SHUFFLE(1, 0, 3, 2)));
+	return _mm_cvtss_f32(v);
+}
+
+static inline float HorizontalMax(__m128 v)
+{
+	v = _mm_max_ps(v, _mm_shuffle_ps(v, v, _MM_SHUFFLE(2, 3, 0, 1)));
+	v = _mm_max_ps(v, _mm_shuffle_ps(v, v, _MM_SHUFFLE(1, 0, 3, 2)));
+	return _mm_cvtss_f32(v);
+}
+
+void ComputeBounds(const glm::vec3* positions, size_t count, AABB& aabb, BoundingSphere& sphere)
+{
+	if (count == 0)
+	{
+		aabb.min = glm::vec3(0.0f);
+		aabb.max = glm::vec3(0.0f);
+		sphere.center = glm::vec3(0.0f);
+		sphere.radius = 0.0f;
+		return;
+	}
+
+	const float* data = &positions[0].x;
+	size_t simd_count = count & ~static_cast<size_t>(3);
+
+	// Bounding box.
+	__m128 min_x = _mm_set1_ps(positions[0].x);
+	__m128 min_y = _mm_set1_ps(positions[0].y);
+	__m128 min_z = _mm_set1_ps(positions[0].z);
+	__m128 max_x = min_x;
+	__m128 max_y = min_y;
+	__m128 max_z = min_z;
+	for (size_t i = 0; i < simd_count; i += 4)
+	{
+		__m128 x, y, z;
+		LoadPositions4(data + i * 3, x, y, z);
+		min_x = _mm_min_ps(min_x, x);
+		min_y = _mm_min_ps(min_y, y);
+		min_z = _mm_min_ps(min_z, z);
+		max_x = _mm_max_ps(max_x, x);
+		max_y = _mm_max_ps(max_y, y);
+		max_z = _mm_max_ps(max_z, z);
+	}
+
+	aabb.min = glm::vec3(HorizontalMin(min_x), HorizontalMin(min_y), HorizontalMin(min_z));
+	aabb.max = glm::vec3(HorizontalMax(max_x), HorizontalMax(max_y), HorizontalMax(max_z));
+	for (size_t i = simd_count; i < count; ++i)
+	{
+		aabb.min = glm::min(aabb.min, positions[i]);
+		aabb.max = glm::max(aabb.max, positions[i]);
+	}
+
+	// Bounding sphere around the box center, with the distance to the furthest position as radius.
+	sphere.center = (aabb.min + aabb.max) * 0.5f;
+	__m128 center_x = _mm_set1_ps(sphere.center.x);
+	__m128 center_y = _mm_set1_ps(sphere.center.y);
+	__m128 center_z = _mm_set1_ps(sphere.center.z);
+	__m128 max_distance2 = _mm_setzero_ps();
+	for (size_t i = 0; i < simd_count; i += 4)
+	{
+		__m128 x, y, z;
+		LoadPositions4(data + i * 3, x, y, z);
+		x = _mm_sub_ps(x, center_x);
+		y = _mm_sub_ps(y, center_y);
+		z = _mm_sub_ps(z, center_z);
+		__m128 distance2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, x), _mm_mul_ps(y, y)), _mm_mul_ps(z, z));
+		max_distance2 = _mm_max_ps(max_distance2, distance2);
+	}
+
+	float radius2 = HorizontalMax(max_distance2);
+	for (size_t i = simd_count; i < count; ++i)
+	{
+		glm::vec3 d = positions[i] - sphere.center;
+		radius2 = std::max(radius2, glm::dot(d, d));
+	}
+
+	sphere.radius = std::sqrt(radius2);
+}
+
+bool IntersectsFrustum(const AABB& aabb, const glm::vec4 planes[6])
+{
+	for (int i = 0; i < 6; ++i)
+	{
+		// The corner of the box furthest along the plane normal is the last one to leave the plane.
+		glm::vec3 corner(planes[i].x >= 0.0f ? aabb.max.x : aabb.min.x, planes[i].y >= 0.0f ? aabb.max.y : aabb.min.y, planes[i].z >= 0.0f ? aabb.max.z : aabb.min.z);
+		if (glm::dot(glm::vec3(planes[i]), corner) + planes[i].w < 0.0f)
+			return false;
+	}
+
+	return true;
+}
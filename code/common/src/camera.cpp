@@ -85,6 +85,24 @@ const glm::mat4& Camera::GetProjectionView() const
 	return projectionView;
 }
 
+void Camera::GetFrustumPlanes(glm::vec4 planes[6]) const
+{
+	// Gribb/Hartmann: each plane is the last row of the matrix plus or minus one of the others.
+	glm::vec4 rows[4];
+	for (int i = 0; i < 4; ++i)
+		rows[i] = glm::vec4(projectionView[0][i], projectionView[1][i], projectionView[2][i], projectionView[3][i]);
+
+	planes[0] = rows[3] + rows[0];
+	planes[1] = rows[3] - rows[0];
+	planes[2] = rows[3] + rows[1];
+	planes[3] = rows[3] - rows[1];
+	planes[4] = rows[3] + rows[2];
+	planes[5] = rows[3] - rows[2];
+
+	for (int i = 0; i < 6; ++i)
+		planes[i] /= glm::length(glm::vec3(planes[i]));
+}
+
 
 void Camera::RecalculateMatrices()
 {
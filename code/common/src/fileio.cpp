@@ -0,0 +1,186 @@
+#include "../include/common/fileio.h"
+#include "../include/common/timer.h"
+#include <fstream>
+#include <iostream>
+#include <mutex>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// The view of empty files, which can not be mapped.
+static const char EMPTY_FILE_DATA[1] = { 0 };
+
+static std::mutex file_reads_mutex;
+static std::vector<FileRead> file_reads;
+static bool file_reads_recorded = false;
+
+static void RecordFileRead(const std::string& filepath, size_t size, int64_t time, bool mapped)
+{
+	FileRead read;
+	read.filepath = filepath;
+	read.size = size;
+	read.time = time;
+	read.mapped = mapped;
+
+	std::lock_guard<std::mutex> lock(file_reads_mutex);
+	if (file_reads_recorded)
+		file_reads.push_back(read);
+}
+
+MappedFile::MappedFile()
+	: data(nullptr)
+	, size(0)
+{}
+
+MappedFile::~MappedFile()
+{
+	Close();
+}
+
+bool MappedFile::Open(const std::string& filepath)
+{
+	Close();
+
+	Timer timer;
+#ifdef _WIN32
+	HANDLE file = CreateFileA(filepath.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file == INVALID_HANDLE_VALUE)
+		return false;
+
+	LARGE_INTEGER file_size;
+	if (!GetFileSizeEx(file, &file_size))
+	{
+		CloseHandle(file);
+		return false;
+	}
+
+	size = static_cast<size_t>(file_size.QuadPart);
+	if (size > 0)
+	{
+		// The view keeps the mapping alive, so the handles can be closed right away.
+		HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		if (mapping)
+		{
+			data = static_cast<const char*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+			CloseHandle(mapping);
+		}
+	}
+	else
+	{
+		data = EMPTY_FILE_DATA;
+	}
+	CloseHandle(file);
+#else
+	int file = open(filepath.c_str(), O_RDONLY);
+	if (file < 0)
+		return false;
+
+	struct stat info;
+	if (fstat(file, &info) != 0)
+	{
+		close(file);
+		return false;
+	}
+
+	size = static_cast<size_t>(info.st_size);
+	if (size > 0)
+	{
+		// The mapping stays valid after the file is closed.
+		void* view = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, file, 0);
+		if (view != MAP_FAILED)
+			data = static_cast<const char*>(view);
+	}
+	else
+	{
+		data = EMPTY_FILE_DATA;
+	}
+	close(file);
+#endif
+
+	if (!data)
+	{
+		size = 0;
+		return false;
+	}
+
+	RecordFileRead(filepath, size, timer.End(), true);
+	return true;
+}
+
+void MappedFile::Close()
+{
+	if (data && data != EMPTY_FILE_DATA)
+	{
+#ifdef _WIN32
+		UnmapViewOfFile(data);
+#else
+		munmap(const_cast<char*>(data), size);
+#endif
+	}
+
+	data = nullptr;
+	size = 0;
+}
+
+const char* MappedFile::GetData() const
+{
+	return data;
+}
+
+size_t MappedFile::GetSize() const
+{
+	return size;
+}
+
+bool LoadFile(const std::string& filepath, std::string& contents)
+{
+	Timer timer;
+	std::ifstream file(filepath.c_str(), std::ios::binary);
+	if (!file.is_open())
+		return false;
+
+	file.seekg(0, std::ios::end);
+	contents.resize(static_cast<size_t>(file.tellg()));
+	file.seekg(0, std::ios::beg);
+	if (!contents.empty())
+		file.read(&contents[0], contents.size());
+	if (!file)
+		return false;
+
+	RecordFileRead(filepath, contents.size(), timer.End(), false);
+	return true;
+}
+
+void SetFileReadRecording(bool enabled)
+{
+	std::lock_guard<std::mutex> lock(file_reads_mutex);
+	file_reads_recorded = enabled;
+	if (!enabled)
+		file_reads.clear();
+}
+
+void CollectFileReads(std::vector<FileRead>& reads)
+{
+	std::lock_guard<std::mutex> lock(file_reads_mutex);
+	reads.insert(reads.end(), file_reads.begin(), file_reads.end());
+	file_reads.clear();
+}
+
+void PrintFileReads()
+{
+	std::vector<FileRead> reads;
+	CollectFileReads(reads);
+	for (size_t i = 0; i < reads.size(); ++i)
+	{
+		std::cout << "Read " << reads[i].filepath << ": " << reads[i].size / 1024.0f << " KB in " << reads[i].time / 1000.0f
+			<< " ms" << (reads[i].mapped ? " (mapped)" : "") << std::endl;
+	}
+}
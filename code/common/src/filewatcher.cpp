@@ -0,0 +1,50 @@
+#include "../include/common/filewatcher.h"
+#include <sys/types.h>
+#include <sys/stat.h>
+
+// Returns false if the file can not be found.
+static bool GetFileStamp(const std::string& filepath, int64_t& modification_time, int64_t& size)
+{
+	struct stat info;
+	if (stat(filepath.c_str(), &info) != 0)
+		return false;
+
+	modification_time = static_cast<int64_t>(info.st_mtime);
+	size = static_cast<int64_t>(info.st_size);
+	return true;
+}
+
+void FileWatcher::Watch(const std::string& filepath)
+{
+	for (size_t i = 0; i < files.size(); ++i)
+	{
+		if (files[i].filepath == filepath)
+			return;
+	}
+
+	WatchedFile file;
+	file.filepath = filepath;
+	file.modification_time = -1;
+	file.size = -1;
+	GetFileStamp(filepath, file.modification_time, file.size);
+	files.push_back(file);
+}
+
+void FileWatcher::Poll(std::vector<std::string>& changed)
+{
+	for (size_t i = 0; i < files.size(); ++i)
+	{
+		int64_t modification_time;
+		int64_t size;
+		if (!GetFileStamp(files[i].filepath, modification_time, size))
+			continue;
+
+		// The size catches a second save within the same second, which the modification time may not resolve.
+		if (modification_time != files[i].modification_time || size != files[i].size)
+		{
+			files[i].modification_time = modification_time;
+			files[i].size = size;
+			changed.push_back(files[i].filepath);
+		}
+	}
+}
@@ -0,0 +1,104 @@
+#include "../include/common/jobqueue.h"
+#include "../include/common/timer.h"
+#include <algorithm>
+
+JobQueue::JobQueue(unsigned int thread_count)
+	: running(0)
+	, stopping(false)
+{
+	if (thread_count == 0)
+	{
+		unsigned int hardware_thread_count = std::thread::hardware_concurrency();
+		thread_count = std::max(hardware_thread_count, 2u) - 1;
+	}
+
+	for (unsigned int i = 0; i < thread_count; ++i)
+		workers.push_back(std::thread(&JobQueue::RunWorker, this));
+}
+
+JobQueue::~JobQueue()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+		queued.clear();
+	}
+
+	condition.notify_all();
+	for (size_t i = 0; i < workers.size(); ++i)
+		workers[i].join();
+}
+
+void JobQueue::Push(const std::function<void()>& work, const std::function<void()>& finish)
+{
+	Job job;
+	job.work = work;
+	job.finish = finish;
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		queued.push_back(job);
+	}
+
+	condition.notify_one();
+}
+
+void JobQueue::Update(int64_t budget)
+{
+	Timer timer;
+	do
+	{
+		Job job;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			if (completed.empty())
+				return;
+
+			job = completed.front();
+			completed.pop_front();
+		}
+
+		// Run outside the lock, since the finish function may push new jobs.
+		if (job.error)
+			std::rethrow_exception(job.error);
+		if (job.finish)
+			job.finish();
+	} while (timer.End() < budget);
+}
+
+bool JobQueue::IsIdle() const
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	return queued.empty() && running == 0 && completed.empty();
+}
+
+void JobQueue::RunWorker()
+{
+	std::unique_lock<std::mutex> lock(mutex);
+	for (;;)
+	{
+		while (!stopping && queued.empty())
+			condition.wait(lock);
+
+		if (stopping)
+			return;
+
+		Job job = queued.front();
+		queued.pop_front();
+		++running;
+
+		lock.unlock();
+		try
+		{
+			job.work();
+		}
+		catch (...)
+		{
+			job.error = std::current_exception();
+		}
+		lock.lock();
+
+		--running;
+		completed.push_back(job);
+	}
+}
@@ -0,0 +1,855 @@
+#include "../include/common/mesh.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <unordered_map>
+#include <unordered_set>
+
+/*
+	A full vertex used as key when merging identical vertices.
+*/
+struct VertexKey
+{
+	glm::vec3 position;
+	glm::vec3 normal;
+	glm::vec2 texcoord;
+
+	bool operator==(const VertexKey& other) const
+	{
+		return memcmp(this, &other, sizeof(VertexKey)) == 0;
+	}
+};
+
+struct VertexKeyHash
+{
+	size_t operator()(const VertexKey& key) const
+	{
+		// FNV-1a over the raw vertex data.
+		const unsigned char* data = reinterpret_cast<const unsigned char*>(&key);
+		unsigned int hash = 2166136261u;
+		for (size_t i = 0; i < sizeof(VertexKey); ++i)
+		{
+			hash ^= data[i];
+			hash *= 16777619u;
+		}
+
+		return hash;
+	}
+};
+
+void BuildIndexedMesh(const OBJ& model, IndexedMesh& mesh)
+{
+	mesh.positions.clear();
+	mesh.normals.clear();
+	mesh.texcoords.clear();
+	mesh.indices.clear();
+	mesh.submeshes = model.submeshes;
+	mesh.indices.reserve(model.positions.size());
+
+	std::unordered_map<VertexKey, unsigned int, VertexKeyHash> vertex_map;
+	vertex_map.reserve(model.positions.size());
+	for (size_t i = 0; i < model.positions.size(); ++i)
+	{
+		VertexKey key;
+		key.position = model.positions[i];
+		key.normal = model.normals[i];
+		key.texcoord = model.texcoords[i];
+
+		std::pair<std::unordered_map<VertexKey, unsigned int, VertexKeyHash>::iterator, bool> inserted =
+			vertex_map.insert(std::make_pair(key, static_cast<unsigned int>(mesh.positions.size())));
+		if (inserted.second)
+		{
+			mesh.positions.push_back(key.position);
+			mesh.normals.push_back(key.normal);
+			mesh.texcoords.push_back(key.texcoord);
+		}
+
+		mesh.indices.push_back(inserted.first->second);
+	}
+}
+
+/*
+	Simulate a FIFO vertex cache for one triangle and return the number of cache misses.
+
+	A vertex is in the cache if fewer than VERTEX_CACHE_SIZE misses have happened since it was last loaded. Adding
+	VERTEX_CACHE_SIZE + 1 to time flushes the cache.
+*/
+static unsigned int SimulateVertexCache(std::vector<unsigned int>& timestamps, unsigned int& time, const unsigned int* triangle)
+{
+	unsigned int misses = 0;
+	for (int k = 0; k < 3; ++k)
+	{
+		unsigned int v = triangle[k];
+		if (time - timestamps[v] > static_cast<unsigned int>(VERTEX_CACHE_SIZE))
+		{
+			timestamps[v] = time++;
+			misses++;
+		}
+	}
+
+	return misses;
+}
+
+VertexCacheStatistics AnalyzeVertexCache(const unsigned int* indices, size_t index_count, size_t vertex_count)
+{
+	VertexCacheStatistics statistics;
+	statistics.acmr = 0.0f;
+	statistics.atvr = 0.0f;
+
+	size_t triangle_count = index_count / 3;
+	if (triangle_count == 0)
+		return statistics;
+
+	std::vector<unsigned int> timestamps(vertex_count, 0);
+	std::vector<bool> referenced(vertex_count, false);
+	unsigned int time = VERTEX_CACHE_SIZE + 1;
+	size_t misses = 0;
+	size_t unique = 0;
+	for (size_t t = 0; t < triangle_count; ++t)
+	{
+		misses += SimulateVertexCache(timestamps, time, &indices[t * 3]);
+		for (int k = 0; k < 3; ++k)
+		{
+			if (!referenced[indices[t * 3 + k]])
+			{
+				referenced[indices[t * 3 + k]] = true;
+				unique++;
+			}
+		}
+	}
+
+	statistics.acmr = static_cast<float>(misses) / triangle_count;
+	statistics.atvr = static_cast<float>(misses) / unique;
+	return statistics;
+}
+
+// Tuning constants from Tom Forsyth's "Linear-Speed Vertex Cache Optimisation".
+static const int FORSYTH_CACHE_SIZE = 32;
+static const float FORSYTH_CACHE_DECAY_POWER = 1.5f;
+static const float FORSYTH_LAST_TRIANGLE_SCORE = 0.75f;
+static const float FORSYTH_VALENCE_BOOST_SCALE = 2.0f;
+static const float FORSYTH_VALENCE_BOOST_POWER = 0.5f;
+
+static float ForsythVertexScore(int cache_position, unsigned int remaining_triangles)
+{
+	if (remaining_triangles == 0)
+		return -1.0f;
+
+	float score = 0.0f;
+	if (cache_position >= 0)
+	{
+		// The vertices of the last triangle get a fixed score, so the next triangle does not simply reuse them.
+		if (cache_position < 3)
+		{
+			score = FORSYTH_LAST_TRIANGLE_SCORE;
+		}
+		else
+		{
+			float scaler = 1.0f / (FORSYTH_CACHE_SIZE - 3);
+			score = std::pow(1.0f - (cache_position - 3) * scaler, FORSYTH_CACHE_DECAY_POWER);
+		}
+	}
+
+	// Boost vertices with few remaining triangles, to finish them off and avoid leaving lone triangles behind.
+	score += FORSYTH_VALENCE_BOOST_SCALE * std::pow(static_cast<float>(remaining_triangles), -FORSYTH_VALENCE_BOOST_POWER);
+	return score;
+}
+
+void OptimizeVertexCache(unsigned int* indices, size_t index_count, size_t vertex_count)
+{
+	size_t triangle_count = index_count / 3;
+	if (triangle_count == 0)
+		return;
+
+	// Build the vertex to triangle adjacency.
+	std::vector<unsigned int> remaining(vertex_count, 0);
+	for (size_t i = 0; i < triangle_count * 3; ++i)
+		remaining[indices[i]]++;
+
+	std::vector<unsigned int> adjacency_offsets(vertex_count + 1, 0);
+	for (size_t v = 0; v < vertex_count; ++v)
+		adjacency_offsets[v + 1] = adjacency_offsets[v] + remaining[v];
+
+	std::vector<unsigned int> adjacency(triangle_count * 3);
+	std::vector<unsigned int> fill(adjacency_offsets.begin(), adjacency_offsets.end() - 1);
+	for (size_t t = 0; t < triangle_count; ++t)
+	{
+		for (int k = 0; k < 3; ++k)
+			adjacency[fill[indices[t * 3 + k]]++] = static_cast<unsigned int>(t);
+	}
+
+	// Initial scores.
+	std::vector<int> cache_positions(vertex_count, -1);
+	std::vector<float> vertex_scores(vertex_count);
+	for (size_t v = 0; v < vertex_count; ++v)
+		vertex_scores[v] = ForsythVertexScore(-1, remaining[v]);
+
+	std::vector<float> triangle_scores(triangle_count);
+	std::vector<bool> emitted(triangle_count, false);
+	for (size_t t = 0; t < triangle_count; ++t)
+	{
+		triangle_scores[t] = vertex_scores[indices[t * 3 + 0]] + vertex_scores[indices[t * 3 + 1]] + vertex_scores[indices[t * 3 + 2]];
+	}
+
+	std::vector<unsigned int> output;
+	output.reserve(triangle_count * 3);
+	std::vector<unsigned int> cache;
+	std::vector<unsigned int> new_cache;
+	cache.reserve(FORSYTH_CACHE_SIZE + 3);
+	new_cache.reserve(FORSYTH_CACHE_SIZE + 3);
+
+	size_t input_cursor = 0;
+	long long best_triangle = -1;
+	while (output.size() < triangle_count * 3)
+	{
+		// Fall back to the next triangle in input order when the cache has nothing to offer.
+		if (best_triangle < 0)
+		{
+			while (emitted[input_cursor])
+				input_cursor++;
+			best_triangle = static_cast<long long>(input_cursor);
+		}
+
+		// Emit the triangle and remove it from the adjacency of its vertices.
+		const unsigned int* triangle = &indices[best_triangle * 3];
+		emitted[best_triangle] = true;
+		for (int k = 0; k < 3; ++k)
+		{
+			unsigned int v = triangle[k];
+			output.push_back(v);
+
+			unsigned int* begin = &adjacency[adjacency_offsets[v]];
+			unsigned int* end = begin + remaining[v];
+			*std::find(begin, end, static_cast<unsigned int>(best_triangle)) = *(end - 1);
+			remaining[v]--;
+		}
+
+		// Move the triangle's vertices to the front of the LRU cache.
+		new_cache.assign(triangle, triangle + 3);
+		for (size_t i = 0; i < cache.size(); ++i)
+		{
+			if (cache[i] != triangle[0] && cache[i] != triangle[1] && cache[i] != triangle[2])
+				new_cache.push_back(cache[i]);
+		}
+
+		// Vertices pushed out of the cache lose their cache bonus; update their triangles to match.
+		for (size_t i = FORSYTH_CACHE_SIZE; i < new_cache.size(); ++i)
+		{
+			unsigned int v = new_cache[i];
+			cache_positions[v] = -1;
+
+			float score = ForsythVertexScore(-1, remaining[v]);
+			float delta = score - vertex_scores[v];
+			vertex_scores[v] = score;
+
+			for (unsigned int a = 0; a < remaining[v]; ++a)
+				triangle_scores[adjacency[adjacency_offsets[v] + a]] += delta;
+		}
+		if (new_cache.size() > static_cast<size_t>(FORSYTH_CACHE_SIZE))
+			new_cache.resize(FORSYTH_CACHE_SIZE);
+
+		cache.swap(new_cache);
+
+		// Update the scores of the vertices in the cache and of their triangles, and pick the best one.
+		best_triangle = -1;
+		float best_score = -1.0f;
+		for (size_t i = 0; i < cache.size(); ++i)
+		{
+			unsigned int v = cache[i];
+			cache_positions[v] = static_cast<int>(i);
+
+			float score = ForsythVertexScore(cache_positions[v], remaining[v]);
+			float delta = score - vertex_scores[v];
+			vertex_scores[v] = score;
+
+			for (unsigned int a = 0; a < remaining[v]; ++a)
+			{
+				unsigned int t = adjacency[adjacency_offsets[v] + a];
+				triangle_scores[t] += delta;
+				if (triangle_scores[t] > best_score)
+				{
+					best_score = triangle_scores[t];
+					best_triangle = t;
+				}
+			}
+		}
+	}
+
+	std::copy(output.begin(), output.end(), indices);
+}
+
+void OptimizeOverdraw(unsigned int* indices, size_t index_count, const glm::vec3* positions, size_t vertex_count, float threshold)
+{
+	size_t triangle_count = index_count / 3;
+	if (triangle_count == 0)
+		return;
+
+	std::vector<unsigned int> timestamps(vertex_count, 0);
+	unsigned int time = VERTEX_CACHE_SIZE + 1;
+
+	// Hard boundaries are triangles without any cache hits; the optimized order already restarts there.
+	std::vector<size_t> hard_boundaries;
+	for (size_t t = 0; t < triangle_count; ++t)
+	{
+		if (SimulateVertexCache(timestamps, time, &indices[t * 3]) == 3)
+			hard_boundaries.push_back(t);
+	}
+
+	hard_boundaries.push_back(triangle_count);
+	if (hard_boundaries.front() != 0)
+		hard_boundaries.insert(hard_boundaries.begin(), 0);
+
+	// Split the hard clusters further where the cache efficiency of the part stays within the threshold.
+	std::vector<size_t> clusters;
+	for (size_t h = 0; h + 1 < hard_boundaries.size(); ++h)
+	{
+		size_t start = hard_boundaries[h];
+		size_t end = hard_boundaries[h + 1];
+
+		time += VERTEX_CACHE_SIZE + 1;
+		unsigned int cluster_misses = 0;
+		for (size_t t = start; t < end; ++t)
+			cluster_misses += SimulateVertexCache(timestamps, time, &indices[t * 3]);
+
+		float cluster_threshold = threshold * cluster_misses / (end - start);
+
+		time += VERTEX_CACHE_SIZE + 1;
+		clusters.push_back(start);
+		size_t part_start = start;
+		unsigned int part_misses = 0;
+		for (size_t t = start; t < end; ++t)
+		{
+			part_misses += SimulateVertexCache(timestamps, time, &indices[t * 3]);
+			if (t + 1 < end && static_cast<float>(part_misses) / (t + 1 - part_start) <= cluster_threshold)
+			{
+				time += VERTEX_CACHE_SIZE + 1;
+				clusters.push_back(t + 1);
+				part_start = t + 1;
+				part_misses = 0;
+			}
+		}
+	}
+
+	clusters.push_back(triangle_count);
+
+	// Sort the clusters by how much they face away from the mesh center. Outward facing clusters on the
+	// outside of the mesh are the most likely to occlude the rest, so they are drawn first.
+	size_t cluster_count = clusters.size() - 1;
+	std::vector<glm::vec3> cluster_centroids(cluster_count, glm::vec3(0.0f));
+	std::vector<glm::vec3> cluster_normals(cluster_count, glm::vec3(0.0f));
+	std::vector<float> cluster_areas(cluster_count, 0.0f);
+	glm::vec3 mesh_centroid(0.0f);
+	float mesh_area = 0.0f;
+	for (size_t c = 0; c < cluster_count; ++c)
+	{
+		for (size_t t = clusters[c]; t < clusters[c + 1]; ++t)
+		{
+			const glm::vec3& p0 = positions[indices[t * 3 + 0]];
+			const glm::vec3& p1 = positions[indices[t * 3 + 1]];
+			const glm::vec3& p2 = positions[indices[t * 3 + 2]];
+			glm::vec3 normal = glm::cross(p1 - p0, p2 - p0);
+			float area = glm::length(normal);
+
+			cluster_centroids[c] += (p0 + p1 + p2) * (area / 3.0f);
+			cluster_normals[c] += normal;
+			cluster_areas[c] += area;
+		}
+
+		mesh_centroid += cluster_centroids[c];
+		mesh_area += cluster_areas[c];
+	}
+
+	if (mesh_area > 0.0f)
+		mesh_centroid /= mesh_area;
+
+	std::vector<float> sort_keys(cluster_count, 0.0f);
+	std::vector<size_t> cluster_order(cluster_count);
+	for (size_t c = 0; c < cluster_count; ++c)
+	{
+		cluster_order[c] = c;
+
+		float normal_length = glm::length(cluster_normals[c]);
+		if (cluster_areas[c] > 0.0f && normal_length > 0.0f)
+		{
+			glm::vec3 centroid = cluster_centroids[c] / cluster_areas[c];
+			sort_keys[c] = glm::dot(centroid - mesh_centroid, cluster_normals[c] / normal_length);
+		}
+	}
+
+	std::stable_sort(cluster_order.begin(), cluster_order.end(), [&sort_keys](size_t a, size_t b) { return sort_keys[a] > sort_keys[b]; });
+
+	std::vector<unsigned int> output;
+	output.reserve(triangle_count * 3);
+	for (size_t i = 0; i < cluster_count; ++i)
+	{
+		size_t c = cluster_order[i];
+		output.insert(output.end(), indices + clusters[c] * 3, indices + clusters[c + 1] * 3);
+	}
+
+	std::copy(output.begin(), output.end(), indices);
+}
+
+void OptimizeVertexFetch(IndexedMesh& mesh)
+{
+	// Assign new vertex indices in order of first use. Unreferenced vertices are dropped.
+	const unsigned int UNUSED = ~0u;
+	std::vector<unsigned int> remap(mesh.positions.size(), UNUSED);
+	unsigned int vertex_count = 0;
+	for (size_t i = 0; i < mesh.indices.size(); ++i)
+	{
+		unsigned int& target = remap[mesh.indices[i]];
+		if (target == UNUSED)
+			target = vertex_count++;
+
+		mesh.indices[i] = target;
+	}
+
+	std::vector<glm::vec3> positions(vertex_count);
+	std::vector<glm::vec3> normals(vertex_count);
+	std::vector<glm::vec2> texcoords(vertex_count);
+	for (size_t v = 0; v < remap.size(); ++v)
+	{
+		if (remap[v] == UNUSED)
+			continue;
+
+		positions[remap[v]] = mesh.positions[v];
+		normals[remap[v]] = mesh.normals[v];
+		texcoords[remap[v]] = mesh.texcoords[v];
+	}
+
+	mesh.positions.swap(positions);
+	mesh.normals.swap(normals);
+	mesh.texcoords.swap(texcoords);
+}
+
+void OptimizeMesh(IndexedMesh& mesh, MeshOptimizationStatistics* statistics)
+{
+	if (statistics != nullptr)
+		statistics->before = AnalyzeVertexCache(mesh.indices.data(), mesh.indices.size(), mesh.positions.size());
+
+	for (size_t i = 0; i < mesh.submeshes.size(); ++i)
+	{
+		unsigned int* indices = mesh.indices.data() + mesh.submeshes[i].first;
+		size_t index_count = mesh.submeshes[i].count;
+
+		OptimizeVertexCache(indices, index_count, mesh.positions.size());
+		OptimizeOverdraw(indices, index_count, mesh.positions.data(), mesh.positions.size(), 1.05f);
+	}
+
+	OptimizeVertexFetch(mesh);
+
+	if (statistics != nullptr)
+		statistics->after = AnalyzeVertexCache(mesh.indices.data(), mesh.indices.size(), mesh.positions.size());
+}
+
+/*
+	Error quadric of a set of planes, weighted by area: error(p) = p^T A p + 2 b.p + c.
+*/
+struct Quadric
+{
+	double a00, a11, a22, a01, a02, a12;
+	double b0, b1, b2;
+	double c;
+	double weight;
+};
+
+static void AddPlaneQuadric(Quadric& quadric, const glm::vec3& normal, float distance, float weight)
+{
+	quadric.a00 += weight * normal.x * normal.x;
+	quadric.a11 += weight * normal.y * normal.y;
+	quadric.a22 += weight * normal.z * normal.z;
+	quadric.a01 += weight * normal.x * normal.y;
+	quadric.a02 += weight * normal.x * normal.z;
+	quadric.a12 += weight * normal.y * normal.z;
+	quadric.b0 += weight * normal.x * distance;
+	quadric.b1 += weight * normal.y * distance;
+	quadric.b2 += weight * normal.z * distance;
+	quadric.c += weight * distance * distance;
+	quadric.weight += weight;
+}
+
+static void AddQuadric(Quadric& quadric, const Quadric& other)
+{
+	quadric.a00 += other.a00;
+	quadric.a11 += other.a11;
+	quadric.a22 += other.a22;
+	quadric.a01 += other.a01;
+	quadric.a02 += other.a02;
+	quadric.a12 += other.a12;
+	quadric.b0 += other.b0;
+	quadric.b1 += other.b1;
+	quadric.b2 += other.b2;
+	quadric.c += other.c;
+	quadric.weight += other.weight;
+}
+
+/*
+	Returns the mean squared distance from p to the planes of the quadric.
+*/
+static float QuadricError(const Quadric& quadric, const glm::vec3& p)
+{
+	double x = p.x, y = p.y, z = p.z;
+	double error = quadric.a00 * x * x + quadric.a11 * y * y + quadric.a22 * z * z
+		+ 2.0 * (quadric.a01 * x * y + quadric.a02 * x * z + quadric.a12 * y * z)
+		+ 2.0 * (quadric.b0 * x + quadric.b1 * y + quadric.b2 * z) + quadric.c;
+
+	return static_cast<float>(std::fabs(error) / (quadric.weight > 0.0 ? quadric.weight : 1.0));
+}
+
+enum VertexKind
+{
+	VERTEX_KIND_MANIFOLD,	// Interior vertex, can be collapsed to any neighbour.
+	VERTEX_KIND_BORDER,		// Vertex on an open border, can only be collapsed along the border.
+	VERTEX_KIND_LOCKED		// Border corner or non-manifold vertex, never collapsed.
+};
+
+struct Collapse
+{
+	unsigned int source;
+	unsigned int target;
+	float error;
+};
+
+static unsigned long long EdgeKey(unsigned int a, unsigned int b)
+{
+	return (static_cast<unsigned long long>(a) << 32) | b;
+}
+
+// Extra weight of the planes that keep open borders in place.
+static const float SIMPLIFY_BORDER_WEIGHT = 10.0f;
+
+float SimplifyMesh(const unsigned int* indices, size_t index_count, const glm::vec3* positions, size_t vertex_count, size_t target_index_count, std::vector<unsigned int>& destination)
+{
+	destination.assign(indices, indices + index_count / 3 * 3);
+	if (destination.size() <= target_index_count)
+		return 0.0f;
+
+	// Group the vertices by position. remap points to the first vertex at the same position, and wedge links all
+	// vertices at the same position (differing in normal or texture coordinate) in a circular list.
+	std::vector<unsigned int> remap(vertex_count);
+	std::vector<unsigned int> wedge(vertex_count);
+	for (size_t v = 0; v < vertex_count; ++v)
+	{
+		remap[v] = static_cast<unsigned int>(v);
+		wedge[v] = static_cast<unsigned int>(v);
+	}
+
+	{
+		std::vector<bool> referenced(vertex_count, false);
+		for (size_t i = 0; i < destination.size(); ++i)
+			referenced[destination[i]] = true;
+
+		std::unordered_multimap<size_t, unsigned int> position_map;
+		for (size_t v = 0; v < vertex_count; ++v)
+		{
+			if (!referenced[v])
+				continue;
+
+			size_t hash = std::hash<float>()(positions[v].x) ^ (std::hash<float>()(positions[v].y) * 31) ^ (std::hash<float>()(positions[v].z) * 131);
+			std::pair<std::unordered_multimap<size_t, unsigned int>::iterator, std::unordered_multimap<size_t, unsigned int>::iterator> range = position_map.equal_range(hash);
+			for (; range.first != range.second; ++range.first)
+			{
+				if (positions[range.first->second] == positions[v])
+					break;
+			}
+
+			if (range.first == range.second)
+			{
+				position_map.insert(std::make_pair(hash, static_cast<unsigned int>(v)));
+			}
+			else
+			{
+				unsigned int r = range.first->second;
+				remap[v] = r;
+				wedge[v] = wedge[r];
+				wedge[r] = static_cast<unsigned int>(v);
+			}
+		}
+	}
+
+	// Build the plane quadrics of the triangles, and of the open border edges. An edge is open if the mesh does not
+	// contain its reverse, comparing positions so that attribute seams are not mistaken for borders.
+	std::unordered_set<unsigned long long> edges;
+	for (size_t i = 0; i < destination.size(); i += 3)
+	{
+		for (int e = 0; e < 3; ++e)
+			edges.insert(EdgeKey(remap[destination[i + e]], remap[destination[i + (e + 1) % 3]]));
+	}
+
+	std::vector<unsigned int> border_edge_count(vertex_count, 0);
+	std::vector<Quadric> quadrics(vertex_count);
+	memset(&quadrics[0], 0, quadrics.size() * sizeof(Quadric));
+	for (size_t i = 0; i < destination.size(); i += 3)
+	{
+		const glm::vec3& p0 = positions[destination[i + 0]];
+		const glm::vec3& p1 = positions[destination[i + 1]];
+		const glm::vec3& p2 = positions[destination[i + 2]];
+		glm::vec3 normal = glm::cross(p1 - p0, p2 - p0);
+		float length = glm::length(normal);
+		if (length == 0.0f)
+			continue;
+
+		normal /= length;
+		for (int e = 0; e < 3; ++e)
+			AddPlaneQuadric(quadrics[remap[destination[i + e]]], normal, -glm::dot(normal, p0), length * 0.5f);
+
+		for (int e = 0; e < 3; ++e)
+		{
+			unsigned int a = remap[destination[i + e]];
+			unsigned int b = remap[destination[i + (e + 1) % 3]];
+			if (edges.find(EdgeKey(b, a)) != edges.end())
+				continue;
+
+			// Keep the border in place with a plane through the edge, perpendicular to the triangle.
+			glm::vec3 edge = positions[b] - positions[a];
+			glm::vec3 border_normal = glm::cross(edge, normal);
+			float border_length = glm::length(border_normal);
+			if (border_length > 0.0f)
+			{
+				border_normal /= border_length;
+				float weight = glm::dot(edge, edge) * SIMPLIFY_BORDER_WEIGHT;
+				AddPlaneQuadric(quadrics[a], border_normal, -glm::dot(border_normal, positions[a]), weight);
+				AddPlaneQuadric(quadrics[b], border_normal, -glm::dot(border_normal, positions[a]), weight);
+			}
+
+			border_edge_count[a]++;
+			border_edge_count[b]++;
+		}
+	}
+
+	// Classify the vertices by position. Vertices with more than two border edges are corners of the border.
+	std::vector<unsigned char> kinds(vertex_count, VERTEX_KIND_LOCKED);
+	for (size_t v = 0; v < vertex_count; ++v)
+	{
+		unsigned int border_edges = border_edge_count[remap[v]];
+		if (border_edges == 0)
+			kinds[v] = VERTEX_KIND_MANIFOLD;
+		else if (border_edges == 2)
+			kinds[v] = VERTEX_KIND_BORDER;
+	}
+
+	size_t target_triangle_count = target_index_count / 3;
+	float max_error = 0.0f;
+
+	std::vector<unsigned int> adjacency_offsets(vertex_count + 1);
+	std::vector<unsigned int> adjacency;
+	std::vector<Collapse> collapses;
+	std::vector<unsigned int> collapse_remap(vertex_count);
+	std::vector<bool> collapse_locked(vertex_count);
+	std::vector<unsigned int> wedge_targets;
+	while (destination.size() / 3 > target_triangle_count)
+	{
+		size_t triangle_count = destination.size() / 3;
+
+		// Build the vertex to triangle adjacency and the edges of the current triangles.
+		std::fill(adjacency_offsets.begin(), adjacency_offsets.end(), 0);
+		for (size_t i = 0; i < destination.size(); ++i)
+			adjacency_offsets[destination[i] + 1]++;
+		for (size_t v = 0; v < vertex_count; ++v)
+			adjacency_offsets[v + 1] += adjacency_offsets[v];
+
+		adjacency.resize(destination.size());
+		std::vector<unsigned int> fill(adjacency_offsets.begin(), adjacency_offsets.end() - 1);
+		for (size_t i = 0; i < destination.size(); ++i)
+			adjacency[fill[destination[i]]++] = static_cast<unsigned int>(i / 3);
+
+		edges.clear();
+		for (size_t i = 0; i < destination.size(); i += 3)
+		{
+			for (int e = 0; e < 3; ++e)
+				edges.insert(EdgeKey(remap[destination[i + e]], remap[destination[i + (e + 1) % 3]]));
+		}
+
+		// Gather the allowed collapses along each edge, in both directions.
+		collapses.clear();
+		for (size_t i = 0; i < destination.size(); i += 3)
+		{
+			for (int e = 0; e < 3; ++e)
+			{
+				unsigned int a = destination[i + e];
+				unsigned int b = destination[i + (e + 1) % 3];
+				bool border = edges.find(EdgeKey(remap[b], remap[a])) == edges.end();
+
+				for (int direction = 0; direction < 2; ++direction)
+				{
+					unsigned int source = direction == 0 ? a : b;
+					unsigned int target = direction == 0 ? b : a;
+					if (kinds[source] == VERTEX_KIND_MANIFOLD || (kinds[source] == VERTEX_KIND_BORDER && border))
+					{
+						Collapse collapse = { source, target, QuadricError(quadrics[remap[source]], positions[target]) };
+						collapses.push_back(collapse);
+					}
+				}
+			}
+		}
+
+		if (collapses.empty())
+			break;
+
+		std::sort(collapses.begin(), collapses.end(), [](const Collapse& a, const Collapse& b) { return a.error < b.error; });
+
+		// Each collapse removes about two triangles. Only collapses up to the error of the one that would reach the
+		// target count are done in this pass, since the locks below skip some of the cheaper ones. The cheapest
+		// collapse that passes the checks is always done, so every pass makes progress.
+		size_t collapse_goal = std::max<size_t>((triangle_count - target_triangle_count) / 2, 1);
+		float pass_error_limit = collapses[std::min(collapse_goal, collapses.size()) - 1].error;
+
+		for (size_t v = 0; v < vertex_count; ++v)
+			collapse_remap[v] = static_cast<unsigned int>(v);
+		std::fill(collapse_locked.begin(), collapse_locked.end(), false);
+
+		size_t triangles_removed = 0;
+		size_t collapses_done = 0;
+		for (size_t c = 0; c < collapses.size(); ++c)
+		{
+			const Collapse& collapse = collapses[c];
+			if ((collapse.error > pass_error_limit && collapses_done > 0) || triangles_removed >= triangle_count - target_triangle_count)
+				break;
+
+			unsigned int source_position = remap[collapse.source];
+			unsigned int target_position = remap[collapse.target];
+			if (collapse_locked[source_position] || collapse_locked[target_position])
+				continue;
+
+			// Every vertex at the source position must have a neighbour at the target position to collapse onto.
+			// This keeps the attributes on both sides of a UV or normal seam, and only allows seams to be collapsed
+			// along the seam. Collapses that flip a triangle around the source are rejected as well.
+			wedge_targets.clear();
+			bool rejected = false;
+			size_t removed = 0;
+			unsigned int w = collapse.source;
+			do
+			{
+				unsigned int wedge_target = ~0u;
+				for (unsigned int a = adjacency_offsets[w]; a < adjacency_offsets[w + 1] && !rejected; ++a)
+				{
+					const unsigned int* triangle = &destination[adjacency[a] * 3];
+					bool removed_triangle = false;
+					for (int k = 0; k < 3; ++k)
+					{
+						if (remap[triangle[k]] == target_position)
+						{
+							wedge_target = triangle[k];
+							removed_triangle = true;
+						}
+					}
+
+					if (removed_triangle)
+					{
+						removed++;
+						continue;
+					}
+
+					glm::vec3 p[3];
+					glm::vec3 q[3];
+					for (int k = 0; k < 3; ++k)
+					{
+						p[k] = positions[triangle[k]];
+						q[k] = remap[triangle[k]] == source_position ? positions[collapse.target] : p[k];
+					}
+
+					glm::vec3 before = glm::cross(p[1] - p[0], p[2] - p[0]);
+					glm::vec3 after = glm::cross(q[1] - q[0], q[2] - q[0]);
+					rejected = glm::dot(before, after) <= 0.0f;
+				}
+
+				rejected = rejected || (adjacency_offsets[w] != adjacency_offsets[w + 1] && wedge_target == ~0u);
+				wedge_targets.push_back(wedge_target);
+				w = wedge[w];
+			} while (w != collapse.source && !rejected);
+
+			if (rejected)
+				continue;
+
+			w = collapse.source;
+			for (size_t i = 0; i < wedge_targets.size(); ++i, w = wedge[w])
+			{
+				if (wedge_targets[i] != ~0u)
+					collapse_remap[w] = wedge_targets[i];
+			}
+
+			AddQuadric(quadrics[target_position], quadrics[source_position]);
+			collapse_locked[source_position] = true;
+			collapse_locked[target_position] = true;
+			max_error = std::max(max_error, collapse.error);
+			triangles_removed += removed;
+			collapses_done++;
+		}
+
+		if (collapses_done == 0)
+			break;
+
+		// Apply the collapses and remove the triangles that became degenerate.
+		size_t write = 0;
+		for (size_t i = 0; i < destination.size(); i += 3)
+		{
+			unsigned int a = collapse_remap[destination[i + 0]];
+			unsigned int b = collapse_remap[destination[i + 1]];
+			unsigned int c = collapse_remap[destination[i + 2]];
+			if (remap[a] == remap[b] || remap[a] == remap[c] || remap[b] == remap[c])
+				continue;
+
+			destination[write++] = a;
+			destination[write++] = b;
+			destination[write++] = c;
+		}
+
+		destination.resize(write);
+	}
+
+	return std::sqrt(max_error);
+}
+
+void BuildMeshLODs(IndexedMesh& mesh, const float* ratios, size_t ratio_count, std::vector<MeshLOD>& lods)
+{
+	lods.clear();
+
+	MeshLOD full_detail;
+	full_detail.submeshes = mesh.submeshes;
+	full_detail.error = 0.0f;
+	lods.push_back(full_detail);
+
+	size_t previous_index_count = mesh.indices.size();
+	std::vector<unsigned int> lod_indices;
+	std::vector<unsigned int> simplified;
+	for (size_t r = 0; r < ratio_count; ++r)
+	{
+		// Simplify from the full detail mesh each time, so the errors do not accumulate over the chain.
+		MeshLOD lod;
+		lod.submeshes = mesh.submeshes;
+		lod.error = 0.0f;
+		lod_indices.clear();
+		for (size_t i = 0; i < mesh.submeshes.size(); ++i)
+		{
+			const OBJSubmesh& submesh = mesh.submeshes[i];
+			size_t target_index_count = static_cast<size_t>(submesh.count / 3 * ratios[r]) * 3;
+			float error = SimplifyMesh(&mesh.indices[submesh.first], submesh.count, &mesh.positions[0], mesh.positions.size(), target_index_count, simplified);
+			OptimizeVertexCache(simplified.data(), simplified.size(), mesh.positions.size());
+
+			lod.submeshes[i].first = static_cast<unsigned int>(mesh.indices.size() + lod_indices.size());
+			lod.submeshes[i].count = static_cast<unsigned int>(simplified.size());
+			lod.error = std::max(lod.error, error);
+			lod_indices.insert(lod_indices.end(), simplified.begin(), simplified.end());
+		}
+
+		// Seams and borders may stop the simplification short of the target. End the chain once a level no longer
+		// removes any triangles.
+		if (lod_indices.size() >= previous_index_count)
+			break;
+
+		previous_index_count = lod_indices.size();
+		mesh.indices.insert(mesh.indices.end(), lod_indices.begin(), lod_indices.end());
+		lods.push_back(lod);
+	}
+}
+
+int SelectMeshLOD(const std::vector<MeshLOD>& lods, float distance, float pixels_per_unit, float max_pixel_error)
+{
+	for (int i = static_cast<int>(lods.size()) - 1; i > 0; --i)
+	{
+		if (lods[i].error * pixels_per_unit <= max_pixel_error * distance)
+			return i;
+	}
+
+	return 0;
+}
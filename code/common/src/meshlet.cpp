@@ -0,0 +1,276 @@
+#include "../include/common/meshlet.h"
+#include <algorithm>
+#include <cmath>
+#include <unordered_map>
+
+/*
+	Compute the bounding sphere and normal cone of a finished meshlet.
+*/
+static void ComputeMeshletBounds(Meshlet& meshlet, const glm::vec3* positions, const std::vector<unsigned int>& meshlet_vertices, const std::vector<unsigned char>& meshlet_triangles)
+{
+	const unsigned int* vertices = &meshlet_vertices[meshlet.vertex_offset];
+	const unsigned char* triangles = &meshlet_triangles[meshlet.triangle_offset];
+
+	// Ritter's bounding sphere: start from the two vertices furthest apart along x, y or z and grow to fit the rest.
+	unsigned int min_vertex[3] = { 0, 0, 0 };
+	unsigned int max_vertex[3] = { 0, 0, 0 };
+	for (unsigned int i = 0; i < meshlet.vertex_count; ++i)
+	{
+		const glm::vec3& p = positions[vertices[i]];
+		for (int axis = 0; axis < 3; ++axis)
+		{
+			if (p[axis] < positions[vertices[min_vertex[axis]]][axis])
+				min_vertex[axis] = i;
+			if (p[axis] > positions[vertices[max_vertex[axis]]][axis])
+				max_vertex[axis] = i;
+		}
+	}
+
+	int widest_axis = 0;
+	float widest_distance = 0.0f;
+	for (int axis = 0; axis < 3; ++axis)
+	{
+		float distance = glm::length(positions[vertices[max_vertex[axis]]] - positions[vertices[min_vertex[axis]]]);
+		if (distance > widest_distance)
+		{
+			widest_distance = distance;
+			widest_axis = axis;
+		}
+	}
+
+	glm::vec3 center = (positions[vertices[min_vertex[widest_axis]]] + positions[vertices[max_vertex[widest_axis]]]) * 0.5f;
+	float radius = widest_distance * 0.5f;
+	for (unsigned int i = 0; i < meshlet.vertex_count; ++i)
+	{
+		const glm::vec3& p = positions[vertices[i]];
+		float distance = glm::length(p - center);
+		if (distance > radius)
+		{
+			float grown_radius = (radius + distance) * 0.5f;
+			center += (p - center) * ((grown_radius - radius) / distance);
+			radius = grown_radius;
+		}
+	}
+
+	meshlet.center = center;
+	meshlet.radius = radius;
+
+	// The cone axis is the average triangle normal and the cone contains all triangle normals.
+	std::vector<glm::vec3> normals(meshlet.triangle_count, glm::vec3(0.0f));
+	glm::vec3 axis(0.0f);
+	for (unsigned int t = 0; t < meshlet.triangle_count; ++t)
+	{
+		const glm::vec3& p0 = positions[vertices[triangles[t * 3 + 0]]];
+		const glm::vec3& p1 = positions[vertices[triangles[t * 3 + 1]]];
+		const glm::vec3& p2 = positions[vertices[triangles[t * 3 + 2]]];
+		glm::vec3 normal = glm::cross(p1 - p0, p2 - p0);
+		float length = glm::length(normal);
+		if (length > 0.0f)
+			normals[t] = normal / length;
+
+		axis += normals[t];
+	}
+
+	meshlet.cone_apex = center;
+	meshlet.cone_axis = glm::vec3(0.0f, 0.0f, 1.0f);
+	meshlet.cone_cutoff = 2.0f;
+
+	float axis_length = glm::length(axis);
+	if (axis_length == 0.0f)
+		return;
+
+	axis /= axis_length;
+	float min_dot = 1.0f;
+	for (unsigned int t = 0; t < meshlet.triangle_count; ++t)
+		min_dot = std::min(min_dot, glm::dot(normals[t], axis));
+
+	// Cones wider than about 85 degrees reject almost nothing, leave those unculled.
+	if (min_dot <= 0.1f)
+		return;
+
+	// Move the apex back along the axis until it is behind all triangle planes, so the test is conservative for
+	// cameras close to the meshlet.
+	float max_t = 0.0f;
+	for (unsigned int t = 0; t < meshlet.triangle_count; ++t)
+	{
+		const glm::vec3& p0 = positions[vertices[triangles[t * 3 + 0]]];
+		float denominator = glm::dot(normals[t], axis);
+		if (denominator > 0.0f)
+			max_t = std::max(max_t, glm::dot(center - p0, normals[t]) / denominator);
+	}
+
+	meshlet.cone_apex = center - axis * max_t;
+	meshlet.cone_axis = axis;
+	meshlet.cone_cutoff = std::sqrt(1.0f - min_dot * min_dot);
+}
+
+struct PositionHash
+{
+	size_t operator()(const glm::vec3& position) const
+	{
+		std::hash<float> hash;
+		return hash(position.x) ^ (hash(position.y) * 31) ^ (hash(position.z) * 131);
+	}
+};
+
+// Smallest cosine allowed between a triangle normal and the average normal of the meshlet it is added to.
+static const float MESHLET_MIN_NORMAL_DOT = 0.5f;
+
+void BuildMeshlets(const unsigned int* indices, size_t index_count, const glm::vec3* positions, size_t vertex_count,
+	std::vector<Meshlet>& meshlets, std::vector<unsigned int>& meshlet_vertices, std::vector<unsigned char>& meshlet_triangles)
+{
+	meshlets.clear();
+	meshlet_vertices.clear();
+	meshlet_triangles.clear();
+
+	size_t triangle_count = index_count / 3;
+	if (triangle_count == 0)
+		return;
+
+	// Build the triangle adjacency by position rather than by vertex, so meshlets can grow across UV and normal
+	// seams. remap points to the first vertex at the same position.
+	std::vector<unsigned int> remap(vertex_count);
+	{
+		std::unordered_map<glm::vec3, unsigned int, PositionHash> position_map;
+		for (size_t v = 0; v < vertex_count; ++v)
+			remap[v] = position_map.insert(std::make_pair(positions[v], static_cast<unsigned int>(v))).first->second;
+	}
+
+	std::vector<unsigned int> adjacency_offsets(vertex_count + 1, 0);
+	for (size_t i = 0; i < triangle_count * 3; ++i)
+		adjacency_offsets[remap[indices[i]] + 1]++;
+	for (size_t v = 0; v < vertex_count; ++v)
+		adjacency_offsets[v + 1] += adjacency_offsets[v];
+
+	std::vector<unsigned int> adjacency(triangle_count * 3);
+	std::vector<unsigned int> fill(adjacency_offsets.begin(), adjacency_offsets.end() - 1);
+	for (size_t i = 0; i < triangle_count * 3; ++i)
+		adjacency[fill[remap[indices[i]]]++] = static_cast<unsigned int>(i / 3);
+
+	std::vector<glm::vec3> normals(triangle_count, glm::vec3(0.0f));
+	for (size_t t = 0; t < triangle_count; ++t)
+	{
+		const glm::vec3& p0 = positions[indices[t * 3 + 0]];
+		glm::vec3 normal = glm::cross(positions[indices[t * 3 + 1]] - p0, positions[indices[t * 3 + 2]] - p0);
+		float length = glm::length(normal);
+		if (length > 0.0f)
+			normals[t] = normal / length;
+	}
+
+	// Local index of each mesh vertex in the current meshlet, or 0xff if it is not in it.
+	std::vector<unsigned char> local_indices(vertex_count, 0xff);
+	std::vector<bool> emitted(triangle_count, false);
+	size_t emitted_count = 0;
+	size_t input_cursor = 0;
+
+	Meshlet meshlet = {};
+	glm::vec3 meshlet_normal(0.0f);
+	while (emitted_count < triangle_count)
+	{
+		// Grow the meshlet with the neighbouring triangle that adds the fewest vertices, preferring the one that
+		// faces most like the meshlet. Neighbours facing too far away are left out, since they would make the
+		// normal cone too wide to cull anything.
+		long long best_triangle = -1;
+		unsigned int best_new_vertices = 4;
+		float best_dot = -2.0f;
+		glm::vec3 average_normal = glm::length(meshlet_normal) > 0.0f ? glm::normalize(meshlet_normal) : glm::vec3(0.0f);
+		for (unsigned int v = 0; v < meshlet.vertex_count; ++v)
+		{
+			unsigned int vertex = remap[meshlet_vertices[meshlet.vertex_offset + v]];
+			for (unsigned int a = adjacency_offsets[vertex]; a < adjacency_offsets[vertex + 1]; ++a)
+			{
+				unsigned int t = adjacency[a];
+				if (emitted[t])
+					continue;
+
+				unsigned int new_vertices = 0;
+				for (int k = 0; k < 3; ++k)
+				{
+					if (local_indices[indices[t * 3 + k]] == 0xff)
+						new_vertices++;
+				}
+
+				float dot = glm::dot(normals[t], average_normal);
+				if (meshlet.vertex_count + new_vertices > MESHLET_MAX_VERTICES || dot < MESHLET_MIN_NORMAL_DOT)
+					continue;
+
+				if (new_vertices < best_new_vertices || (new_vertices == best_new_vertices && dot > best_dot))
+				{
+					best_triangle = t;
+					best_new_vertices = new_vertices;
+					best_dot = dot;
+				}
+			}
+		}
+
+		// Finish the meshlet when it is full or has no more neighbours to grow with, and start the next one from
+		// the first remaining triangle in index buffer order.
+		if (best_triangle < 0 || meshlet.triangle_count == MESHLET_MAX_TRIANGLES)
+		{
+			if (meshlet.triangle_count > 0)
+			{
+				for (unsigned int v = 0; v < meshlet.vertex_count; ++v)
+					local_indices[meshlet_vertices[meshlet.vertex_offset + v]] = 0xff;
+
+				ComputeMeshletBounds(meshlet, positions, meshlet_vertices, meshlet_triangles);
+				meshlets.push_back(meshlet);
+
+				meshlet = Meshlet();
+				meshlet.vertex_offset = static_cast<unsigned int>(meshlet_vertices.size());
+				meshlet.triangle_offset = static_cast<unsigned int>(meshlet_triangles.size());
+				meshlet_normal = glm::vec3(0.0f);
+			}
+
+			while (emitted[input_cursor])
+				input_cursor++;
+			best_triangle = static_cast<long long>(input_cursor);
+		}
+
+		for (int k = 0; k < 3; ++k)
+		{
+			unsigned int vertex = indices[best_triangle * 3 + k];
+			unsigned char& local = local_indices[vertex];
+			if (local == 0xff)
+			{
+				local = static_cast<unsigned char>(meshlet.vertex_count++);
+				meshlet_vertices.push_back(vertex);
+			}
+
+			meshlet_triangles.push_back(local);
+		}
+
+		emitted[best_triangle] = true;
+		emitted_count++;
+		meshlet.triangle_count++;
+		meshlet_normal += normals[best_triangle];
+	}
+
+	ComputeMeshletBounds(meshlet, positions, meshlet_vertices, meshlet_triangles);
+	meshlets.push_back(meshlet);
+}
+
+size_t CullMeshlets(const std::vector<Meshlet>& meshlets, const glm::vec4 planes[6], const glm::vec3& camera_position, std::vector<unsigned int>& visible)
+{
+	visible.clear();
+
+	size_t triangle_count = 0;
+	for (size_t i = 0; i < meshlets.size(); ++i)
+	{
+		const Meshlet& meshlet = meshlets[i];
+
+		bool outside = false;
+		for (int p = 0; p < 6 && !outside; ++p)
+			outside = glm::dot(glm::vec3(planes[p]), meshlet.center) + planes[p].w < -meshlet.radius;
+
+		if (outside)
+			continue;
+
+		if (glm::dot(glm::normalize(meshlet.cone_apex - camera_position), meshlet.cone_axis) >= meshlet.cone_cutoff)
+			continue;
+
+		visible.push_back(static_cast<unsigned int>(i));
+		triangle_count += meshlet.triangle_count;
+	}
+
+	return triangle_count;
+}
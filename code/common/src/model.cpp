@@ -1,145 +1,572 @@
 #include "../include/common/model.h"
-#include <fstream>
+#include "../include/common/fileio.h"
 #include <string>
 #include <sstream>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <unordered_map>
+#include <thread>
 
-bool LoadOBJ(const char* filepath, OBJ& model)
+/*
+	The indices of a face corner as written in the file. Zero means that the attribute was not given.
+*/
+struct OBJCorner
 {
-	bool result = true;
-	std::ifstream file(filepath);
+	int v;
+	int vt;
+	int vn;
+};
+
+/*
+	A face corner resolved into zero-based indices into the attribute tables. -1 means that the attribute is absent.
+*/
+struct OBJResolvedCorner
+{
+	int v;
+	int vt;
+	int vn;
+};
+
+static bool IsLineEnd(char c)
+{
+	return c == '\n' || c == '\r' || c == '\0';
+}
+
+static const char* SkipSpace(const char* p)
+{
+	while (*p == ' ' || *p == '\t')
+		++p;
+	return p;
+}
+
+static const char* SkipLine(const char* p, const char* end)
+{
+	const char* newline = static_cast<const char*>(memchr(p, '\n', end - p));
+	return newline != nullptr ? newline + 1 : end;
+}
+
+static bool MatchKeyword(const char* p, const char* keyword, size_t length)
+{
+	return strncmp(p, keyword, length) == 0 && (p[length] == ' ' || p[length] == '\t' || IsLineEnd(p[length]));
+}
+
+static bool ParseFloat(const char*& p, float& value)
+{
+	// strtof skips newlines as whitespace, so make sure the value is on this line.
+	p = SkipSpace(p);
+	if (IsLineEnd(*p))
+		return false;
+
+	char* next;
+	value = strtof(p, &next);
+	if (next == p)
+		return false;
+
+	p = next;
+	return true;
+}
+
+static bool ParseIndex(const char*& p, int& value)
+{
+	bool negative = false;
+	if (*p == '-')
+	{
+		negative = true;
+		++p;
+	}
+
+	if (*p < '0' || *p > '9')
+		return false;
+
+	int result = 0;
+	while (*p >= '0' && *p <= '9')
+	{
+		result = result * 10 + (*p - '0');
+		++p;
+	}
+
+	value = negative ? -result : result;
+	return true;
+}
+
+static bool ParseCorner(const char*& p, OBJCorner& corner)
+{
+	corner.vt = 0;
+	corner.vn = 0;
+
+	if (!ParseIndex(p, corner.v))
+		return false;
+
+	if (*p == '/')
+	{
+		++p;
+		if (*p != '/' && !ParseIndex(p, corner.vt))
+			return false;
+
+		if (*p == '/')
+		{
+			++p;
+			if (!ParseIndex(p, corner.vn))
+				return false;
+		}
+	}
+
+	return *p == ' ' || *p == '\t' || IsLineEnd(*p);
+}
+
+/*
+	Convert a one-based (or negative, relative to the end) OBJ index into a zero-based index.
+	Returns false if the index is out of range.
+*/
+static bool ResolveIndex(int index, size_t count, int& resolved)
+{
+	resolved = index > 0 ? index - 1 : static_cast<int>(count) + index;
+	return index != 0 && resolved >= 0 && static_cast<size_t>(resolved) < count;
+}
 
+/*
+	Hash of a face corner, used to merge identical corners within a batch.
+*/
+struct OBJCornerHash
+{
+	size_t operator()(const OBJResolvedCorner& corner) const
+	{
+		return static_cast<size_t>(corner.v) * 73856093u ^ static_cast<size_t>(corner.vt) * 19349663u ^ static_cast<size_t>(corner.vn) * 83492791u;
+	}
+};
+
+struct OBJCornerEqual
+{
+	bool operator()(const OBJResolvedCorner& a, const OBJResolvedCorner& b) const
+	{
+		return a.v == b.v && a.vt == b.vt && a.vn == b.vn;
+	}
+};
+
+/*
+	Parser state of StreamOBJ.
+*/
+struct OBJStream
+{
 	std::vector<glm::vec3> positionLUT;
 	std::vector<glm::vec3> normalLUT;
 	std::vector<glm::vec2> texcoordLUT;
-	if (file.is_open())
-	{
-		while (!file.eof())
-		{
-			std::string line;
-			std::stringstream ss;
+	std::vector<OBJResolvedCorner> face;
+	std::unordered_map<OBJResolvedCorner, unsigned int, OBJCornerHash, OBJCornerEqual> batch_corners;
+	OBJBatch batch;
+	bool submesh_has_faces;
+	size_t max_batch_vertices;
+	OBJBatchCallback callback;
+	void* user_data;
+};
 
-			std::getline(file, line, '\n');
-			ss.str(line);
+static bool FlushBatch(OBJStream& stream)
+{
+	bool result = true;
+	if (!stream.batch.indices.empty())
+		result = stream.callback(stream.batch, stream.user_data);
 
-			std::string identifier;
-			ss >> identifier;
+	stream.batch.positions.clear();
+	stream.batch.normals.clear();
+	stream.batch.texcoords.clear();
+	stream.batch.position_indices.clear();
+	stream.batch.face_normals.clear();
+	stream.batch.indices.clear();
+	stream.batch_corners.clear();
+	return result;
+}
 
-			if (identifier == "v")
-			{
-				glm::vec3 position;
+/*
+	Start a new submesh on an o, g or usemtl statement. The current submesh is reused if it has no faces yet.
+*/
+static bool BeginSubmesh(OBJStream& stream)
+{
+	if (!FlushBatch(stream))
+		return false;
 
-				ss >> position.x;
-				ss >> position.y;
-				ss >> position.z;
+	if (stream.submesh_has_faces)
+	{
+		stream.batch.submesh++;
+		stream.submesh_has_faces = false;
+	}
 
-				if (ss.fail() || ss.bad())
-				{
-					result = false;
-					break;
-				}
-				
-				positionLUT.push_back(position);
-			}
-			else if (identifier == "vn")
-			{
-				glm::vec3 normal;
+	return true;
+}
 
-				ss >> normal.x;
-				ss >> normal.y;
-				ss >> normal.z;
+static bool ParseFace(OBJStream& stream, const char* c)
+{
+	// Resolve all corners up front, so that triangulation only copies attributes.
+	stream.face.clear();
+	for (c = SkipSpace(c); !IsLineEnd(*c); c = SkipSpace(c))
+	{
+		OBJCorner corner;
+		OBJResolvedCorner resolved;
+		if (!ParseCorner(c, corner) ||
+			!ResolveIndex(corner.v, stream.positionLUT.size(), resolved.v) ||
+			(corner.vt != 0 && !ResolveIndex(corner.vt, stream.texcoordLUT.size(), resolved.vt)) ||
+			(corner.vn != 0 && !ResolveIndex(corner.vn, stream.normalLUT.size(), resolved.vn)))
+		{
+			return false;
+		}
 
-				if (ss.fail() || ss.bad())
-				{
-					result = false;
-					break;
-				}
+		if (corner.vt == 0)
+			resolved.vt = -1;
+		if (corner.vn == 0)
+			resolved.vn = -1;
 
-				normalLUT.push_back(normal);
-			}
-			else if (identifier == "vt")
-			{
-				glm::vec2 texcoord;
+		stream.face.push_back(resolved);
+	}
 
-				ss >> texcoord.s;
-				ss >> texcoord.t;
+	if (stream.face.size() < 3)
+		return false;
 
-				if (ss.fail() || ss.bad())
-				{
-					result = false;
-					break;
-				}
+	stream.submesh_has_faces = true;
 
-				texcoord.t = 1.0f - texcoord.t;
-				texcoordLUT.push_back(texcoord);
-			}
-			else if (identifier == "f")
+	// Fan triangulate the face. A triangle takes exactly one trip through the loop.
+	OBJBatch& batch = stream.batch;
+	for (size_t i = 1; i + 1 < stream.face.size(); ++i)
+	{
+		const OBJResolvedCorner triangle[] = { stream.face[0], stream.face[i], stream.face[i + 1] };
+
+		// Make room for three new vertices and one triangle.
+		if (batch.positions.size() + 3 > stream.max_batch_vertices || batch.indices.size() + 3 > stream.max_batch_vertices * 6)
+		{
+			if (!FlushBatch(stream))
+				return false;
+		}
+
+		glm::vec3 face_normal(0.0f);
+		if (triangle[0].vn < 0 || triangle[1].vn < 0 || triangle[2].vn < 0)
+		{
+			const glm::vec3& p0 = stream.positionLUT[triangle[0].v];
+			const glm::vec3& p1 = stream.positionLUT[triangle[1].v];
+			const glm::vec3& p2 = stream.positionLUT[triangle[2].v];
+			glm::vec3 n = glm::cross(p1 - p0, p2 - p0);
+			float length = glm::length(n);
+			face_normal = length > 0.0f ? n / length : glm::vec3(0.0f, 1.0f, 0.0f);
+		}
+
+		for (int k = 0; k < 3; ++k)
+		{
+			// Corners with a face normal are unique to their triangle, the others are merged within the batch.
+			unsigned int index = static_cast<unsigned int>(batch.positions.size());
+			if (triangle[k].vn >= 0)
 			{
-				for (int i = 0; i < 3; ++i)
-				{
-					unsigned int v;
-					unsigned int vt;
-					unsigned int vn;
-
-					ss >> v;
-					ss.ignore();
-					ss >> vt;
-					ss.ignore();
-					ss >> vn;
-
-					if (ss.fail() || ss.bad())
-					{
-						result = false;
-						break;
-					}
-
-					v = v - 1;
-					vt = vt - 1;
-					vn = vn - 1;
-
-					model.positions.push_back(positionLUT[v]);
-					model.texcoords.push_back(texcoordLUT[vt]);
-					model.normals.push_back(normalLUT[vn]);
-				}
+				std::pair<std::unordered_map<OBJResolvedCorner, unsigned int, OBJCornerHash, OBJCornerEqual>::iterator, bool> inserted =
+					stream.batch_corners.insert(std::make_pair(triangle[k], index));
+				index = inserted.first->second;
 			}
-			else if (identifier == "mtllib")
+
+			if (index == batch.positions.size())
 			{
-				ss >> model.mtllib;
+				batch.positions.push_back(stream.positionLUT[triangle[k].v]);
+				batch.texcoords.push_back(triangle[k].vt >= 0 ? stream.texcoordLUT[triangle[k].vt] : glm::vec2(0.0f));
+				batch.normals.push_back(triangle[k].vn >= 0 ? stream.normalLUT[triangle[k].vn] : face_normal);
+				batch.position_indices.push_back(static_cast<unsigned int>(triangle[k].v));
+				batch.face_normals.push_back(triangle[k].vn < 0);
 			}
+
+			batch.indices.push_back(index);
 		}
 	}
-	else
+
+	return true;
+}
+
+static bool ParseLine(OBJStream& stream, const char* line, const char* end)
+{
+	if (line[0] == 'f' && (line[1] == ' ' || line[1] == '\t'))
 	{
-		result = false;
+		return ParseFace(stream, line + 1);
 	}
+	else if (line[0] == 'v' && (line[1] == ' ' || line[1] == '\t'))
+	{
+		const char* c = line + 1;
+		glm::vec3 position;
+		if (!ParseFloat(c, position.x) || !ParseFloat(c, position.y) || !ParseFloat(c, position.z))
+			return false;
 
-	if (!result)
+		stream.positionLUT.push_back(position);
+	}
+	else if (MatchKeyword(line, "vn", 2))
+	{
+		const char* c = line + 2;
+		glm::vec3 normal;
+		if (!ParseFloat(c, normal.x) || !ParseFloat(c, normal.y) || !ParseFloat(c, normal.z))
+			return false;
+
+		stream.normalLUT.push_back(normal);
+	}
+	else if (MatchKeyword(line, "vt", 2))
+	{
+		// The third (w) texture coordinate is optional and ignored.
+		const char* c = line + 2;
+		glm::vec2 texcoord;
+		if (!ParseFloat(c, texcoord.s))
+			return false;
+
+		if (!ParseFloat(c, texcoord.t))
+			texcoord.t = 0.0f;
+
+		texcoord.t = 1.0f - texcoord.t;
+		stream.texcoordLUT.push_back(texcoord);
+	}
+	else if (MatchKeyword(line, "o", 1) || MatchKeyword(line, "g", 1))
+	{
+		if (!BeginSubmesh(stream))
+			return false;
+
+		std::stringstream ss(std::string(line + 1, SkipLine(line, end)));
+		stream.batch.name.clear();
+		ss >> stream.batch.name;
+	}
+	else if (MatchKeyword(line, "usemtl", 6))
+	{
+		if (!BeginSubmesh(stream))
+			return false;
+
+		std::stringstream ss(std::string(line + 6, SkipLine(line, end)));
+		stream.batch.material.clear();
+		ss >> stream.batch.material;
+	}
+	else if (MatchKeyword(line, "mtllib", 6))
+	{
+		std::stringstream ss(std::string(line + 6, SkipLine(line, end)));
+		ss >> stream.batch.mtllib;
+	}
+
+	return true;
+}
+
+bool StreamOBJ(const char* filepath, size_t max_batch_vertices, OBJBatchCallback callback, void* user_data)
+{
+	MappedFile file;
+	if (max_batch_vertices < 3 || !file.Open(filepath))
+		return false;
+
+	OBJStream stream;
+	stream.batch.submesh = 0;
+	stream.submesh_has_faces = false;
+	stream.max_batch_vertices = max_batch_vertices;
+	stream.callback = callback;
+	stream.user_data = user_data;
+
+	// Parse the lines in place. Every parsed line has to end with a newline, so a last line without one is copied
+	// into a buffer and gets one appended.
+	const char* begin = file.GetData();
+	const char* end = begin + file.GetSize();
+	const char* lines_end = end;
+	while (lines_end > begin && lines_end[-1] != '\n')
+		--lines_end;
+
+	bool result = true;
+	const char* p = begin;
+	while (p < lines_end && result)
+	{
+		const char* line = SkipSpace(p);
+		p = SkipLine(p, lines_end);
+		result = ParseLine(stream, line, lines_end);
+	}
+
+	if (result && lines_end < end)
+	{
+		std::vector<char> last_line(lines_end, end);
+		last_line.push_back('\n');
+		const char* line = SkipSpace(&last_line[0]);
+		result = ParseLine(stream, line, &last_line[0] + last_line.size());
+	}
+
+	return result && FlushBatch(stream);
+}
+
+/*
+	Collects the batches of StreamOBJ into a non-indexed OBJ, along with the v table index of every vertex.
+*/
+struct OBJCollector
+{
+	OBJ* model;
+	unsigned int submesh;
+	std::vector<unsigned int> position_indices;
+	std::vector<unsigned char> face_normals;
+	bool has_face_normals;
+};
+
+static bool CollectOBJBatch(const OBJBatch& batch, void* user_data)
+{
+	OBJCollector& collector = *static_cast<OBJCollector*>(user_data);
+	OBJ& model = *collector.model;
+	if (model.submeshes.empty() || batch.submesh != collector.submesh)
+	{
+		OBJSubmesh submesh;
+		submesh.name = batch.name;
+		submesh.material = batch.material;
+		submesh.first = static_cast<unsigned int>(model.positions.size());
+		submesh.count = 0;
+		model.submeshes.push_back(submesh);
+		collector.submesh = batch.submesh;
+	}
+
+	for (size_t i = 0; i < batch.indices.size(); ++i)
+	{
+		unsigned int index = batch.indices[i];
+		model.positions.push_back(batch.positions[index]);
+		model.normals.push_back(batch.normals[index]);
+		model.texcoords.push_back(batch.texcoords[index]);
+		collector.position_indices.push_back(batch.position_indices[index]);
+		collector.face_normals.push_back(batch.face_normals[index]);
+		collector.has_face_normals = collector.has_face_normals || batch.face_normals[index] != 0;
+	}
+
+	model.submeshes.back().count += static_cast<unsigned int>(batch.indices.size());
+	model.mtllib = batch.mtllib;
+	return true;
+}
+
+/*
+	Split [0, count) into one contiguous range per hardware thread, with at least min_per_thread items per range,
+	and call function(begin, end) for each range in parallel.
+*/
+template<typename Function>
+static void ParallelFor(size_t count, size_t min_per_thread, Function function)
+{
+	size_t thread_count = std::max(std::thread::hardware_concurrency(), 1u);
+	thread_count = std::max<size_t>(std::min(thread_count, count / std::max<size_t>(min_per_thread, 1)), 1);
+
+	std::vector<std::thread> threads;
+	for (size_t t = 1; t < thread_count; ++t)
+		threads.push_back(std::thread(function, count * t / thread_count, count * (t + 1) / thread_count));
+
+	function(0, count / thread_count);
+	for (size_t t = 0; t < threads.size(); ++t)
+		threads[t].join();
+}
+
+// Smallest amount of work worth a thread of its own when generating normals.
+static const size_t SMOOTH_NORMALS_MIN_PER_THREAD = 16384;
+
+/*
+	Replace the face normals of the model with smooth normals. The triangle normals are summed per position without
+	normalizing, which weights them by triangle area. Each thread sums its share of the triangles separately and the
+	sums are then added up per position, so no synchronization is needed.
+*/
+static void GenerateSmoothNormals(OBJ& model, const std::vector<unsigned int>& position_indices, const std::vector<unsigned char>& face_normals)
+{
+	size_t position_count = 0;
+	for (size_t i = 0; i < position_indices.size(); ++i)
+		position_count = std::max<size_t>(position_count, position_indices[i] + 1);
+
+	size_t triangle_count = model.positions.size() / 3;
+	size_t thread_count = std::max<size_t>(std::min<size_t>(std::max(std::thread::hardware_concurrency(), 1u), triangle_count / SMOOTH_NORMALS_MIN_PER_THREAD), 1);
+	std::vector<std::vector<glm::vec3>> sums(thread_count);
+	ParallelFor(thread_count, 1, [&](size_t begin, size_t end)
+	{
+		for (size_t t = begin; t < end; ++t)
+		{
+			std::vector<glm::vec3>& sum = sums[t];
+			sum.assign(position_count, glm::vec3(0.0f));
+			for (size_t i = triangle_count * t / thread_count * 3; i < triangle_count * (t + 1) / thread_count * 3; i += 3)
+			{
+				const glm::vec3& p0 = model.positions[i + 0];
+				glm::vec3 normal = glm::cross(model.positions[i + 1] - p0, model.positions[i + 2] - p0);
+				sum[position_indices[i + 0]] += normal;
+				sum[position_indices[i + 1]] += normal;
+				sum[position_indices[i + 2]] += normal;
+			}
+		}
+	});
+
+	ParallelFor(position_count, SMOOTH_NORMALS_MIN_PER_THREAD, [&](size_t begin, size_t end)
+	{
+		for (size_t t = 1; t < thread_count; ++t)
+		{
+			for (size_t p = begin; p < end; ++p)
+				sums[0][p] += sums[t][p];
+		}
+	});
+
+	// Positions of degenerate triangles only keep their face normal.
+	ParallelFor(model.normals.size(), SMOOTH_NORMALS_MIN_PER_THREAD, [&](size_t begin, size_t end)
+	{
+		for (size_t i = begin; i < end; ++i)
+		{
+			const glm::vec3& sum = sums[0][position_indices[i]];
+			float length = glm::length(sum);
+			if (face_normals[i] && length > 0.0f)
+				model.normals[i] = sum / length;
+		}
+	});
+}
+
+bool LoadOBJ(const char* filepath, OBJ& model)
+{
+	model.positions.clear();
+	model.normals.clear();
+	model.texcoords.clear();
+	model.submeshes.clear();
+	model.mtllib.clear();
+
+	OBJCollector collector;
+	collector.model = &model;
+	collector.submesh = 0;
+	collector.has_face_normals = false;
+	if (!StreamOBJ(filepath, OBJ_STREAM_BATCH_VERTICES, CollectOBJBatch, &collector))
 	{
 		model.positions.clear();
 		model.normals.clear();
 		model.texcoords.clear();
+		model.submeshes.clear();
+		ComputeBounds(nullptr, 0, model.aabb, model.bounding_sphere);
+		return false;
 	}
 
-	return result;
+	if (collector.has_face_normals)
+		GenerateSmoothNormals(model, collector.position_indices, collector.face_normals);
+
+	ComputeBounds(model.positions.data(), model.positions.size(), model.aabb, model.bounding_sphere);
+	return true;
 }
 
-bool LoadMTL(const char* filepath, MTL& material)
+MTL::MTL()
+	: Ka(0.0f)
+	, Kd(1.0f)
+	, Ks(0.0f)
+	, Ns(0.0f)
+{}
+
+bool LoadMTL(const char* filepath, std::vector<MTL>& materials)
 {
 	bool result = true;
-	std::ifstream file(filepath);
+	std::string contents;
 
-	if (file.is_open())
+	materials.clear();
+	if (LoadFile(filepath, contents))
 	{
-		while (!file.eof())
+		std::istringstream file(contents);
+		std::string line;
+		while (std::getline(file, line, '\n'))
 		{
-			std::string line;
 			std::stringstream ss;
-
-			std::getline(file, line, '\n');
 			ss.str(line);
 
 			std::string identifier;
 			ss >> identifier;
 
+			if (identifier.empty() || identifier[0] == '#')
+				continue;
+
+			if (identifier == "newmtl")
+			{
+				materials.push_back(MTL());
+				ss >> materials.back().name;
+				continue;
+			}
+
+			// Statements before the first newmtl go into an unnamed material.
+			if (materials.empty())
+				materials.push_back(MTL());
+
+			MTL& material = materials.back();
 			if (identifier == "Ka")
 			{
 				ss >> material.Ka.r;
@@ -205,5 +632,113 @@ bool LoadMTL(const char* filepath, MTL& material)
 		result = false;
 	}
 
+	if (!result)
+	{
+		materials.clear();
+	}
+
 	return result;
+}
+
+int FindMaterial(const std::vector<MTL>& materials, const std::string& name)
+{
+	for (size_t i = 0; i < materials.size(); ++i)
+	{
+		if (materials[i].name == name)
+			return static_cast<int>(i);
+	}
+
+	return -1;
+}
+
+void SortOBJByMaterial(OBJ& model, const std::vector<MTL>& materials)
+{
+	// Bucket the submeshes by material.
+	std::vector<std::vector<size_t>> buckets(std::max<size_t>(materials.size(), 1));
+	for (size_t i = 0; i < model.submeshes.size(); ++i)
+	{
+		int material = FindMaterial(materials, model.submeshes[i].material);
+		buckets[material >= 0 ? material : 0].push_back(i);
+	}
+
+	// Copy the vertices bucket by bucket, giving one contiguous submesh per material.
+	OBJ sorted;
+	sorted.mtllib = model.mtllib;
+	sorted.aabb = model.aabb;
+	sorted.bounding_sphere = model.bounding_sphere;
+	sorted.positions.reserve(model.positions.size());
+	sorted.normals.reserve(model.normals.size());
+	sorted.texcoords.reserve(model.texcoords.size());
+	for (size_t m = 0; m < buckets.size(); ++m)
+	{
+		if (buckets[m].empty())
+			continue;
+
+		OBJSubmesh submesh;
+		submesh.name = model.submeshes[buckets[m][0]].name;
+		submesh.material = materials.empty() ? model.submeshes[buckets[m][0]].material : materials[m].name;
+		submesh.first = static_cast<unsigned int>(sorted.positions.size());
+		submesh.count = 0;
+
+		for (size_t i = 0; i < buckets[m].size(); ++i)
+		{
+			const OBJSubmesh& source = model.submeshes[buckets[m][i]];
+			sorted.positions.insert(sorted.positions.end(), model.positions.begin() + source.first, model.positions.begin() + source.first + source.count);
+			sorted.normals.insert(sorted.normals.end(), model.normals.begin() + source.first, model.normals.begin() + source.first + source.count);
+			sorted.texcoords.insert(sorted.texcoords.end(), model.texcoords.begin() + source.first, model.texcoords.begin() + source.first + source.count);
+			submesh.count += source.count;
+		}
+
+		sorted.submeshes.push_back(submesh);
+	}
+
+	std::swap(model, sorted);
+}
+
+void BuildMaterialBatches(const std::vector<OBJSubmesh>& submeshes, const std::vector<MTL>& materials, std::vector<MaterialBatch>& batches)
+{
+	batches.clear();
+	if (materials.empty())
+		return;
+
+	for (size_t i = 0; i < submeshes.size(); ++i)
+	{
+		const OBJSubmesh& submesh = submeshes[i];
+		int material = std::max(FindMaterial(materials, submesh.material), 0);
+
+		// Find a batch with the same render state, or start a new one.
+		size_t b = 0;
+		for (; b < batches.size(); ++b)
+		{
+			const MTL& other = materials[batches[b].material];
+			if (other.map_Kd == materials[material].map_Kd && other.Ks == materials[material].Ks && other.Ns == materials[material].Ns)
+				break;
+		}
+
+		if (b == batches.size())
+		{
+			MaterialBatch batch;
+			batch.material = material;
+			batches.push_back(batch);
+		}
+
+		// Extend the previous range if this one directly follows it.
+		MaterialBatch& batch = batches[b];
+		if (!batch.firsts.empty() && batch.firsts.back() + batch.counts.back() == static_cast<int>(submesh.first))
+		{
+			batch.counts.back() += submesh.count;
+		}
+		else
+		{
+			batch.firsts.push_back(static_cast<int>(submesh.first));
+			batch.counts.push_back(static_cast<int>(submesh.count));
+		}
+	}
+
+	for (size_t b = 0; b < batches.size(); ++b)
+	{
+		MaterialBatch& batch = batches[b];
+		for (size_t i = 0; i < batch.firsts.size(); ++i)
+			batch.offsets.push_back(reinterpret_cast<const void*>(batch.firsts[i] * sizeof(unsigned int)));
+	}
 }
\ No newline at end of file
@@ -0,0 +1,561 @@
+#include "../include/common/resourcecache.h"
+#include "../include/common/fileio.h"
+#include "../include/common/shader.h"
+#include "../include/common/texture.h"
+#include <gli/gli.hpp>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <vector>
+
+// FNV-1a over the bytes, continuing from hash.
+static uint64_t HashBytes(const void* data, size_t size, uint64_t hash)
+{
+	const unsigned char* bytes = static_cast<const unsigned char*>(data);
+	for (size_t i = 0; i < size; ++i)
+	{
+		hash ^= bytes[i];
+		hash *= 1099511628211ull;
+	}
+
+	return hash;
+}
+
+static uint64_t HashValue(uint64_t value, uint64_t hash)
+{
+	return HashBytes(&value, sizeof(value), hash);
+}
+
+static const uint64_t HASH_SEED = 14695981039346656037ull;
+
+static void AppendBytes(std::string& identity, const void* data, size_t size)
+{
+	identity.append(static_cast<const char*>(data), size);
+}
+
+static void AppendValue(std::string& identity, uint64_t value)
+{
+	AppendBytes(identity, &value, sizeof(value));
+}
+
+static std::string ToHex(uint64_t value)
+{
+	const char DIGITS[] = "0123456789abcdef";
+	std::string hex(16, '0');
+	for (int i = 15; i >= 0; --i, value >>= 4)
+		hex[i] = DIGITS[value & 0xf];
+
+	return hex;
+}
+
+/*
+	A program binary file is the binary format followed by the binary. Returns false if there is no file or the driver
+	rejects the binary, which it may do after an update even though the driver string is the same.
+*/
+static bool LoadProgramBinary(GLuint program, const std::string& filepath)
+{
+	MappedFile file;
+	if (!file.Open(filepath) || file.GetSize() <= sizeof(GLenum))
+		return false;
+
+	GLenum format;
+	memcpy(&format, file.GetData(), sizeof(format));
+	glProgramBinary(program, format, file.GetData() + sizeof(format), static_cast<GLsizei>(file.GetSize() - sizeof(format)));
+
+	GLint status;
+	glGetProgramiv(program, GL_LINK_STATUS, &status);
+	return status == GL_TRUE;
+}
+
+static void SaveProgramBinary(GLuint program, const std::string& filepath)
+{
+	GLint length = 0;
+	glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+	if (length <= 0)
+		return;
+
+	GLenum format;
+	std::vector<char> binary(length);
+	glGetProgramBinary(program, length, &length, &format, &binary[0]);
+
+	// Failing to write the file only costs a compile on the next run.
+	std::ofstream file(filepath.c_str(), std::ios::binary);
+	file.write(reinterpret_cast<const char*>(&format), sizeof(format));
+	file.write(&binary[0], length);
+}
+
+Resource::Resource(ResourceType type, GLuint name, const std::string& identity)
+	: type(type)
+	, name(name)
+	, hash(HashBytes(identity.data(), identity.size(), HASH_SEED))
+	, identity(identity)
+{
+
+}
+
+Resource::~Resource()
+{
+	switch (type)
+	{
+	case RESOURCE_TEXTURE: glDeleteTextures(1, &name); break;
+	case RESOURCE_BUFFER: glDeleteBuffers(1, &name); break;
+	case RESOURCE_PROGRAM: glDeleteProgram(name); break;
+	}
+}
+
+ResourceCache::ResourceCache(const std::string& program_binary_directory)
+	: program_binary_directory(program_binary_directory)
+	, driver_hash(0)
+{
+	statistics.loads = 0;
+	statistics.binary_loads = 0;
+	statistics.path_hits = 0;
+	statistics.content_hits = 0;
+}
+
+ResourceHandle ResourceCache::LoadTexture(const std::string& filepath, GLenum internal_format, GLenum format)
+{
+	std::string key = "texture:" + std::to_string(internal_format) + ":" + std::to_string(format) + ":" + filepath;
+	ResourceHandle resource = FindPath(key);
+	if (resource)
+	{
+		++statistics.path_hits;
+		return resource;
+	}
+
+	MappedFile file;
+	if (!file.Open(filepath))
+	{
+		throw std::runtime_error("Failed to open file: " + filepath);
+	}
+
+	std::string identity;
+	AppendValue(identity, RESOURCE_TEXTURE);
+	AppendValue(identity, internal_format);
+	AppendValue(identity, format);
+	AppendBytes(identity, file.GetData(), file.GetSize());
+	resource = FindContents(identity);
+	if (resource)
+	{
+		++statistics.content_hits;
+		paths[key] = resource;
+		return resource;
+	}
+
+	TextureImage image;
+	if (!LoadDDS(file.GetData(), file.GetSize(), image))
+	{
+		throw std::runtime_error("Failed to load DDS texture: " + filepath);
+	}
+
+	GLuint texture = CreateTexture(image, internal_format, format);
+
+	resource = std::make_shared<Resource>(RESOURCE_TEXTURE, texture, identity);
+	Insert(key, resource);
+	++statistics.loads;
+
+	return resource;
+}
+
+ResourceHandle ResourceCache::LoadTextureArray(const std::string* filepaths, size_t count, GLenum internal_format, GLenum format)
+{
+	std::string key = "texture_array:" + std::to_string(internal_format) + ":" + std::to_string(format);
+	for (size_t i = 0; i < count; ++i)
+		key += ":" + filepaths[i];
+
+	ResourceHandle resource = FindPath(key);
+	if (resource)
+	{
+		++statistics.path_hits;
+		return resource;
+	}
+
+	std::vector<MappedFile> files(count);
+	std::string identity;
+	AppendValue(identity, RESOURCE_TEXTURE);
+	AppendValue(identity, GL_TEXTURE_2D_ARRAY);
+	AppendValue(identity, internal_format);
+	AppendValue(identity, format);
+	for (size_t i = 0; i < count; ++i)
+	{
+		if (!files[i].Open(filepaths[i]))
+		{
+			throw std::runtime_error("Failed to open file: " + filepaths[i]);
+		}
+
+		// The sizes keep the boundaries between the files in the identity.
+		AppendValue(identity, files[i].GetSize());
+		AppendBytes(identity, files[i].GetData(), files[i].GetSize());
+	}
+
+	resource = FindContents(identity);
+	if (resource)
+	{
+		++statistics.content_hits;
+		paths[key] = resource;
+		return resource;
+	}
+
+	std::vector<TextureImage> images(count);
+	for (size_t i = 0; i < count; ++i)
+	{
+		if (!LoadDDS(files[i].GetData(), files[i].GetSize(), images[i]))
+		{
+			throw std::runtime_error("Failed to load DDS texture: " + filepaths[i]);
+		}
+	}
+
+	GLuint texture = CreateTextureArray(&images[0], count, internal_format, format);
+	if (!texture)
+	{
+		throw std::runtime_error("Texture array layers differ in size or format: " + filepaths[0]);
+	}
+
+	resource = std::make_shared<Resource>(RESOURCE_TEXTURE, texture, identity);
+	Insert(key, resource);
+	++statistics.loads;
+
+	return resource;
+}
+
+ResourceHandle ResourceCache::LoadProgram(const ShaderFile* shaders, size_t count, const ShaderDefine* defines, size_t define_count)
+{
+	ProgramFiles program = { shaders, count, defines, define_count };
+	ResourceHandle resource;
+	LoadPrograms(&program, 1, &resource, nullptr);
+
+	return resource;
+}
+
+void ResourceCache::LoadPrograms(const ProgramFiles* programs, size_t count, ResourceHandle* resources, ShaderBatchStatistics* compile_statistics)
+{
+	std::vector<std::string> keys(count);
+	std::vector<std::vector<std::string>> sources(count);
+	std::vector<std::vector<std::string>> files(count);
+	std::vector<std::string> identities(count);
+	std::vector<uint64_t> hashes(count);
+	std::vector<size_t> duplicates(count, count);
+	std::vector<size_t> compiled;
+	for (size_t i = 0; i < count; ++i)
+	{
+		const ProgramFiles& program = programs[i];
+		keys[i] = "program";
+		for (size_t j = 0; j < program.count; ++j)
+			keys[i] += ":" + std::to_string(program.shaders[j].type) + ":" + program.shaders[j].filepath;
+		for (size_t j = 0; j < program.define_count; ++j)
+			keys[i] += ":" + program.defines[j].name + "=" + program.defines[j].value;
+
+		resources[i] = FindPath(keys[i]);
+		if (resources[i])
+		{
+			++statistics.path_hits;
+			continue;
+		}
+
+		sources[i].resize(program.count);
+		AppendValue(identities[i], RESOURCE_PROGRAM);
+		for (size_t j = 0; j < program.count; ++j)
+		{
+			sources[i][j] = PreprocessShaderFile(program.shaders[j].filepath, program.defines, program.define_count, files[i]);
+			AppendValue(identities[i], program.shaders[j].type);
+			AppendValue(identities[i], sources[i][j].size());
+			AppendBytes(identities[i], sources[i][j].data(), sources[i][j].size());
+		}
+
+		hashes[i] = HashBytes(identities[i].data(), identities[i].size(), HASH_SEED);
+		resources[i] = FindContents(identities[i]);
+		if (resources[i])
+		{
+			++statistics.content_hits;
+			paths[keys[i]] = resources[i];
+			continue;
+		}
+
+		// Programs with the same contents earlier in the batch are only compiled once.
+		for (size_t k = 0; k < compiled.size() && duplicates[i] == count; ++k)
+		{
+			if (hashes[compiled[k]] == hashes[i] && identities[compiled[k]] == identities[i])
+				duplicates[i] = compiled[k];
+		}
+
+		if (duplicates[i] != count)
+			continue;
+
+		// Reuse the binary linked on an earlier run by the same driver, if there is one.
+		std::string binary_filepath = GetProgramBinaryFilepath(hashes[i]);
+		if (!binary_filepath.empty())
+		{
+			GLuint name = glCreateProgram();
+			if (LoadProgramBinary(name, binary_filepath))
+			{
+				std::shared_ptr<Resource> resource = std::make_shared<Resource>(RESOURCE_PROGRAM, name, identities[i]);
+				WatchProgram(resource, program, files[i]);
+				resources[i] = resource;
+				Insert(keys[i], resources[i]);
+				++statistics.loads;
+				++statistics.binary_loads;
+				continue;
+			}
+
+			glDeleteProgram(name);
+		}
+
+		compiled.push_back(i);
+	}
+
+	// Compile the rest together, so the driver can work on them in parallel.
+	if (compile_statistics != nullptr)
+		*compile_statistics = ShaderBatchStatistics();
+
+	if (!compiled.empty())
+	{
+		std::vector<std::vector<ShaderStage>> stages(compiled.size());
+		std::vector<ProgramStages> batch(compiled.size());
+		for (size_t k = 0; k < compiled.size(); ++k)
+		{
+			const ProgramFiles& program = programs[compiled[k]];
+			for (size_t j = 0; j < program.count; ++j)
+			{
+				ShaderStage stage = { program.shaders[j].type, sources[compiled[k]][j].c_str(), program.shaders[j].filepath.c_str() };
+				stages[k].push_back(stage);
+			}
+
+			batch[k].stages = &stages[k][0];
+			batch[k].count = stages[k].size();
+		}
+
+		std::vector<GLuint> names(compiled.size());
+		CompileProgramBatch(&batch[0], batch.size(), !program_binary_directory.empty(), &names[0], compile_statistics);
+
+		for (size_t k = 0; k < compiled.size(); ++k)
+		{
+			size_t i = compiled[k];
+			std::string binary_filepath = GetProgramBinaryFilepath(hashes[i]);
+			if (!binary_filepath.empty())
+				SaveProgramBinary(names[k], binary_filepath);
+
+			std::shared_ptr<Resource> resource = std::make_shared<Resource>(RESOURCE_PROGRAM, names[k], identities[i]);
+			WatchProgram(resource, programs[i], files[i]);
+			resources[i] = resource;
+			Insert(keys[i], resources[i]);
+			++statistics.loads;
+		}
+	}
+
+	for (size_t i = 0; i < count; ++i)
+	{
+		if (duplicates[i] != count)
+		{
+			resources[i] = resources[duplicates[i]];
+			paths[keys[i]] = resources[i];
+			++statistics.content_hits;
+		}
+	}
+}
+
+ResourceHandle ResourceCache::CreateBuffer(GLenum target, const void* data, size_t size, GLenum usage)
+{
+	// Only static buffers are shared. Writing to a dynamic or stream buffer through one handle would change it for
+	// every other handle too.
+	bool shared = usage == GL_STATIC_DRAW;
+	std::string identity;
+	if (shared)
+	{
+		AppendValue(identity, RESOURCE_BUFFER);
+		AppendValue(identity, target);
+		AppendValue(identity, size);
+		AppendBytes(identity, data, size);
+		ResourceHandle resource = FindContents(identity);
+		if (resource)
+		{
+			++statistics.content_hits;
+			return resource;
+		}
+	}
+
+	GLuint buffer;
+	glGenBuffers(1, &buffer);
+	glBindBuffer(target, buffer);
+	glBufferData(target, size, data, usage);
+
+	ResourceHandle resource = std::make_shared<Resource>(RESOURCE_BUFFER, buffer, identity);
+	if (shared)
+		contents[resource->hash] = resource;
+	++statistics.loads;
+
+	return resource;
+}
+
+unsigned int ResourceCache::ReloadChangedPrograms(std::vector<std::string>& errors)
+{
+	std::vector<std::string> changed;
+	file_watcher.Poll(changed);
+	if (changed.empty())
+		return 0;
+
+	unsigned int reloaded = 0;
+	for (size_t i = 0; i < watched_programs.size(); ++i)
+	{
+		WatchedProgram& watched = watched_programs[i];
+		const std::vector<ShaderFile>& shaders = watched.shaders;
+		std::shared_ptr<Resource> resource = watched_programs[i].resource.lock();
+		if (!resource)
+		{
+			// The program has been released.
+			watched_programs.erase(watched_programs.begin() + i);
+			--i;
+			continue;
+		}
+
+		bool uses_changed_file = false;
+		for (size_t j = 0; j < watched.files.size() && !uses_changed_file; ++j)
+		{
+			for (size_t k = 0; k < changed.size() && !uses_changed_file; ++k)
+				uses_changed_file = watched.files[j] == changed[k];
+		}
+
+		if (!uses_changed_file)
+			continue;
+
+		// Build the new version next to the current one, which is kept if anything fails.
+		std::vector<std::string> sources(shaders.size());
+		std::vector<ShaderStage> stages(shaders.size());
+		std::vector<std::string> files;
+		std::string identity;
+		AppendValue(identity, RESOURCE_PROGRAM);
+		GLuint name = 0;
+		try
+		{
+			for (size_t j = 0; j < shaders.size(); ++j)
+			{
+				sources[j] = PreprocessShaderFile(shaders[j].filepath, watched.defines.empty() ? nullptr : &watched.defines[0], watched.defines.size(), files);
+				AppendValue(identity, shaders[j].type);
+				AppendValue(identity, sources[j].size());
+				AppendBytes(identity, sources[j].data(), sources[j].size());
+
+				ShaderStage stage = { shaders[j].type, sources[j].c_str(), shaders[j].filepath.c_str() };
+				stages[j] = stage;
+			}
+
+			// Saving a file without changing it does not need a rebuild.
+			if (identity == resource->identity)
+				continue;
+
+			ProgramStages program = { &stages[0], stages.size() };
+			CompileProgramBatch(&program, 1, !program_binary_directory.empty(), &name, nullptr);
+		}
+		catch (std::runtime_error& e)
+		{
+			errors.push_back(e.what());
+			continue;
+		}
+
+		// The includes may have changed as well.
+		watched.files = files;
+		for (size_t j = 0; j < files.size(); ++j)
+			file_watcher.Watch(files[j]);
+
+		uint64_t hash = HashBytes(identity.data(), identity.size(), HASH_SEED);
+		std::string binary_filepath = GetProgramBinaryFilepath(hash);
+		if (!binary_filepath.empty())
+			SaveProgramBinary(name, binary_filepath);
+
+		// The entry for the old contents may already refer to another program with the same hash.
+		std::unordered_map<uint64_t, std::weak_ptr<const Resource>>::iterator it = contents.find(resource->hash);
+		if (it != contents.end() && it->second.lock() == resource)
+			contents.erase(it);
+
+		glDeleteProgram(resource->name);
+		resource->name = name;
+		resource->hash = hash;
+		resource->identity = identity;
+		contents[hash] = resource;
+		++reloaded;
+	}
+
+	return reloaded;
+}
+
+const ResourceCacheStatistics& ResourceCache::GetStatistics() const
+{
+	return statistics;
+}
+
+uint64_t ResourceCache::GetDriverHash()
+{
+	// Queried on first use, since the cache may be created before the context.
+	if (driver_hash == 0)
+	{
+		const GLenum NAMES[] = { GL_VENDOR, GL_RENDERER, GL_VERSION };
+		driver_hash = HASH_SEED;
+		for (size_t i = 0; i < sizeof(NAMES) / sizeof(GLenum); ++i)
+		{
+			const char* name = reinterpret_cast<const char*>(glGetString(NAMES[i]));
+			std::string driver = name != nullptr ? name : "";
+			driver_hash = HashBytes(driver.c_str(), driver.size() + 1, driver_hash);
+		}
+	}
+
+	return driver_hash;
+}
+
+std::string ResourceCache::GetProgramBinaryFilepath(uint64_t hash)
+{
+	if (program_binary_directory.empty())
+		return std::string();
+
+	return program_binary_directory + ToHex(HashValue(hash, GetDriverHash())) + FILE_EXTENSION_PROGRAM_BINARY;
+}
+
+ResourceHandle ResourceCache::FindPath(const std::string& key)
+{
+	std::unordered_map<std::string, std::weak_ptr<const Resource>>::iterator it = paths.find(key);
+	if (it == paths.end())
+		return ResourceHandle();
+
+	// Forget resources that have been released.
+	ResourceHandle resource = it->second.lock();
+	if (!resource)
+		paths.erase(it);
+
+	return resource;
+}
+
+ResourceHandle ResourceCache::FindContents(const std::string& identity)
+{
+	std::unordered_map<uint64_t, std::weak_ptr<const Resource>>::iterator it = contents.find(HashBytes(identity.data(), identity.size(), HASH_SEED));
+	if (it == contents.end())
+		return ResourceHandle();
+
+	ResourceHandle resource = it->second.lock();
+	if (!resource)
+	{
+		contents.erase(it);
+		return ResourceHandle();
+	}
+
+	// A different resource whose identity has the same hash.
+	if (resource->identity != identity)
+		return ResourceHandle();
+
+	return resource;
+}
+
+void ResourceCache::WatchProgram(const std::shared_ptr<Resource>& resource, const ProgramFiles& program, const std::vector<std::string>& files)
+{
+	WatchedProgram watched;
+	watched.resource = resource;
+	watched.shaders.assign(program.shaders, program.shaders + program.count);
+	watched.defines.assign(program.defines, program.defines + program.define_count);
+	watched.files = files;
+	watched_programs.push_back(watched);
+
+	for (size_t i = 0; i < files.size(); ++i)
+		file_watcher.Watch(files[i]);
+}
+
+void ResourceCache::Insert(const std::string& key, const ResourceHandle& resource)
+{
+	paths[key] = resource;
+	contents[resource->hash] = resource;
+}
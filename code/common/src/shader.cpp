@@ -1,43 +1,20 @@
 #include "../include/common/shader.h"
+#include "../include/common/fileio.h"
+#include "../include/common/timer.h"
 #include <string>
 #include <stdexcept>
-#include <fstream>
+#include <vector>
+#include <algorithm>
+#include <cstring>
 
-GLuint CompileShaderFromFile(const char* filepath, GLenum shaderType)
-{
-	GLuint shader = 0;
-	std::ifstream file(filepath);
-	
-	if (!file.is_open())
-	{
-		throw std::runtime_error(std::string("Failed to open shader file: ") + filepath);
-	}
-
-	std::string source;
-	while (!file.eof())
-	{
-		std::string line;
-		std::getline(file, line);
-
-		source += line + "\n";
-	}
-
-	try
-	{
-		shader = CompileShaderFromSource(source.c_str(), shaderType);
-	}
-	catch (std::runtime_error& e)
-	{
-		throw std::runtime_error(std::string("[") + filepath + "] " + e.what());
-	}
+// GL_KHR_parallel_shader_compile and GL_ARB_parallel_shader_compile are not part of the core profile header.
+typedef void (APIENTRYP PFNGLMAXSHADERCOMPILERTHREADSKHRPROC)(GLuint count);
 
-	return shader;
-}
-
-GLuint CompileShaderFromSource(const char* source, GLenum shaderType)
+// A negative length means the source is null terminated.
+static GLuint CompileShader(const char* source, GLint length, GLenum shaderType)
 {
 	GLuint shader = glCreateShader(shaderType);
-	glShaderSource(shader, 1, &source, nullptr);
+	glShaderSource(shader, 1, &source, length < 0 ? nullptr : &length);
 	glCompileShader(shader);
 
 	GLint status;
@@ -55,12 +32,40 @@ GLuint CompileShaderFromSource(const char* source, GLenum shaderType)
 			glGetShaderInfoLog(shader, logSize, &written, &log[0]);
 		}
 
+		glDeleteShader(shader);
 		throw std::runtime_error("Failed to compile shader: " + log);
 	}
 
 	return shader;
 }
 
+GLuint CompileShaderFromFile(const char* filepath, GLenum shaderType)
+{
+	GLuint shader = 0;
+	MappedFile file;
+	if (!file.Open(filepath))
+	{
+		throw std::runtime_error(std::string("Failed to open shader file: ") + filepath);
+	}
+
+	// The source is handed to the driver straight from the mapping.
+	try
+	{
+		shader = CompileShader(file.GetData(), static_cast<GLint>(file.GetSize()), shaderType);
+	}
+	catch (std::runtime_error& e)
+	{
+		throw std::runtime_error(std::string("[") + filepath + "] " + e.what());
+	}
+
+	return shader;
+}
+
+GLuint CompileShaderFromSource(const char* source, GLenum shaderType)
+{
+	return CompileShader(source, -1, shaderType);
+}
+
 GLuint LinkProgram(GLuint program)
 {
 	glLinkProgram(program);
@@ -84,4 +89,319 @@ GLuint LinkProgram(GLuint program)
 	}
 
 	return program;
-}
\ No newline at end of file
+}
+
+static std::string GetDirectory(const std::string& filepath)
+{
+	size_t separator = filepath.find_last_of("/\\");
+	return separator == std::string::npos ? std::string() : filepath.substr(0, separator + 1);
+}
+
+// Remove the "." and "dir/.." parts of a path, so a file included through different paths is recognized.
+static std::string NormalizePath(const std::string& filepath)
+{
+	std::vector<std::string> parts;
+	size_t begin = 0;
+	while (begin <= filepath.size())
+	{
+		size_t end = filepath.find_first_of("/\\", begin);
+		if (end == std::string::npos)
+			end = filepath.size();
+
+		std::string part = filepath.substr(begin, end - begin);
+		if (part == ".." && !parts.empty() && parts.back() != ".." && !parts.back().empty())
+			parts.pop_back();
+		else if (part != "." || parts.empty())
+			parts.push_back(part);
+
+		begin = end + 1;
+	}
+
+	std::string normalized = parts[0];
+	for (size_t i = 1; i < parts.size(); ++i)
+		normalized += "/" + parts[i];
+	return normalized;
+}
+
+// Returns true if the line from begin to end starts with the directive.
+static bool MatchDirective(const char* begin, const char* end, const char* directive)
+{
+	size_t length = strlen(directive);
+	return static_cast<size_t>(end - begin) >= length && strncmp(begin, directive, length) == 0;
+}
+
+// Returns true and the included path if the line from begin to end is an #include "file" directive.
+static bool ParseInclude(const char* begin, const char* end, std::string& include)
+{
+	while (begin < end && (*begin == ' ' || *begin == '\t'))
+		++begin;
+	if (!MatchDirective(begin, end, "#include"))
+		return false;
+
+	const char* first = std::find(begin + 8, end, '"');
+	const char* last = first == end ? end : std::find(first + 1, end, '"');
+	if (last == end)
+		return false;
+
+	include.assign(first + 1, last);
+	return true;
+}
+
+static void PreprocessShaderFile(const std::string& filepath, const ShaderDefine* defines, size_t define_count, std::vector<std::string>& files, std::string& source)
+{
+	MappedFile file;
+	if (!file.Open(filepath))
+	{
+		throw std::runtime_error("Failed to open shader file: " + filepath);
+	}
+
+	size_t file_index = files.size();
+	files.push_back(filepath);
+
+	int line_number = 0;
+	if (file_index > 0)
+		source += "#line 1 " + std::to_string(file_index) + "\n";
+
+	// Copy the runs of lines between directives straight from the mapping. pending is the first line not copied yet.
+	source.reserve(source.size() + file.GetSize());
+	const char* end = file.GetData() + file.GetSize();
+	const char* pending = file.GetData();
+	for (const char* line = file.GetData(); line < end; )
+	{
+		const char* line_end = std::find(line, end, '\n');
+		const char* next = line_end == end ? end : line_end + 1;
+		++line_number;
+
+		std::string include;
+		if (ParseInclude(line, line_end, include))
+		{
+			source.append(pending, line);
+
+			// Skipping the files read before also ends include cycles.
+			std::string include_filepath = NormalizePath(GetDirectory(filepath) + include);
+			bool included = false;
+			for (size_t i = 0; i < files.size() && !included; ++i)
+				included = files[i] == include_filepath;
+
+			if (!included)
+				PreprocessShaderFile(include_filepath, defines, define_count, files, source);
+
+			source += "#line " + std::to_string(line_number + 1) + " " + std::to_string(file_index) + "\n";
+			pending = next;
+		}
+		else if (file_index == 0 && define_count > 0 && MatchDirective(line, line_end, "#version"))
+		{
+			// The defines go right after the #version line of the main file, which has to come first.
+			source.append(pending, line_end);
+			source += "\n";
+			for (size_t i = 0; i < define_count; ++i)
+				source += "#define " + defines[i].name + " " + defines[i].value + "\n";
+			source += "#line " + std::to_string(line_number + 1) + " 0\n";
+			pending = next;
+		}
+
+		line = next;
+	}
+
+	source.append(pending, end);
+	if (pending < end && end[-1] != '\n')
+		source += "\n";
+}
+
+std::string PreprocessShaderFile(const std::string& filepath, const ShaderDefine* defines, size_t define_count, std::vector<std::string>& files)
+{
+	// The files of this shader are numbered from zero, whatever files already holds.
+	std::vector<std::string> shader_files;
+	std::string source;
+	PreprocessShaderFile(NormalizePath(filepath), defines, define_count, shader_files, source);
+	files.insert(files.end(), shader_files.begin(), shader_files.end());
+
+	return source;
+}
+
+static std::string GetShaderLog(GLuint shader)
+{
+	GLint logSize;
+	glGetShaderiv(shader, GL_INFO_LOG_LENGTH, &logSize);
+
+	std::string log;
+	if (logSize > 0)
+	{
+		int written;
+		log.resize(logSize);
+		glGetShaderInfoLog(shader, logSize, &written, &log[0]);
+	}
+
+	return log;
+}
+
+static std::string GetProgramLog(GLuint program)
+{
+	GLint logSize;
+	glGetProgramiv(program, GL_INFO_LOG_LENGTH, &logSize);
+
+	std::string log;
+	if (logSize > 0)
+	{
+		int written;
+		log.resize(logSize);
+		glGetProgramInfoLog(program, logSize, &written, &log[0]);
+	}
+
+	return log;
+}
+
+/*
+	Let the driver compile shaders on as many threads as it likes, if it supports one of the parallel shader compile
+	extensions. Returns true if it does. The extensions are only looked up once.
+*/
+static bool EnableParallelShaderCompile()
+{
+	static int supported = -1;
+	if (supported == -1)
+	{
+		supported = 0;
+
+		GLint extension_count = 0;
+		glGetIntegerv(GL_NUM_EXTENSIONS, &extension_count);
+		for (GLint i = 0; i < extension_count && supported == 0; ++i)
+		{
+			const char* extension = reinterpret_cast<const char*>(glGetStringi(GL_EXTENSIONS, i));
+			const char* function = nullptr;
+			if (std::strcmp(extension, "GL_KHR_parallel_shader_compile") == 0)
+				function = "glMaxShaderCompilerThreadsKHR";
+			else if (std::strcmp(extension, "GL_ARB_parallel_shader_compile") == 0)
+				function = "glMaxShaderCompilerThreadsARB";
+
+			PFNGLMAXSHADERCOMPILERTHREADSKHRPROC max_shader_compiler_threads = nullptr;
+			if (function != nullptr)
+				max_shader_compiler_threads = reinterpret_cast<PFNGLMAXSHADERCOMPILERTHREADSKHRPROC>(gl3wGetProcAddress(function));
+
+			// 0xFFFFFFFF leaves the number of threads to the driver.
+			if (max_shader_compiler_threads != nullptr)
+			{
+				max_shader_compiler_threads(0xFFFFFFFF);
+				supported = 1;
+			}
+		}
+	}
+
+	return supported == 1;
+}
+
+void CompileProgramBatch(const ProgramStages* batch, size_t count, bool binary_retrievable, GLuint* programs, ShaderBatchStatistics* statistics)
+{
+	Timer timer;
+	bool parallel = EnableParallelShaderCompile();
+
+	std::vector<std::vector<GLuint>> shaders(count);
+	for (size_t i = 0; i < count; ++i)
+		programs[i] = 0;
+
+	int64_t submit_time = 0;
+	try
+	{
+		// Submit everything. Without parallel compilation each status is checked right away instead.
+		for (size_t i = 0; i < count; ++i)
+		{
+			programs[i] = glCreateProgram();
+			if (binary_retrievable)
+				glProgramParameteri(programs[i], GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+
+			for (size_t j = 0; j < batch[i].count; ++j)
+			{
+				const ShaderStage& stage = batch[i].stages[j];
+				GLuint shader = 0;
+				if (parallel)
+				{
+					shader = glCreateShader(stage.type);
+					glShaderSource(shader, 1, &stage.source, nullptr);
+					glCompileShader(shader);
+				}
+				else
+				{
+					try
+					{
+						shader = CompileShaderFromSource(stage.source, stage.type);
+					}
+					catch (std::runtime_error& e)
+					{
+						throw std::runtime_error(std::string("[") + stage.name + "] " + e.what());
+					}
+				}
+
+				shaders[i].push_back(shader);
+				glAttachShader(programs[i], shader);
+			}
+
+			if (parallel)
+				glLinkProgram(programs[i]);
+			else
+				LinkProgram(programs[i]);
+		}
+
+		submit_time = timer.End();
+
+		// Wait for the results. Querying the link status only blocks until that program is done, while the driver
+		// keeps working on the rest.
+		if (parallel)
+		{
+			for (size_t i = 0; i < count; ++i)
+			{
+				GLint status;
+				glGetProgramiv(programs[i], GL_LINK_STATUS, &status);
+				if (status == GL_TRUE)
+					continue;
+
+				std::string names;
+				for (size_t j = 0; j < batch[i].count; ++j)
+				{
+					glGetShaderiv(shaders[i][j], GL_COMPILE_STATUS, &status);
+					if (status != GL_TRUE)
+					{
+						throw std::runtime_error(std::string("[") + batch[i].stages[j].name + "] Failed to compile shader: " + GetShaderLog(shaders[i][j]));
+					}
+
+					names += (j > 0 ? ", " : "") + std::string(batch[i].stages[j].name);
+				}
+
+				throw std::runtime_error("[" + names + "] Failed to link program: " + GetProgramLog(programs[i]));
+			}
+		}
+	}
+	catch (...)
+	{
+		for (size_t i = 0; i < count; ++i)
+		{
+			for (size_t j = 0; j < shaders[i].size(); ++j)
+				glDeleteShader(shaders[i][j]);
+			if (programs[i] != 0)
+				glDeleteProgram(programs[i]);
+			programs[i] = 0;
+		}
+
+		throw;
+	}
+
+	// The shaders are only needed until the programs are linked.
+	unsigned int shader_count = 0;
+	for (size_t i = 0; i < count; ++i)
+	{
+		for (size_t j = 0; j < shaders[i].size(); ++j)
+		{
+			glDetachShader(programs[i], shaders[i][j]);
+			glDeleteShader(shaders[i][j]);
+		}
+
+		shader_count += static_cast<unsigned int>(shaders[i].size());
+	}
+
+	if (statistics != nullptr)
+	{
+		statistics->program_count = static_cast<unsigned int>(count);
+		statistics->shader_count = shader_count;
+		statistics->parallel = parallel;
+		statistics->submit_time = submit_time;
+		statistics->total_time = timer.End();
+	}
+}
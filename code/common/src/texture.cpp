@@ -0,0 +1,413 @@
+#include "../include/common/texture.h"
+#include "../include/common/fileio.h"
+#include <gli/gli.hpp>
+#include <emmintrin.h>
+#include <algorithm>
+#include <cstring>
+
+// GL_EXT_texture_filter_anisotropic and GL_ARB_texture_filter_anisotropic are not part of the core profile header.
+#ifndef GL_TEXTURE_MAX_ANISOTROPY
+#define GL_TEXTURE_MAX_ANISOTROPY 0x84FE
+#define GL_MAX_TEXTURE_MAX_ANISOTROPY 0x84FF
+#endif
+
+// GL_EXT_texture_compression_s3tc is not part of the core profile header either.
+#ifndef GL_COMPRESSED_RGBA_S3TC_DXT1_EXT
+#define GL_COMPRESSED_RGBA_S3TC_DXT1_EXT 0x83F1
+#define GL_COMPRESSED_RGBA_S3TC_DXT5_EXT 0x83F3
+#endif
+
+// Returns false if the format is not one of the block formats.
+static bool GetBlockFormat(gli::format format, BlockFormat& block_format)
+{
+	switch (format)
+	{
+	case gli::FORMAT_RGB_DXT1_UNORM:
+	case gli::FORMAT_RGBA_DXT1_UNORM:
+		block_format = BLOCK_FORMAT_BC1;
+		return true;
+	case gli::FORMAT_RGBA_DXT5_UNORM:
+		block_format = BLOCK_FORMAT_BC3;
+		return true;
+	case gli::FORMAT_R_ATI1N_UNORM:
+		block_format = BLOCK_FORMAT_BC4;
+		return true;
+	case gli::FORMAT_RG_ATI2N_UNORM:
+		block_format = BLOCK_FORMAT_BC5;
+		return true;
+	case gli::FORMAT_RGB_BP_UNORM:
+		block_format = BLOCK_FORMAT_BC7;
+		return true;
+	default:
+		return false;
+	}
+}
+
+static GLenum GetCompressedInternalFormat(BlockFormat block_format)
+{
+	switch (block_format)
+	{
+	case BLOCK_FORMAT_BC1:
+		return GL_COMPRESSED_RGBA_S3TC_DXT1_EXT;
+	case BLOCK_FORMAT_BC3:
+		return GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+	case BLOCK_FORMAT_BC4:
+		return GL_COMPRESSED_RED_RGTC1;
+	case BLOCK_FORMAT_BC5:
+		return GL_COMPRESSED_RG_RGTC2;
+	default:
+		return GL_COMPRESSED_RGBA_BPTC_UNORM;
+	}
+}
+
+bool LoadDDS(const char* data, size_t size, TextureImage& image)
+{
+	gli::storage storage = gli::load_dds(data, size);
+	if (storage.empty() || storage.layers() != 1 || storage.faces() != 1 || storage.dimensions(0).z != 1)
+		return false;
+
+	gli::format format = storage.format();
+	image.compressed = GetBlockFormat(format, image.block_format);
+	if (!image.compressed && (gli::block_dimensions_x(format) != 1 || gli::block_dimensions_y(format) != 1 || gli::block_size(format) != gli::component_count(format)))
+		return false;
+
+	image.pixel_size = image.compressed ? 0 : gli::block_size(format);
+	image.levels.resize(storage.levels());
+
+	size_t offset = 0;
+	for (size_t i = 0; i < image.levels.size(); ++i)
+	{
+		image.levels[i].width = static_cast<unsigned int>(storage.dimensions(i).x);
+		image.levels[i].height = static_cast<unsigned int>(storage.dimensions(i).y);
+		image.levels[i].offset = offset;
+		offset += storage.level_size(i);
+	}
+
+	const unsigned char* pixels = reinterpret_cast<const unsigned char*>(storage.data());
+	image.pixels.assign(pixels, pixels + offset);
+
+	if (image.levels.size() == 1 && !image.compressed)
+		GenerateMipmaps(image);
+
+	return true;
+}
+
+bool LoadDDSFile(const std::string& filepath, TextureImage& image)
+{
+	MappedFile file;
+	return file.Open(filepath) && LoadDDS(file.GetData(), file.GetSize(), image);
+}
+
+bool ReadDDSLayout(const char* data, size_t size, DDSLayout& layout)
+{
+	if (size < sizeof(gli::detail::ddsHeader) || std::strncmp(data, "DDS ", 4) != 0)
+		return false;
+
+	const gli::detail::ddsHeader& header = *reinterpret_cast<const gli::detail::ddsHeader*>(data);
+	layout.offset = sizeof(header);
+	if ((header.format.flags & gli::dx::DDPF_FOURCC) && header.format.fourCC == gli::dx::D3DFMT_DX10)
+		layout.offset += sizeof(gli::detail::ddsHeader10);
+	if (size < layout.offset || header.width == 0 || header.height == 0)
+		return false;
+	if (header.cubemapFlags & (gli::detail::DDSCAPS2_CUBEMAP | gli::detail::DDSCAPS2_VOLUME))
+		return false;
+
+	// Let LoadDDS find and check the format on a copy of the header that describes a single 4x4 level of zeros, which
+	// is large enough for any format.
+	std::vector<char> probe(layout.offset + 4 * 4 * 16, 0);
+	std::memcpy(&probe[0], data, layout.offset);
+	gli::detail::ddsHeader& probe_header = *reinterpret_cast<gli::detail::ddsHeader*>(&probe[0]);
+	probe_header.width = 4;
+	probe_header.height = 4;
+	probe_header.flags &= ~gli::detail::DDSD_MIPMAPCOUNT;
+	if (layout.offset > sizeof(header))
+		reinterpret_cast<gli::detail::ddsHeader10*>(&probe[sizeof(header)])->arraySize = 1;
+
+	TextureImage image;
+	if (!LoadDDS(&probe[0], probe.size(), image))
+		return false;
+
+	layout.width = header.width;
+	layout.height = header.height;
+	layout.pixel_size = image.pixel_size;
+	layout.compressed = image.compressed;
+	layout.block_format = image.block_format;
+	if (layout.compressed)
+		layout.pitch = GetCompressedSize(layout.block_format, layout.width, 4);
+	else
+		layout.pitch = size_t(layout.width) * layout.pixel_size;
+
+	size_t rows = layout.compressed ? (layout.height + 3) / 4 : layout.height;
+	return (size - layout.offset) / layout.pitch >= rows;
+}
+
+bool DecompressTextureImage(const TextureImage& image, TextureImage& decompressed)
+{
+	decompressed.levels = image.levels;
+	decompressed.pixel_size = 4;
+	decompressed.compressed = false;
+
+	size_t offset = 0;
+	for (size_t i = 0; i < decompressed.levels.size(); ++i)
+	{
+		decompressed.levels[i].offset = offset;
+		offset += decompressed.levels[i].width * decompressed.levels[i].height * 4;
+	}
+
+	decompressed.pixels.resize(offset);
+	for (size_t i = 0; i < image.levels.size(); ++i)
+	{
+		const TextureLevel& level = image.levels[i];
+		if (!DecodeBlocks(image.block_format, &image.pixels[level.offset], level.width, level.height, &decompressed.pixels[decompressed.levels[i].offset]))
+			return false;
+	}
+
+	return true;
+}
+
+/*
+	Weights of the taps of the mip filter, from the nearest pair of pixels outwards. A Kaiser windowed sinc (alpha 4)
+	reaching three source pixels to each side, sampled at the pixel centers and normalized. It keeps more detail
+	than a box filter while aliasing less, at the cost of a slight ringing that is clamped away.
+*/
+static const float MIP_FILTER_WEIGHTS[3] = { 0.42649f, 0.09450f, -0.02099f };
+
+/*
+	Filter six rows of bytes into a row of floats, sixteen bytes at a time with SSE.
+*/
+static void FilterMipRows(const unsigned char* const rows[6], size_t size, float* filtered)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128 WEIGHTS[6] =
+	{
+		_mm_set1_ps(MIP_FILTER_WEIGHTS[2]), _mm_set1_ps(MIP_FILTER_WEIGHTS[1]), _mm_set1_ps(MIP_FILTER_WEIGHTS[0]),
+		_mm_set1_ps(MIP_FILTER_WEIGHTS[0]), _mm_set1_ps(MIP_FILTER_WEIGHTS[1]), _mm_set1_ps(MIP_FILTER_WEIGHTS[2])
+	};
+
+	size_t i = 0;
+	for (; i + 16 <= size; i += 16)
+	{
+		__m128 sums[4] = { _mm_setzero_ps(), _mm_setzero_ps(), _mm_setzero_ps(), _mm_setzero_ps() };
+		for (int k = 0; k < 6; ++k)
+		{
+			__m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(rows[k] + i));
+			__m128i low = _mm_unpacklo_epi8(bytes, zero);
+			__m128i high = _mm_unpackhi_epi8(bytes, zero);
+			sums[0] = _mm_add_ps(sums[0], _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(low, zero)), WEIGHTS[k]));
+			sums[1] = _mm_add_ps(sums[1], _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(low, zero)), WEIGHTS[k]));
+			sums[2] = _mm_add_ps(sums[2], _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(high, zero)), WEIGHTS[k]));
+			sums[3] = _mm_add_ps(sums[3], _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(high, zero)), WEIGHTS[k]));
+		}
+
+		for (int j = 0; j < 4; ++j)
+			_mm_storeu_ps(filtered + i + j * 4, sums[j]);
+	}
+
+	for (; i < size; ++i)
+	{
+		filtered[i] = MIP_FILTER_WEIGHTS[2] * (rows[0][i] + rows[5][i]) + MIP_FILTER_WEIGHTS[1] * (rows[1][i] + rows[4][i])
+			+ MIP_FILTER_WEIGHTS[0] * (rows[2][i] + rows[3][i]);
+	}
+}
+
+void GenerateMipmaps(TextureImage& image)
+{
+	TextureLevel level = image.levels[0];
+	unsigned int pixel_size = image.pixel_size;
+	image.levels.resize(1);
+	image.pixels.resize(level.width * level.height * pixel_size);
+
+	// The vertically filtered row, and its even and odd pixels with one clamped pixel on each side and room for reading
+	// a whole vector past the end.
+	std::vector<float> filtered;
+	std::vector<float> even;
+	std::vector<float> odd;
+	std::vector<unsigned char> destination_row;
+
+	while (level.width > 1 || level.height > 1)
+	{
+		TextureLevel next;
+		next.width = std::max(level.width / 2, 1u);
+		next.height = std::max(level.height / 2, 1u);
+		next.offset = image.pixels.size();
+		image.pixels.resize(next.offset + next.width * next.height * pixel_size);
+
+		// Resizing may move the pixels, so the pointers are taken after it.
+		const unsigned char* source = &image.pixels[level.offset];
+		unsigned char* destination = &image.pixels[next.offset];
+		size_t source_pitch = level.width * pixel_size;
+		size_t destination_pitch = next.width * pixel_size;
+		size_t padded_size = (next.width + 2) * pixel_size + 4;
+		filtered.resize(source_pitch);
+		even.resize(padded_size);
+		odd.resize(padded_size);
+		destination_row.resize(destination_pitch + 4);
+
+		for (unsigned int y = 0; y < next.height; ++y)
+		{
+			// Pixel 2 * y of the next level is centered between rows 2 * y and 2 * y + 1 of this one.
+			const unsigned char* rows[6];
+			for (int k = 0; k < 6; ++k)
+			{
+				int row = std::min(std::max(static_cast<int>(2 * y) + k - 2, 0), static_cast<int>(level.height) - 1);
+				rows[k] = source + row * source_pitch;
+			}
+
+			FilterMipRows(rows, source_pitch, &filtered[0]);
+
+			// Split the row into even and odd pixels, so the horizontal taps of consecutive destination pixels are
+			// consecutive in memory.
+			for (int x = -1; x <= static_cast<int>(next.width); ++x)
+			{
+				int even_x = std::min(std::max(2 * x, 0), static_cast<int>(level.width) - 1);
+				int odd_x = std::min(std::max(2 * x + 1, 0), static_cast<int>(level.width) - 1);
+				for (unsigned int c = 0; c < pixel_size; ++c)
+				{
+					even[(x + 1) * pixel_size + c] = filtered[even_x * pixel_size + c];
+					odd[(x + 1) * pixel_size + c] = filtered[odd_x * pixel_size + c];
+				}
+			}
+
+			// Destination pixel x takes source pixels 2 * x - 2 to 2 * x + 3, which are the even and odd pixels x - 1
+			// to x + 1. Saturating packs clamp the ringing.
+			for (size_t i = 0; i < destination_pitch; i += 4)
+			{
+				const float* e = &even[i];
+				const float* o = &odd[i];
+				__m128 sum = _mm_mul_ps(_mm_add_ps(_mm_loadu_ps(e), _mm_loadu_ps(o + 2 * pixel_size)), _mm_set1_ps(MIP_FILTER_WEIGHTS[2]));
+				sum = _mm_add_ps(sum, _mm_mul_ps(_mm_add_ps(_mm_loadu_ps(o), _mm_loadu_ps(e + 2 * pixel_size)), _mm_set1_ps(MIP_FILTER_WEIGHTS[1])));
+				sum = _mm_add_ps(sum, _mm_mul_ps(_mm_add_ps(_mm_loadu_ps(e + pixel_size), _mm_loadu_ps(o + pixel_size)), _mm_set1_ps(MIP_FILTER_WEIGHTS[0])));
+
+				__m128i words = _mm_packs_epi32(_mm_cvtps_epi32(sum), _mm_setzero_si128());
+				int bytes = _mm_cvtsi128_si32(_mm_packus_epi16(words, _mm_setzero_si128()));
+				std::memcpy(&destination_row[i], &bytes, 4);
+			}
+
+			std::memcpy(destination + y * destination_pitch, &destination_row[0], destination_pitch);
+		}
+
+		image.levels.push_back(next);
+		level = next;
+	}
+}
+
+GLuint CreateTexture(const TextureImage& image, GLenum internal_format, GLenum format)
+{
+	GLuint texture;
+	glGenTextures(1, &texture);
+	glBindTexture(GL_TEXTURE_2D, texture);
+	if (image.compressed)
+		internal_format = GetCompressedInternalFormat(image.block_format);
+	glTexStorage2D(GL_TEXTURE_2D, static_cast<GLsizei>(image.levels.size()), internal_format, image.levels[0].width, image.levels[0].height);
+
+	if (image.compressed)
+	{
+		for (size_t i = 0; i < image.levels.size(); ++i)
+		{
+			const TextureLevel& level = image.levels[i];
+			GLsizei size = static_cast<GLsizei>(GetCompressedSize(image.block_format, level.width, level.height));
+			glCompressedTexSubImage2D(GL_TEXTURE_2D, static_cast<GLint>(i), 0, 0, level.width, level.height, internal_format, size, &image.pixels[level.offset]);
+		}
+
+		return texture;
+	}
+
+	// The rows of 3 byte pixels are not 4 byte aligned on the smaller levels.
+	GLint unpack_alignment;
+	glGetIntegerv(GL_UNPACK_ALIGNMENT, &unpack_alignment);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+
+	for (size_t i = 0; i < image.levels.size(); ++i)
+	{
+		const TextureLevel& level = image.levels[i];
+		glTexSubImage2D(GL_TEXTURE_2D, static_cast<GLint>(i), 0, 0, level.width, level.height, format, GL_UNSIGNED_BYTE, &image.pixels[level.offset]);
+	}
+
+	glPixelStorei(GL_UNPACK_ALIGNMENT, unpack_alignment);
+
+	return texture;
+}
+
+GLuint CreateTextureArray(const TextureImage* images, size_t count, GLenum internal_format, GLenum format)
+{
+	const TextureImage& first = images[0];
+	for (size_t i = 1; i < count; ++i)
+	{
+		const TextureImage& image = images[i];
+		if (image.levels.size() != first.levels.size() || image.levels[0].width != first.levels[0].width || image.levels[0].height != first.levels[0].height)
+			return 0;
+		if (image.compressed != first.compressed || (image.compressed ? image.block_format != first.block_format : image.pixel_size != first.pixel_size))
+			return 0;
+	}
+
+	GLuint texture;
+	glGenTextures(1, &texture);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, texture);
+	if (first.compressed)
+		internal_format = GetCompressedInternalFormat(first.block_format);
+	glTexStorage3D(GL_TEXTURE_2D_ARRAY, static_cast<GLsizei>(first.levels.size()), internal_format, first.levels[0].width, first.levels[0].height, static_cast<GLsizei>(count));
+
+	// The rows of 3 byte pixels are not 4 byte aligned on the smaller levels.
+	GLint unpack_alignment;
+	glGetIntegerv(GL_UNPACK_ALIGNMENT, &unpack_alignment);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+
+	for (size_t layer = 0; layer < count; ++layer)
+	{
+		const TextureImage& image = images[layer];
+		for (size_t i = 0; i < image.levels.size(); ++i)
+		{
+			const TextureLevel& level = image.levels[i];
+			if (image.compressed)
+			{
+				GLsizei size = static_cast<GLsizei>(GetCompressedSize(image.block_format, level.width, level.height));
+				glCompressedTexSubImage3D(GL_TEXTURE_2D_ARRAY, static_cast<GLint>(i), 0, 0, static_cast<GLint>(layer), level.width, level.height, 1, internal_format, size, &image.pixels[level.offset]);
+			}
+			else
+			{
+				glTexSubImage3D(GL_TEXTURE_2D_ARRAY, static_cast<GLint>(i), 0, 0, static_cast<GLint>(layer), level.width, level.height, 1, format, GL_UNSIGNED_BYTE, &image.pixels[level.offset]);
+			}
+		}
+	}
+
+	glPixelStorei(GL_UNPACK_ALIGNMENT, unpack_alignment);
+
+	return texture;
+}
+
+/*
+	Returns the largest anisotropy the driver supports, or zero if it supports neither of the anisotropic filtering
+	extensions. The extensions are only looked up once.
+*/
+static float GetMaxAnisotropy()
+{
+	static float max_anisotropy = -1.0f;
+	if (max_anisotropy < 0.0f)
+	{
+		max_anisotropy = 0.0f;
+
+		GLint extension_count = 0;
+		glGetIntegerv(GL_NUM_EXTENSIONS, &extension_count);
+		for (GLint i = 0; i < extension_count; ++i)
+		{
+			const char* extension = reinterpret_cast<const char*>(glGetStringi(GL_EXTENSIONS, i));
+			if (std::strcmp(extension, "GL_EXT_texture_filter_anisotropic") == 0 || std::strcmp(extension, "GL_ARB_texture_filter_anisotropic") == 0)
+			{
+				glGetFloatv(GL_MAX_TEXTURE_MAX_ANISOTROPY, &max_anisotropy);
+				break;
+			}
+		}
+	}
+
+	return max_anisotropy;
+}
+
+void SetSamplerFiltering(GLuint sampler, float max_anisotropy)
+{
+	glSamplerParameteri(sampler, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glSamplerParameteri(sampler, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+
+	float supported_anisotropy = GetMaxAnisotropy();
+	if (supported_anisotropy > 0.0f)
+		glSamplerParameterf(sampler, GL_TEXTURE_MAX_ANISOTROPY, std::min(std::max(max_anisotropy, 1.0f), supported_anisotropy));
+}
@@ -0,0 +1,93 @@
+#include "../include/common/vertexformat.h"
+#include "../include/common/bounds.h"
+#include <glm/gtc/packing.hpp>
+#include <algorithm>
+#include <cstddef>
+
+static float SignNotZero(float v)
+{
+	return v >= 0.0f ? 1.0f : -1.0f;
+}
+
+glm::vec2 EncodeOctahedral(const glm::vec3& normal)
+{
+	float l1 = std::abs(normal.x) + std::abs(normal.y) + std::abs(normal.z);
+	if (l1 == 0.0f)
+		return glm::vec2(0.0f);
+
+	// Project the normal onto the octahedron and fold the lower hemisphere over the upper one.
+	glm::vec2 encoded = glm::vec2(normal.x, normal.y) / l1;
+	if (normal.z < 0.0f)
+	{
+		encoded = glm::vec2((1.0f - std::abs(encoded.y)) * SignNotZero(encoded.x),
+			(1.0f - std::abs(encoded.x)) * SignNotZero(encoded.y));
+	}
+
+	return encoded;
+}
+
+glm::vec3 DecodeOctahedral(const glm::vec2& encoded)
+{
+	glm::vec3 normal(encoded.x, encoded.y, 1.0f - std::abs(encoded.x) - std::abs(encoded.y));
+	float t = std::max(-normal.z, 0.0f);
+	normal.x += normal.x >= 0.0f ? -t : t;
+	normal.y += normal.y >= 0.0f ? -t : t;
+
+	return glm::normalize(normal);
+}
+
+static int16_t PackSnorm16(float v)
+{
+	return static_cast<int16_t>(glm::round(glm::clamp(v, -1.0f, 1.0f) * 32767.0f));
+}
+
+static uint16_t PackUnorm16(float v)
+{
+	return static_cast<uint16_t>(glm::round(glm::clamp(v, 0.0f, 1.0f) * 65535.0f));
+}
+
+void PackVertices(const glm::vec3* positions, const glm::vec3* normals, const glm::vec2* texcoords, size_t count, std::vector<PackedVertex>& vertices, glm::mat4& dequantization)
+{
+	// Find the bounds. Use the largest extent for all axes to keep the dequantization a uniform scale.
+	AABB aabb;
+	BoundingSphere sphere;
+	ComputeBounds(positions, count, aabb, sphere);
+
+	glm::vec3 extents = aabb.max - aabb.min;
+	float scale = std::max(extents.x, std::max(extents.y, extents.z));
+	float inverse_scale = scale > 0.0f ? 1.0f / scale : 0.0f;
+
+	dequantization = glm::mat4(scale);
+	dequantization[3] = glm::vec4(aabb.min, 1.0f);
+
+	vertices.resize(count);
+	for (size_t i = 0; i < count; ++i)
+	{
+		PackedVertex& vertex = vertices[i];
+
+		glm::vec3 position = (positions[i] - aabb.min) * inverse_scale;
+		vertex.position[0] = PackUnorm16(position.x);
+		vertex.position[1] = PackUnorm16(position.y);
+		vertex.position[2] = PackUnorm16(position.z);
+		vertex.position[3] = 0;
+
+		glm::vec2 normal = normals != nullptr ? EncodeOctahedral(normals[i]) : glm::vec2(0.0f);
+		vertex.normal[0] = PackSnorm16(normal.x);
+		vertex.normal[1] = PackSnorm16(normal.y);
+
+		glm::vec2 texcoord = texcoords != nullptr ? texcoords[i] : glm::vec2(0.0f);
+		vertex.texcoord[0] = glm::packHalf1x16(texcoord.x);
+		vertex.texcoord[1] = glm::packHalf1x16(texcoord.y);
+	}
+}
+
+void SetupPackedVertexAttributes()
+{
+	glVertexAttribPointer(PACKED_ATTRIBUTE_POSITION, 3, GL_UNSIGNED_SHORT, GL_TRUE, sizeof(PackedVertex), reinterpret_cast<const void*>(offsetof(PackedVertex, position)));
+	glVertexAttribPointer(PACKED_ATTRIBUTE_NORMAL, 2, GL_SHORT, GL_TRUE, sizeof(PackedVertex), reinterpret_cast<const void*>(offsetof(PackedVertex, normal)));
+	glVertexAttribPointer(PACKED_ATTRIBUTE_TEXCOORD, 2, GL_HALF_FLOAT, GL_FALSE, sizeof(PackedVertex), reinterpret_cast<const void*>(offsetof(PackedVertex, texcoord)));
+
+	glEnableVertexAttribArray(PACKED_ATTRIBUTE_POSITION);
+	glEnableVertexAttribArray(PACKED_ATTRIBUTE_NORMAL);
+	glEnableVertexAttribArray(PACKED_ATTRIBUTE_TEXCOORD);
+}
@@ -1,7 +1,8 @@
 #include "lighting.hpp"
 #include <iostream>
-#include <gli/gli.hpp>
 #include <glm/gtx/transform.hpp>
+#include <cstddef>
+#include <cstring>
 
 int main(int argc, char* argv[])
 {
@@ -45,14 +46,10 @@ Lighting::Lighting()
 	, glcontext(nullptr)
 	, cube_angle(0.0f)
 	, cube_vertex_count(0)
-	, cube_vbo_positions(0)
-	, cube_vbo_normals(0)
-	, cube_vbo_texcoords(0)
+	, cube_vbo(0)
+	, cube_ibo(0)
 	, cube_vao(0)
-	, cube_texture(0)
-	, mesh_vs(0)
-	, mesh_fs(0)
-	, mesh_program(0)
+	, resources(DIRECTORY_PROGRAM_BINARIES)
 	, uniform_buffer_constant(0)
 	, uniform_buffer_frame(0)
 	, uniform_buffer_cube(0)
@@ -68,21 +65,17 @@ Lighting::Lighting()
 
 Lighting::~Lighting()
 {
-	glDetachShader(mesh_program, mesh_vs);
-	glDetachShader(mesh_program, mesh_fs);
-	glDeleteProgram(mesh_program);
-	glDeleteShader(mesh_vs);
-	glDeleteShader(mesh_fs);
+	mesh_program.reset();
 
 	glDeleteBuffers(1, &uniform_buffer_constant);
 	glDeleteBuffers(1, &uniform_buffer_frame);
 
 	glDeleteBuffers(1, &uniform_buffer_cube);
-	glDeleteBuffers(1, &cube_vbo_positions);
-	glDeleteBuffers(1, &cube_vbo_normals);
-	glDeleteBuffers(1, &cube_vbo_texcoords);
+	glDeleteBuffers(1, &cube_vbo);
+	glDeleteBuffers(1, &cube_ibo);
 	glDeleteVertexArrays(1, &cube_vao);
-	glDeleteTextures(1, &cube_texture);
+	if (!cube_textures.empty())
+		glDeleteTextures(static_cast<GLsizei>(cube_textures.size()), &cube_textures[0]);
 
 	glDeleteSamplers(1, &diffuse_sampler);
 
@@ -163,17 +156,16 @@ void Lighting::SetupContext()
 void Lighting::SetupResources()
 {
 	// Compile the shader program.
-	mesh_vs = CompileShaderFromFile((DIRECTORY_SHADERS + FILE_MESH_VS).c_str(), GL_VERTEX_SHADER);
-	mesh_fs = CompileShaderFromFile((DIRECTORY_SHADERS + FILE_MESH_FS).c_str(), GL_FRAGMENT_SHADER);
-	mesh_program = glCreateProgram();
-	glAttachShader(mesh_program, mesh_vs);
-	glAttachShader(mesh_program, mesh_fs);
-	LinkProgram(mesh_program);
+	const ShaderFile mesh_shaders[] =
+	{
+		{ GL_VERTEX_SHADER, DIRECTORY_SHADERS + FILE_MESH_VS },
+		{ GL_FRAGMENT_SHADER, DIRECTORY_SHADERS + FILE_MESH_FS }
+	};
+	mesh_program = resources.LoadProgram(mesh_shaders, sizeof(mesh_shaders) / sizeof(ShaderFile));
 
 	// Generate a texture sampler.
 	glGenSamplers(1, &diffuse_sampler);
-	glSamplerParameteri(diffuse_sampler, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-	glSamplerParameteri(diffuse_sampler, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	SetSamplerFiltering(diffuse_sampler, TEXTURE_ANISOTROPY_DEFAULT);
 	glSamplerParameteri(diffuse_sampler, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
 	glSamplerParameteri(diffuse_sampler, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
 
@@ -203,45 +195,53 @@ void Lighting::SetupResources()
 		throw std::runtime_error("Failed to load OBJ model: " + DIRECTORY_MODELS + FILE_CUBE_MODEL);
 	}
 
-	// Setup the cube buffers.
-	glGenVertexArrays(1, &cube_vao);
-	glBindVertexArray(cube_vao);
+	// Load the cube materials and make the faces of each material contiguous.
+	if (!LoadMTL((DIRECTORY_MODELS + cube_model.mtllib).c_str(), cube_materials) || cube_materials.empty())
+	{
+		throw std::runtime_error("Failed to load material library: " + DIRECTORY_MODELS + cube_model.mtllib);
+	}
 
-	glGenBuffers(1, &cube_vbo_positions);
-	glBindBuffer(GL_ARRAY_BUFFER, cube_vbo_positions);
-	glBufferData(GL_ARRAY_BUFFER, cube_model.positions.size() * sizeof(glm::vec3), &cube_model.positions[0], GL_STATIC_DRAW);
-	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, 0);
+	SortOBJByMaterial(cube_model, cube_materials);
 
-	glGenBuffers(1, &cube_vbo_normals);
-	glBindBuffer(GL_ARRAY_BUFFER, cube_vbo_normals);
-	glBufferData(GL_ARRAY_BUFFER, cube_model.normals.size() * sizeof(glm::vec3), &cube_model.normals[0], GL_STATIC_DRAW);
-	glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 0, 0);
+	// Index the model and optimize it for the vertex cache, overdraw and vertex fetch.
+	IndexedMesh cube_mesh;
+	BuildIndexedMesh(cube_model, cube_mesh);
+	OptimizeMesh(cube_mesh, nullptr);
+	BuildMaterialBatches(cube_mesh.submeshes, cube_materials, cube_batches);
 
-	glGenBuffers(1, &cube_vbo_texcoords);
-	glBindBuffer(GL_ARRAY_BUFFER, cube_vbo_texcoords);
-	glBufferData(GL_ARRAY_BUFFER, cube_model.texcoords.size() * sizeof(glm::vec2), &cube_model.texcoords[0], GL_STATIC_DRAW);
-	glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 0, 0);
+	// Pack the vertices into the compressed format and setup the cube buffers.
+	std::vector<PackedVertex> cube_vertices;
+	PackVertices(&cube_mesh.positions[0], &cube_mesh.normals[0], &cube_mesh.texcoords[0], cube_mesh.positions.size(), cube_vertices, cube_dequantization);
 
-	glEnableVertexAttribArray(0);
-	glEnableVertexAttribArray(1);
-	glEnableVertexAttribArray(2);
+	glGenVertexArrays(1, &cube_vao);
+	glBindVertexArray(cube_vao);
+
+	glGenBuffers(1, &cube_vbo);
+	glBindBuffer(GL_ARRAY_BUFFER, cube_vbo);
+	glBufferData(GL_ARRAY_BUFFER, cube_vertices.size() * sizeof(PackedVertex), &cube_vertices[0], GL_STATIC_DRAW);
+	SetupPackedVertexAttributes();
 
-	cube_vertex_count = cube_model.positions.size();
+	glGenBuffers(1, &cube_ibo);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, cube_ibo);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, cube_mesh.indices.size() * sizeof(unsigned int), &cube_mesh.indices[0], GL_STATIC_DRAW);
 
-	// Load the cube material.
-	MTL cube_material;
-	if (!LoadMTL((DIRECTORY_MODELS + cube_model.mtllib).c_str(), cube_material))
+	cube_vertex_count = static_cast<GLuint>(cube_mesh.positions.size());
+
+	// Load the diffuse texture of each material batch.
+	cube_textures.resize(cube_batches.size());
+	for (size_t i = 0; i < cube_batches.size(); ++i)
 	{
-		throw std::runtime_error("Failed to load material library: " + DIRECTORY_MODELS + cube_model.mtllib);
-	}
+		const MTL& cube_material = cube_materials[cube_batches[i].material];
+		TextureImage cube_texture_image;
+		if (!LoadDDSFile(DIRECTORY_TEXTURES + cube_material.map_Kd, cube_texture_image))
+		{
+			throw std::runtime_error("Failed to load texture: " + DIRECTORY_TEXTURES + cube_material.map_Kd);
+		}
 
-	gli::storage cube_texture_image = gli::load_dds((DIRECTORY_TEXTURES + cube_material.map_Kd).c_str());
-	glGenTextures(1, &cube_texture);
-	glBindTexture(GL_TEXTURE_2D, cube_texture);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB8, cube_texture_image.dimensions(0).x, cube_texture_image.dimensions(0).y, 0, GL_BGR, GL_UNSIGNED_BYTE, cube_texture_image.data());
+		cube_textures[i] = CreateTexture(cube_texture_image, GL_RGB8, GL_BGR);
+	}
 
-	// Setup the instance buffer.
-	uniform_data_cube.material_specular_color = glm::vec4(cube_material.Ks, cube_material.Ns);
+	// Setup the instance buffer. The material specular color is filled in per batch when rendering.
 
 	glGenBuffers(1, &uniform_buffer_cube);
 	glBindBufferBase(GL_UNIFORM_BUFFER, UNIFORM_BINDING_INSTANCE, uniform_buffer_cube);
@@ -263,6 +263,7 @@ void Lighting::Run()
 		HandleEvents();
 		UpdateCamera(dt);
 		UpdateScene(dt);
+		ReloadShaders();
 		RenderScene();
 	}
 }
@@ -374,10 +375,22 @@ void Lighting::UpdateCamera(float dt)
 void Lighting::UpdateScene(float dt)
 {
 	cube_angle += CUBE_ROTATION_SPEED * dt;
-	uniform_data_cube.model_matrix = glm::rotate(cube_angle, glm::vec3(0.0f, 1.0f, 0.0f));
+	uniform_data_cube.model_matrix = glm::rotate(cube_angle, glm::vec3(0.0f, 1.0f, 0.0f)) * cube_dequantization;
 	uniform_data_cube.normal_matrix = glm::mat4(glm::transpose(glm::inverse(glm::mat3(uniform_data_cube.model_matrix))));
 }
 
+void Lighting::ReloadShaders()
+{
+	// Rebuild the programs whose shader files were edited. Programs that fail to build keep their previous version.
+	std::vector<std::string> errors;
+	unsigned int reloaded = resources.ReloadChangedPrograms(errors);
+	for (size_t i = 0; i < errors.size(); ++i)
+		std::cerr << errors[i] << std::endl;
+
+	if (reloaded > 0)
+		std::cout << "Reloaded " << reloaded << " shader programs" << std::endl;
+}
+
 void Lighting::RenderScene()
 {
 	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
@@ -388,17 +401,26 @@ void Lighting::RenderScene()
 	glBindBufferBase(GL_UNIFORM_BUFFER, UNIFORM_BINDING_FRAME, uniform_buffer_frame);
 	glBufferData(GL_UNIFORM_BUFFER, sizeof(UniformBufferPerFrame), &uniform_data_frame, GL_DYNAMIC_DRAW);
 
-	glUseProgram(mesh_program);
+	glUseProgram(mesh_program->name);
 
 	glActiveTexture(GL_TEXTURE0 + TEXTURE_UNIT_DIFFUSE);
 	glBindSampler(TEXTURE_UNIT_DIFFUSE, diffuse_sampler);
-	glBindTexture(GL_TEXTURE_2D, cube_texture);
 
 	glBindBufferBase(GL_UNIFORM_BUFFER, UNIFORM_BINDING_INSTANCE, uniform_buffer_cube);
 	glBufferData(GL_UNIFORM_BUFFER, sizeof(UniformBufferPerInstance), &uniform_data_cube, GL_DYNAMIC_DRAW);
 	
+	// Draw the cube one material batch at a time.
 	glBindVertexArray(cube_vao);
-	glDrawArrays(GL_TRIANGLES, 0, cube_vertex_count);
+	for (size_t i = 0; i < cube_batches.size(); ++i)
+	{
+		const MaterialBatch& batch = cube_batches[i];
+		const MTL& cube_material = cube_materials[batch.material];
+		uniform_data_cube.material_specular_color = glm::vec4(cube_material.Ks, cube_material.Ns);
+		glBufferSubData(GL_UNIFORM_BUFFER, offsetof(UniformBufferPerInstance, material_specular_color), sizeof(glm::vec4), &uniform_data_cube.material_specular_color);
+
+		glBindTexture(GL_TEXTURE_2D, cube_textures[i]);
+		glMultiDrawElements(GL_TRIANGLES, &batch.counts[0], GL_UNSIGNED_INT, &batch.offsets[0], static_cast<GLsizei>(batch.offsets.size()));
+	}
 
 	SDL_GL_SwapWindow(window);
 }
\ No newline at end of file
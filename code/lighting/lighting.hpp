@@ -20,13 +20,19 @@
 #include <GL/gl3w.h>
 #include <glm/glm.hpp>
 #include <common/model.h>
+#include <common/mesh.h>
+#include <common/vertexformat.h>
 #include <common/shader.h>
 #include <common/camera.h>
+#include <common/resourcecache.h>
+#include <common/texture.h>
 #include <SDL2/SDL.h>
 #include <string>
+#include <vector>
 
 const std::string WINDOW_TITLE = "Transformation & Lighting";
 const std::string DIRECTORY_ASSETS_ROOT = "../../../assets/";
+const std::string DIRECTORY_PROGRAM_BINARIES = "./";
 const std::string DIRECTORY_SHADERS = "../../../code/lighting/shaders/";
 const std::string DIRECTORY_MODELS = DIRECTORY_ASSETS_ROOT + "models/";
 const std::string DIRECTORY_TEXTURES = DIRECTORY_ASSETS_ROOT + "textures/";
@@ -107,14 +113,15 @@ private:
 	UniformBufferPerInstance uniform_data_cube;
 	float cube_angle;
 	GLuint cube_vertex_count;
-	GLuint cube_vbo_positions;
-	GLuint cube_vbo_normals;
-	GLuint cube_vbo_texcoords;
+	GLuint cube_vbo;
+	GLuint cube_ibo;
+	glm::mat4 cube_dequantization;
 	GLuint cube_vao;
-	GLuint cube_texture;
-	GLuint mesh_vs;
-	GLuint mesh_fs;
-	GLuint mesh_program;
+	std::vector<MTL> cube_materials;
+	std::vector<MaterialBatch> cube_batches;
+	std::vector<GLuint> cube_textures;
+	ResourceCache resources;
+	ResourceHandle mesh_program;
 	GLuint uniform_buffer_constant;
 	GLuint uniform_buffer_frame;
 	GLuint uniform_buffer_cube;
@@ -129,5 +136,6 @@ private:
 	void HandleEvents();
 	void UpdateCamera(float dt);
 	void UpdateScene(float dt);
+	void ReloadShaders();
 	void RenderScene();
 };
\ No newline at end of file
@@ -1,7 +1,7 @@
 #version 440
 
 layout(location = 0) in vec3 in_position_M;
-layout(location = 1) in vec3 in_normal_M;
+layout(location = 1) in vec2 in_normal_M;	// Octahedral encoded.
 layout(location = 2) in vec2 in_texcoord;
 
 out vec3 vs_position_W;
@@ -22,10 +22,19 @@ layout(binding = 2, std140) uniform PerInstance
     vec4 material_specular_color;
 };
 
+vec3 DecodeOctahedral(vec2 encoded)
+{
+	vec3 normal = vec3(encoded.xy, 1.0f - abs(encoded.x) - abs(encoded.y));
+	float t = max(-normal.z, 0.0f);
+	normal.x += normal.x >= 0.0f ? -t : t;
+	normal.y += normal.y >= 0.0f ? -t : t;
+	return normal;
+}
+
 void main()
 {
 	gl_Position = projection_matrix * view_matrix * model_matrix * vec4(in_position_M, 1.0f);
 	vs_position_W = (model_matrix * vec4(in_position_M, 1.0f)).xyz;
-	vs_normal_W = normalize(mat3(normal_matrix) * in_normal_M);
+	vs_normal_W = normalize(mat3(normal_matrix) * DecodeOctahedral(in_normal_M));
 	vs_texcoord = in_texcoord;
 }
\ No newline at end of file
@@ -1,7 +1,10 @@
 #include "objviewer.hpp"
 #include <iostream>
-#include <gli/gli.hpp>
 #include <glm/gtx/transform.hpp>
+#include <cstddef>
+#include <cstring>
+#include <algorithm>
+#include <memory>
 
 int main(int argc, char* argv[])
 {
@@ -46,14 +49,13 @@ OBJViewer::OBJViewer()
 	, glcontext(nullptr)
 	, model_angle(0.0f)
 	, model_vertex_count(0)
-	, model_vbo_positions(0)
-	, model_vbo_normals(0)
-	, model_vbo_texcoords(0)
+	, model_vbo(0)
+	, model_ibo(0)
 	, model_vao(0)
-	, model_texture(0)
-	, mesh_vs(0)
-	, mesh_fs(0)
-	, mesh_program(0)
+	, model_lod(0)
+	, model_ready(false)
+	, model_texture_loads(0)
+	, resources(DIRECTORY_PROGRAM_BINARIES)
 	, uniform_buffer_constant(0)
 	, uniform_buffer_frame(0)
 	, uniform_buffer_model(0)
@@ -61,6 +63,7 @@ OBJViewer::OBJViewer()
 	, viewport_width(VIEWPORT_WIDTH_INITIAL)
 	, viewport_height(VIEWPORT_HEIGHT_INITIAL)
 	, running(true)
+	, setup_clock(0)
 {
 	SetupContext();
 	SetupResources();
@@ -69,21 +72,17 @@ OBJViewer::OBJViewer()
 
 OBJViewer::~OBJViewer()
 {
-	glDetachShader(mesh_program, mesh_vs);
-	glDetachShader(mesh_program, mesh_fs);
-	glDeleteProgram(mesh_program);
-	glDeleteShader(mesh_vs);
-	glDeleteShader(mesh_fs);
+	mesh_program.reset();
 
 	glDeleteBuffers(1, &uniform_buffer_constant);
 	glDeleteBuffers(1, &uniform_buffer_frame);
 
 	glDeleteBuffers(1, &uniform_buffer_model);
-	glDeleteBuffers(1, &model_vbo_positions);
-	glDeleteBuffers(1, &model_vbo_normals);
-	glDeleteBuffers(1, &model_vbo_texcoords);
+	glDeleteBuffers(1, &model_vbo);
+	glDeleteBuffers(1, &model_ibo);
 	glDeleteVertexArrays(1, &model_vao);
-	glDeleteTextures(1, &model_texture);
+	if (!model_textures.empty())
+		glDeleteTextures(static_cast<GLsizei>(model_textures.size()), &model_textures[0]);
 
 	glDeleteSamplers(1, &diffuse_sampler);
 
@@ -161,20 +160,60 @@ void OBJViewer::SetupContext()
 	SDL_GL_SetSwapInterval(1);
 }
 
+// Load the model and prepare it for rendering. Run on a worker thread, so nothing here may touch OpenGL.
+static void LoadModelAsset(ModelAsset& asset)
+{
+	// Load the model.
+	OBJ model;
+	if (!LoadOBJ((DIRECTORY_MODELS + FILE_MODEL).c_str(), model))
+	{
+		throw std::runtime_error("Failed to load OBJ model: " + DIRECTORY_MODELS + FILE_MODEL);
+	}
+
+	// Load the model materials and make the faces of each material contiguous.
+	if (!LoadMTL((DIRECTORY_MODELS + model.mtllib).c_str(), asset.materials) || asset.materials.empty())
+	{
+		throw std::runtime_error("Failed to load material library: " + DIRECTORY_MODELS + model.mtllib);
+	}
+
+	SortOBJByMaterial(model, asset.materials);
+	asset.bounding_sphere = model.bounding_sphere;
+
+	// Index the model and optimize it for the vertex cache, overdraw and vertex fetch.
+	IndexedMesh mesh;
+	BuildIndexedMesh(model, mesh);
+	OptimizeMesh(mesh, &asset.mesh_statistics);
+
+	// Partition the full detail mesh into meshlets for the culling benchmark.
+	BuildMeshlets(&mesh.indices[0], mesh.indices.size(), &mesh.positions[0], mesh.positions.size(), asset.meshlets, asset.meshlet_vertices, asset.meshlet_triangles);
+
+	// Generate the levels of detail into the same index buffer, with the material batches of each level.
+	BuildMeshLODs(mesh, MODEL_LOD_RATIOS, MODEL_LOD_RATIO_COUNT, asset.lods);
+	asset.lod_batches.resize(asset.lods.size());
+	for (size_t i = 0; i < asset.lods.size(); ++i)
+		BuildMaterialBatches(asset.lods[i].submeshes, asset.materials, asset.lod_batches[i]);
+
+	// Pack the vertices into the compressed format.
+	PackVertices(&mesh.positions[0], &mesh.normals[0], &mesh.texcoords[0], mesh.positions.size(), asset.vertices, asset.dequantization);
+	asset.indices.swap(mesh.indices);
+}
+
 void OBJViewer::SetupResources()
 {
+	// Record the files read while setting up, for the report once everything is loaded.
+	SetFileReadRecording(true);
+
 	// Compile the shader program.
-	mesh_vs = CompileShaderFromFile((DIRECTORY_SHADERS + FILE_MESH_VS).c_str(), GL_VERTEX_SHADER);
-	mesh_fs = CompileShaderFromFile((DIRECTORY_SHADERS + FILE_MESH_FS).c_str(), GL_FRAGMENT_SHADER);
-	mesh_program = glCreateProgram();
-	glAttachShader(mesh_program, mesh_vs);
-	glAttachShader(mesh_program, mesh_fs);
-	LinkProgram(mesh_program);
+	const ShaderFile mesh_shaders[] =
+	{
+		{ GL_VERTEX_SHADER, DIRECTORY_SHADERS + FILE_MESH_VS },
+		{ GL_FRAGMENT_SHADER, DIRECTORY_SHADERS + FILE_MESH_FS }
+	};
+	mesh_program = resources.LoadProgram(mesh_shaders, sizeof(mesh_shaders) / sizeof(ShaderFile));
 
 	// Generate a texture sampler.
 	glGenSamplers(1, &diffuse_sampler);
-	glSamplerParameteri(diffuse_sampler, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-	glSamplerParameteri(diffuse_sampler, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	SetSamplerFiltering(diffuse_sampler, TEXTURE_ANISOTROPY_DEFAULT);
 	glSamplerParameteri(diffuse_sampler, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
 	glSamplerParameteri(diffuse_sampler, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
 
@@ -197,60 +236,109 @@ void OBJViewer::SetupResources()
 	glBindBufferBase(GL_UNIFORM_BUFFER, UNIFORM_BINDING_CONSTANT, uniform_buffer_constant);
 	glBufferData(GL_UNIFORM_BUFFER, sizeof(UniformBufferConstant), &uniform_data_constant, GL_STATIC_DRAW);
 
-	// Load the model.
-	OBJ model;
-	if (!LoadOBJ((DIRECTORY_MODELS + FILE_MODEL).c_str(), model))
+	// Setup the instance buffer. The model matrix is set every frame and the material specular color per batch.
+	glGenBuffers(1, &uniform_buffer_model);
+	glBindBufferBase(GL_UNIFORM_BUFFER, UNIFORM_BINDING_INSTANCE, uniform_buffer_model);
+	glBufferData(GL_UNIFORM_BUFFER, sizeof(UniformBufferPerInstance), &uniform_data_model, GL_DYNAMIC_DRAW);
+
+	// Load the model in the background. It is drawn once its buffers have been uploaded.
+	std::shared_ptr<ModelAsset> asset = std::make_shared<ModelAsset>();
+	setup_clock = SDL_GetTicks();
+	jobs.Push([asset]() { LoadModelAsset(*asset); }, [this, asset]() { UploadModel(*asset); });
+}
+
+void OBJViewer::UploadModel(ModelAsset& asset)
+{
+	// Report on the model here rather than on the worker, so the output does not interleave with the main thread's.
+	const MeshOptimizationStatistics& mesh_statistics = asset.mesh_statistics;
+	std::cout << "Vertex cache ACMR: " << mesh_statistics.before.acmr << " -> " << mesh_statistics.after.acmr
+		<< ", ATVR: " << mesh_statistics.before.atvr << " -> " << mesh_statistics.after.atvr << std::endl;
+	std::cout << "Meshlets: " << asset.meshlets.size() << std::endl;
+	for (size_t i = 0; i < asset.lods.size(); ++i)
 	{
-		throw std::runtime_error("Failed to load OBJ model: " + DIRECTORY_MODELS + FILE_MODEL);
+		unsigned int triangle_count = 0;
+		for (size_t j = 0; j < asset.lods[i].submeshes.size(); ++j)
+			triangle_count += asset.lods[i].submeshes[j].count / 3;
+
+		std::cout << "LOD " << i << ": " << triangle_count << " triangles, error " << asset.lods[i].error << std::endl;
 	}
 
+	model_materials.swap(asset.materials);
+	model_lods.swap(asset.lods);
+	model_lod_batches.swap(asset.lod_batches);
+	model_bounding_sphere = asset.bounding_sphere;
+	model_meshlets.swap(asset.meshlets);
+	model_meshlet_vertices.swap(asset.meshlet_vertices);
+	model_meshlet_triangles.swap(asset.meshlet_triangles);
+	model_dequantization = asset.dequantization;
+
 	// Setup the model buffers.
 	glGenVertexArrays(1, &model_vao);
 	glBindVertexArray(model_vao);
 
-	glGenBuffers(1, &model_vbo_positions);
-	glBindBuffer(GL_ARRAY_BUFFER, model_vbo_positions);
-	glBufferData(GL_ARRAY_BUFFER, model.positions.size() * sizeof(glm::vec3), &model.positions[0], GL_STATIC_DRAW);
-	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, 0);
-
-	glGenBuffers(1, &model_vbo_normals);
-	glBindBuffer(GL_ARRAY_BUFFER, model_vbo_normals);
-	glBufferData(GL_ARRAY_BUFFER, model.normals.size() * sizeof(glm::vec3), &model.normals[0], GL_STATIC_DRAW);
-	glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 0, 0);
-
-	glGenBuffers(1, &model_vbo_texcoords);
-	glBindBuffer(GL_ARRAY_BUFFER, model_vbo_texcoords);
-	glBufferData(GL_ARRAY_BUFFER, model.texcoords.size() * sizeof(glm::vec2), &model.texcoords[0], GL_STATIC_DRAW);
-	glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 0, 0);
-
-	glEnableVertexAttribArray(0);
-	glEnableVertexAttribArray(1);
-	glEnableVertexAttribArray(2);
-
-	model_vertex_count = model.positions.size();
-
-	// Load the model material.
-	MTL material;
-	if (!LoadMTL((DIRECTORY_MODELS + model.mtllib).c_str(), material))
+	glGenBuffers(1, &model_vbo);
+	glBindBuffer(GL_ARRAY_BUFFER, model_vbo);
+	glBufferData(GL_ARRAY_BUFFER, asset.vertices.size() * sizeof(PackedVertex), &asset.vertices[0], GL_STATIC_DRAW);
+	SetupPackedVertexAttributes();
+
+	glGenBuffers(1, &model_ibo);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, model_ibo);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, asset.indices.size() * sizeof(unsigned int), &asset.indices[0], GL_STATIC_DRAW);
+
+	model_vertex_count = static_cast<GLuint>(asset.vertices.size());
+
+	// Give each material batch a white placeholder texture, replaced by its diffuse texture once decoded. The
+	// textures are immutable, so the placeholder is deleted rather than respecified.
+	// The batches are the same for all levels of detail, only their ranges differ.
+	TextureImage white;
+	white.pixels.assign(3, 255);
+	white.levels.push_back(TextureLevel());
+	white.levels[0].width = 1;
+	white.levels[0].height = 1;
+	white.levels[0].offset = 0;
+	white.pixel_size = 3;
+	white.compressed = false;
+	model_textures.resize(model_lod_batches[0].size());
+	for (size_t i = 0; i < model_lod_batches[0].size(); ++i)
 	{
-		throw std::runtime_error("Failed to load material library: " + DIRECTORY_MODELS + model.mtllib);
+		model_textures[i] = CreateTexture(white, GL_RGB8, GL_RGB);
+
+		// Materials without a diffuse texture keep the placeholder.
+		const std::string& map_Kd = model_materials[model_lod_batches[0][i].material].map_Kd;
+		if (map_Kd.empty())
+			continue;
+
+		// Decoding and generating the mip levels are done on the worker.
+		std::string filepath = DIRECTORY_TEXTURES + map_Kd;
+		std::shared_ptr<TextureImage> image = std::make_shared<TextureImage>();
+		++model_texture_loads;
+		jobs.Push([filepath, image]()
+		{
+			if (!LoadDDSFile(filepath, *image))
+				throw std::runtime_error("Failed to load texture: " + filepath);
+		},
+		[this, i, image]()
+		{
+			glDeleteTextures(1, &model_textures[i]);
+			model_textures[i] = CreateTexture(*image, GL_RGB8, GL_BGR);
+			if (--model_texture_loads == 0)
+				ReportFileReads();
+		});
 	}
 
-	gli::storage model_texture_image = gli::load_dds((DIRECTORY_TEXTURES + material.map_Kd).c_str());
-	glGenTextures(1, &model_texture);
-	glBindTexture(GL_TEXTURE_2D, model_texture);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB8, model_texture_image.dimensions(0).x, model_texture_image.dimensions(0).y, 0, GL_BGR, GL_UNSIGNED_BYTE, model_texture_image.data());
-
-	// Setup the instance buffer.
-	uniform_data_model.material_specular_color = glm::vec4(material.Ks, material.Ns);
-	uniform_data_model.model_matrix = glm::scale(glm::vec3(0.01f, 0.01f, 0.01f));
-	uniform_data_model.normal_matrix = glm::mat4(glm::transpose(glm::inverse(glm::mat3(uniform_data_model.model_matrix))));
-
-	glGenBuffers(1, &uniform_buffer_model);
-	glBindBufferBase(GL_UNIFORM_BUFFER, UNIFORM_BINDING_INSTANCE, uniform_buffer_model);
-	glBufferData(GL_UNIFORM_BUFFER, sizeof(UniformBufferPerInstance), &uniform_data_model, GL_DYNAMIC_DRAW);
+	model_ready = true;
+	std::cout << "Model ready " << SDL_GetTicks() - setup_clock << " ms after setup" << std::endl;
 
+	// Report the files read once the textures have been loaded as well.
+	if (model_texture_loads == 0)
+		ReportFileReads();
+}
 
+// Report the time spent reading each file, and stop recording the reads.
+void OBJViewer::ReportFileReads()
+{
+	PrintFileReads();
+	SetFileReadRecording(false);
 }
 
 void OBJViewer::Run()
@@ -266,6 +354,8 @@ void OBJViewer::Run()
 		HandleEvents();
 		UpdateCamera(dt);
 		UpdateScene(dt);
+		ReloadShaders();
+		jobs.Update(ASSET_UPLOAD_BUDGET);
 		RenderScene();
 	}
 }
@@ -377,8 +467,34 @@ void OBJViewer::UpdateCamera(float dt)
 void OBJViewer::UpdateScene(float dt)
 {
 	model_angle += MODEL_ROTATION_SPEED * dt;
-	uniform_data_model.model_matrix = glm::scale(glm::vec3(0.05f, 0.05f, 0.05f)) * glm::rotate(model_angle, glm::vec3(0.0f, 1.0f, 0.0f));
+	uniform_data_model.model_matrix = glm::scale(glm::vec3(MODEL_SCALE, MODEL_SCALE, MODEL_SCALE)) * glm::rotate(model_angle, glm::vec3(0.0f, 1.0f, 0.0f)) * model_dequantization;
 	uniform_data_model.normal_matrix = glm::mat4(glm::transpose(glm::inverse(glm::mat3(uniform_data_model.model_matrix))));
+
+	// Once the model is loaded, pick the level of detail by the size of its error on screen, at the closest point
+	// of the bounding sphere.
+	if (model_ready)
+	{
+		glm::mat4 model_matrix = glm::scale(glm::vec3(MODEL_SCALE, MODEL_SCALE, MODEL_SCALE)) * glm::rotate(model_angle, glm::vec3(0.0f, 1.0f, 0.0f));
+		glm::vec3 center_W = glm::vec3(model_matrix * glm::vec4(model_bounding_sphere.center, 1.0f));
+		float distance = std::max(glm::length(camera.GetPosition() - center_W) - model_bounding_sphere.radius * MODEL_SCALE, PERSPECTIVE_NEAR);
+		float pixels_per_unit = MODEL_SCALE * viewport_height / (2.0f * std::tan(PERSPECTIVE_FOV * 0.5f));
+		model_lod = SelectMeshLOD(model_lods, distance, pixels_per_unit, MODEL_LOD_PIXEL_ERROR);
+	}
+
+	if (model_ready && input_state_current.keys[SDL_SCANCODE_C] && !input_state_previous.keys[SDL_SCANCODE_C])
+		RunCullingBenchmark();
+}
+
+void OBJViewer::ReloadShaders()
+{
+	// Rebuild the programs whose shader files were edited. Programs that fail to build keep their previous version.
+	std::vector<std::string> errors;
+	unsigned int reloaded = resources.ReloadChangedPrograms(errors);
+	for (size_t i = 0; i < errors.size(); ++i)
+		std::cerr << errors[i] << std::endl;
+
+	if (reloaded > 0)
+		std::cout << "Reloaded " << reloaded << " shader programs" << std::endl;
 }
 
 void OBJViewer::RenderScene()
@@ -391,17 +507,93 @@ void OBJViewer::RenderScene()
 	glBindBufferBase(GL_UNIFORM_BUFFER, UNIFORM_BINDING_FRAME, uniform_buffer_frame);
 	glBufferData(GL_UNIFORM_BUFFER, sizeof(UniformBufferPerFrame), &uniform_data_frame, GL_DYNAMIC_DRAW);
 
-	glUseProgram(mesh_program);
+	glUseProgram(mesh_program->name);
 
 	glActiveTexture(GL_TEXTURE0 + TEXTURE_UNIT_DIFFUSE);
 	glBindSampler(TEXTURE_UNIT_DIFFUSE, diffuse_sampler);
-	glBindTexture(GL_TEXTURE_2D, model_texture);
 
 	glBindBufferBase(GL_UNIFORM_BUFFER, UNIFORM_BINDING_INSTANCE, uniform_buffer_model);
 	glBufferData(GL_UNIFORM_BUFFER, sizeof(UniformBufferPerInstance), &uniform_data_model, GL_DYNAMIC_DRAW);
 
-	glBindVertexArray(model_vao);
-	glDrawArrays(GL_TRIANGLES, 0, model_vertex_count);
+	// Draw the model one material batch at a time, at the selected level of detail, once it has been loaded.
+	if (model_ready)
+	{
+		const std::vector<MaterialBatch>& model_batches = model_lod_batches[model_lod];
+		glBindVertexArray(model_vao);
+		for (size_t i = 0; i < model_batches.size(); ++i)
+		{
+			const MaterialBatch& batch = model_batches[i];
+			const MTL& material = model_materials[batch.material];
+			uniform_data_model.material_specular_color = glm::vec4(material.Ks, material.Ns);
+			glBufferSubData(GL_UNIFORM_BUFFER, offsetof(UniformBufferPerInstance, material_specular_color), sizeof(glm::vec4), &uniform_data_model.material_specular_color);
+
+			glBindTexture(GL_TEXTURE_2D, model_textures[i]);
+			glMultiDrawElements(GL_TRIANGLES, &batch.counts[0], GL_UNSIGNED_INT, &batch.offsets[0], static_cast<GLsizei>(batch.offsets.size()));
+		}
+	}
 
 	SDL_GL_SwapWindow(window);
-}
\ No newline at end of file
+}
+
+void OBJViewer::RunCullingBenchmark()
+{
+	// The meshlet bounds are in model space, without the dequantization, so the planes and the camera position
+	// are brought into that space instead. The model matrix has a uniform scale, so renormalizing the planes is enough.
+	glm::mat4 model_matrix = glm::scale(glm::vec3(MODEL_SCALE, MODEL_SCALE, MODEL_SCALE)) * glm::rotate(model_angle, glm::vec3(0.0f, 1.0f, 0.0f));
+	glm::mat4 inverse_model_matrix = glm::inverse(model_matrix);
+
+	size_t total_triangle_count = 0;
+	for (size_t i = 0; i < model_meshlets.size(); ++i)
+		total_triangle_count += model_meshlets[i].triangle_count;
+
+	// Cull from the current camera and from views orbiting the model at the same distance and height.
+	Camera view_camera = camera;
+	float distance = glm::length(glm::vec2(camera.GetPosition().x, camera.GetPosition().z));
+	std::vector<unsigned int> visible;
+	float rejected_min = 1.0f;
+	float rejected_max = 0.0f;
+	float rejected_sum = 0.0f;
+	int64_t culling_time = 0;
+	Timer culling_timer;
+	for (int view = 0; view <= CULLING_BENCHMARK_VIEW_COUNT; ++view)
+	{
+		if (view > 0)
+		{
+			float angle = 2.0f * glm::pi<float>() * view / CULLING_BENCHMARK_VIEW_COUNT;
+			view_camera.SetPosition(glm::vec3(distance * std::cos(angle), camera.GetPosition().y, distance * std::sin(angle)));
+			view_camera.LookAt(glm::vec3(0.0f, 0.0f, 0.0f));
+			view_camera.RecalculateMatrices();
+		}
+
+		glm::vec4 planes[6];
+		view_camera.GetFrustumPlanes(planes);
+		for (int p = 0; p < 6; ++p)
+		{
+			planes[p] = glm::transpose(model_matrix) * planes[p];
+			planes[p] /= glm::length(glm::vec3(planes[p]));
+		}
+
+		glm::vec3 camera_position_M = glm::vec3(inverse_model_matrix * glm::vec4(view_camera.GetPosition(), 1.0f));
+
+		culling_timer.Start();
+		size_t visible_triangle_count = CullMeshlets(model_meshlets, planes, camera_position_M, visible);
+		culling_time += culling_timer.End();
+
+		float rejected = 1.0f - static_cast<float>(visible_triangle_count) / total_triangle_count;
+		if (view == 0)
+		{
+			std::cout << "Current view: " << visible.size() << "/" << model_meshlets.size() << " meshlets visible, "
+				<< rejected * 100.0f << "% of the triangles rejected" << std::endl;
+		}
+		else
+		{
+			rejected_min = std::min(rejected_min, rejected);
+			rejected_max = std::max(rejected_max, rejected);
+			rejected_sum += rejected;
+		}
+	}
+
+	std::cout << "Orbit of " << CULLING_BENCHMARK_VIEW_COUNT << " views: " << rejected_sum / CULLING_BENCHMARK_VIEW_COUNT * 100.0f
+		<< "% of the triangles rejected on average (min " << rejected_min * 100.0f << "%, max " << rejected_max * 100.0f << "%)" << std::endl;
+	std::cout << "Culling time: " << culling_time / (CULLING_BENCHMARK_VIEW_COUNT + 1.0f) << " us per view" << std::endl;
+}
@@ -10,6 +10,7 @@
 	Camera controls:
 		Move: W, A, S, D.
 		Pan: Hold left mouse button and drag.
+	Run the meshlet culling benchmark: C
 */
 
 #pragma once
@@ -20,13 +21,23 @@
 #include <GL/gl3w.h>
 #include <glm/glm.hpp>
 #include <common/model.h>
+#include <common/mesh.h>
+#include <common/meshlet.h>
+#include <common/vertexformat.h>
 #include <common/shader.h>
 #include <common/camera.h>
+#include <common/fileio.h>
+#include <common/timer.h>
+#include <common/jobqueue.h>
+#include <common/resourcecache.h>
+#include <common/texture.h>
 #include <SDL2/SDL.h>
 #include <string>
+#include <vector>
 
 const std::string WINDOW_TITLE = "OBJ-Viewer";
 const std::string DIRECTORY_ASSETS_ROOT = "../../../assets/";
+const std::string DIRECTORY_PROGRAM_BINARIES = "./";
 const std::string DIRECTORY_SHADERS = "../../../code/objviewer/shaders/";
 const std::string DIRECTORY_MODELS = DIRECTORY_ASSETS_ROOT + "models/";
 const std::string DIRECTORY_TEXTURES = DIRECTORY_ASSETS_ROOT + "textures/";
@@ -45,6 +56,12 @@ const float PERSPECTIVE_FOV = glm::radians(75.0f);
 const float CAMERA_SENSITIVITY = 0.005f;
 const float CAMERA_MOVE_SPEED = 0.1f;
 const float MODEL_ROTATION_SPEED = 1.0f;
+const float MODEL_SCALE = 0.05f;
+const float MODEL_LOD_RATIOS[] = { 0.5f, 0.25f, 0.125f };
+const int MODEL_LOD_RATIO_COUNT = sizeof(MODEL_LOD_RATIOS) / sizeof(float);
+const float MODEL_LOD_PIXEL_ERROR = 1.0f;
+const int CULLING_BENCHMARK_VIEW_COUNT = 64;
+const int64_t ASSET_UPLOAD_BUDGET = 2000;
 
 struct InputState
 {
@@ -90,6 +107,24 @@ struct UniformBufferPerInstance
 	glm::vec4 material_specular_color;
 };
 
+/*
+	The model data prepared by a worker thread, ready to be uploaded on the render thread.
+*/
+struct ModelAsset
+{
+	std::vector<MTL> materials;
+	std::vector<MeshLOD> lods;
+	std::vector<std::vector<MaterialBatch>> lod_batches;
+	BoundingSphere bounding_sphere;
+	std::vector<Meshlet> meshlets;
+	std::vector<unsigned int> meshlet_vertices;
+	std::vector<unsigned char> meshlet_triangles;
+	std::vector<PackedVertex> vertices;
+	std::vector<unsigned int> indices;
+	glm::mat4 dequantization;
+	MeshOptimizationStatistics mesh_statistics;
+};
+
 class OBJViewer
 {
 public:
@@ -107,14 +142,24 @@ private:
 	UniformBufferPerInstance uniform_data_model;
 	float model_angle;
 	GLuint model_vertex_count;
-	GLuint model_vbo_positions;
-	GLuint model_vbo_normals;
-	GLuint model_vbo_texcoords;
+	GLuint model_vbo;
+	GLuint model_ibo;
+	glm::mat4 model_dequantization;
 	GLuint model_vao;
-	GLuint model_texture;
-	GLuint mesh_vs;
-	GLuint mesh_fs;
-	GLuint mesh_program;
+	std::vector<MTL> model_materials;
+	std::vector<MeshLOD> model_lods;
+	std::vector<std::vector<MaterialBatch>> model_lod_batches;
+	int model_lod;
+	BoundingSphere model_bounding_sphere;
+	std::vector<Meshlet> model_meshlets;
+	std::vector<unsigned int> model_meshlet_vertices;
+	std::vector<unsigned char> model_meshlet_triangles;
+	std::vector<GLuint> model_textures;
+	bool model_ready;
+	// Diffuse textures still loading on the workers.
+	unsigned int model_texture_loads;
+	ResourceCache resources;
+	ResourceHandle mesh_program;
 	GLuint uniform_buffer_constant;
 	GLuint uniform_buffer_frame;
 	GLuint uniform_buffer_model;
@@ -122,12 +167,18 @@ private:
 	unsigned int viewport_width;
 	unsigned int viewport_height;
 	bool running;
+	JobQueue jobs;
+	Uint32 setup_clock;
 
 	void SetupContext();
 	void SetupResources();
+	void UploadModel(ModelAsset& asset);
+	void ReportFileReads();
 	void Run();
 	void HandleEvents();
 	void UpdateCamera(float dt);
 	void UpdateScene(float dt);
+	void ReloadShaders();
 	void RenderScene();
+	void RunCullingBenchmark();
 };
\ No newline at end of file
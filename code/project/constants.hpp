@@ -3,6 +3,7 @@
 #include <string>
 #include <glm/glm.hpp>
 #include <gli/gli.hpp>
+#include <common/resourcecache.h>
 
 struct AmbientLight
 {
@@ -57,10 +58,28 @@ struct UniformBufferPerInstance
 	glm::mat4 model_matrix;
 	glm::mat4 normal_matrix;
 	glm::vec4 material_specular_color;
+	// The layer of the texture array the instance samples.
+	float texture_layer;
+	float padding[3];
+};
+
+// The number of levels of detail the terrain quadtree can have, enough for heightmaps of 16 * 2^15 samples a side.
+const int TERRAIN_LOD_LEVEL_MAX = 16;
+
+// The samples of a terrain height tile a side: one per vertex of a patch, and one more on each side for the normals.
+const int TERRAIN_HEIGHT_TILE_SIZE = 11;
+
+struct UniformBufferTerrainLOD
+{
+	// The distances over which each level morphs into the next: start in x and end in y.
+	glm::vec4 morph_ranges[TERRAIN_LOD_LEVEL_MAX];
+	// The heightmap resolution in x and y, and its reciprocal in z and w.
+	glm::vec4 heightmap_size;
 };
 
 const std::string WINDOW_TITLE = "Project";
 const std::string DIRECTORY_ASSETS_ROOT = "../../../assets/";
+const std::string DIRECTORY_PROGRAM_BINARIES = "./";
 const std::string DIRECTORY_SHADERS = "../../../code/project/shaders/";
 const std::string DIRECTORY_MODELS = DIRECTORY_ASSETS_ROOT + "models/";
 const std::string DIRECTORY_TEXTURES = DIRECTORY_ASSETS_ROOT + "textures/";
@@ -70,6 +89,17 @@ const std::string FILE_PARTICLE_FS = "particle.frag";
 const std::string FILE_PARTICLE_SHAFT_TEXTURE = "shaft.dds";
 const std::string FILE_PARTICLE_SMOKE_TEXTURE = "smoke.dds";
 const std::string FILE_PARTICLE_ORBIT_TEXTURE = "orbit.dds";
+// The particle sprites share one array texture, with a layer per emitter type.
+const std::string PARTICLE_TEXTURE_FILES[] =
+{
+	DIRECTORY_TEXTURES + FILE_PARTICLE_SHAFT_TEXTURE,
+	DIRECTORY_TEXTURES + FILE_PARTICLE_SMOKE_TEXTURE,
+	DIRECTORY_TEXTURES + FILE_PARTICLE_ORBIT_TEXTURE
+};
+const size_t PARTICLE_TEXTURE_COUNT = sizeof(PARTICLE_TEXTURE_FILES) / sizeof(std::string);
+const int PARTICLE_TEXTURE_LAYER_SHAFT = 0;
+const int PARTICLE_TEXTURE_LAYER_SMOKE = 1;
+const int PARTICLE_TEXTURE_LAYER_ORBIT = 2;
 const std::string FILE_HEIGHTMAP_TEXTURE = "heightmap.dds";
 const std::string FILE_TERRAIN_VS = "terrain.vert";
 const std::string FILE_TERRAIN_FS = "terrain.frag";
@@ -77,15 +107,47 @@ const std::string FILE_TERRAIN_TEXTURE_1 = "stk_generic_grassb.dds";
 const std::string FILE_TERRAIN_TEXTURE_2 = "stktex_generic_earth_a.dds";
 const std::string FILE_TERRAIN_TEXTURE_3 = "dirt_5.dds";
 const std::string FILE_TERRAIN_MASK = "terrain_mask.dds";
+// The terrain layers are blended by the channels of the mask, in order.
+const std::string TERRAIN_TEXTURE_FILES[] =
+{
+	DIRECTORY_TEXTURES + FILE_TERRAIN_TEXTURE_1,
+	DIRECTORY_TEXTURES + FILE_TERRAIN_TEXTURE_2,
+	DIRECTORY_TEXTURES + FILE_TERRAIN_TEXTURE_3
+};
+const size_t TERRAIN_TEXTURE_COUNT = sizeof(TERRAIN_TEXTURE_FILES) / sizeof(std::string);
+
+const ShaderFile PARTICLE_SHADERS[] =
+{
+	{ GL_VERTEX_SHADER, DIRECTORY_SHADERS + FILE_PARTICLE_VS },
+	{ GL_GEOMETRY_SHADER, DIRECTORY_SHADERS + FILE_PARTICLE_GS },
+	{ GL_FRAGMENT_SHADER, DIRECTORY_SHADERS + FILE_PARTICLE_FS }
+};
+const size_t PARTICLE_SHADER_COUNT = sizeof(PARTICLE_SHADERS) / sizeof(ShaderFile);
+const ShaderFile TERRAIN_SHADERS[] =
+{
+	{ GL_VERTEX_SHADER, DIRECTORY_SHADERS + FILE_TERRAIN_VS },
+	{ GL_FRAGMENT_SHADER, DIRECTORY_SHADERS + FILE_TERRAIN_FS }
+};
+const size_t TERRAIN_SHADER_COUNT = sizeof(TERRAIN_SHADERS) / sizeof(ShaderFile);
+// The light counts, level of detail limit and height tile size of the terrain shaders, which must match the uniform buffers and textures.
+const ShaderDefine TERRAIN_DEFINES[] =
+{
+	{ "POINT_LIGHT_COUNT", std::to_string(POINT_LIGHT_COUNT) },
+	{ "DIRECTIONAL_LIGHT_COUNT", std::to_string(DIRECTIONAL_LIGHT_COUNT) },
+	{ "SPOT_LIGHT_COUNT", std::to_string(SPOT_LIGHT_COUNT) },
+	{ "LOD_LEVEL_MAX", std::to_string(TERRAIN_LOD_LEVEL_MAX) },
+	{ "HEIGHT_TILE_SIZE", std::to_string(TERRAIN_HEIGHT_TILE_SIZE) }
+};
+const size_t TERRAIN_DEFINE_COUNT = sizeof(TERRAIN_DEFINES) / sizeof(ShaderDefine);
 
 const int UNIFORM_BINDING_CONSTANT = 0;
 const int UNIFORM_BINDING_FRAME = 1;
 const int UNIFORM_BINDING_INSTANCE = 2;
+const int UNIFORM_BINDING_TERRAIN_LOD = 3;
 const int TEXTURE_UNIT_DIFFUSE = 0;
 const int TEXTURE_UNIT_TERRAIN_MASK = 0;
-const int TEXTURE_UNIT_TERRAIN_1 = 1;
-const int TEXTURE_UNIT_TERRAIN_2 = 2;
-const int TEXTURE_UNIT_TERRAIN_3 = 3;
+const int TEXTURE_UNIT_TERRAIN_LAYERS = 1;
+const int TEXTURE_UNIT_TERRAIN_HEIGHT = 2;
 
 const int VIEWPORT_WIDTH_INITIAL = 800;
 const int VIEWPORT_HEIGHT_INITIAL = 600;
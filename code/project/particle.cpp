@@ -1,5 +1,4 @@
 #include "particle.hpp"
-#include <common/shader.h>
 #include <glm/gtx/transform.hpp>
 #include <iostream>
 
@@ -11,23 +10,15 @@ float RandomFloat()
 
 ParticleEmitter::~ParticleEmitter()
 {
-	glDetachShader(particle_program, particle_vs);
-	glDetachShader(particle_program, particle_gs);
-	glDetachShader(particle_program, particle_fs);
-	glDeleteProgram(particle_program);
-	glDeleteShader(particle_vs);
-	glDeleteShader(particle_gs);
-	glDeleteShader(particle_fs);
 	glDeleteBuffers(1, &position_vbo);
 	glDeleteVertexArrays(1, &vao);
-	glDeleteTextures(1, &texture);
 	glDeleteSamplers(1, &sampler);
 	glDeleteBuffers(1, &uniform_buffer);
 }
 
-void ParticleEmitter::Render()
+void ParticleEmitter::BeginRender()
 {
-	glUseProgram(particle_program);
+	glUseProgram(particle_program->name);
 
 	glEnable(GL_BLEND);
 	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
@@ -35,53 +26,45 @@ void ParticleEmitter::Render()
 
 	glActiveTexture(GL_TEXTURE0 + TEXTURE_UNIT_DIFFUSE);
 	glBindSampler(TEXTURE_UNIT_DIFFUSE, sampler);
-	glBindTexture(GL_TEXTURE_2D, texture);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, texture->name);
+}
 
+void ParticleEmitter::Render()
+{
+	// The layer of the emitter is in its instance buffer, so only the buffers change between emitters.
 	glBindBufferBase(GL_UNIFORM_BUFFER, UNIFORM_BINDING_INSTANCE, uniform_buffer);
 	glBindVertexArray(vao);
 	glDrawArrays(GL_POINTS, 0, particle_count);
+}
 
+void ParticleEmitter::EndRender()
+{
 	glDepthMask(GL_TRUE);
 }
 
-ParticleEmitter::ParticleEmitter(const glm::vec3& origin, int particle_count, const std::string& texture_file)
+ParticleEmitter::ParticleEmitter(const glm::vec3& origin, int particle_count, int texture_layer, ResourceCache& resources)
 	: origin(origin)
 	, position_vbo(0)
 	, vao(0)
-	, particle_vs(0)
-	, particle_gs(0)
-	, particle_fs(0)
-	, particle_program(0)
-	, texture(0)
 	, sampler(0)
 	, uniform_buffer(0)
 	, particle_count(particle_count)
 {
-	// Load the program.
-	particle_vs = CompileShaderFromFile((DIRECTORY_SHADERS + FILE_PARTICLE_VS).c_str(), GL_VERTEX_SHADER);
-	particle_gs = CompileShaderFromFile((DIRECTORY_SHADERS + FILE_PARTICLE_GS).c_str(), GL_GEOMETRY_SHADER);
-	particle_fs = CompileShaderFromFile((DIRECTORY_SHADERS + FILE_PARTICLE_FS).c_str(), GL_FRAGMENT_SHADER);
-	particle_program = glCreateProgram();
-	glAttachShader(particle_program, particle_vs);
-	glAttachShader(particle_program, particle_gs);
-	glAttachShader(particle_program, particle_fs);
-	LinkProgram(particle_program);
+	// Load the program, shared by all emitters.
+	particle_program = resources.LoadProgram(PARTICLE_SHADERS, PARTICLE_SHADER_COUNT);
 
 	// Generate a texture sampler.
 	glGenSamplers(1, &sampler);
-	glSamplerParameteri(sampler, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-	glSamplerParameteri(sampler, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	SetSamplerFiltering(sampler, TEXTURE_ANISOTROPY_DEFAULT);
 	glSamplerParameteri(sampler, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
 	glSamplerParameteri(sampler, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
 
-	// Load the particle texture.
-	gli::storage texture_image = gli::load_dds((DIRECTORY_TEXTURES + texture_file).c_str());
-	glGenTextures(1, &texture);
-	glBindTexture(GL_TEXTURE_2D, texture);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, texture_image.dimensions(0).x, texture_image.dimensions(0).y, 0, GL_BGRA, GL_UNSIGNED_BYTE, texture_image.data());
+	// Load the particle texture array, shared by all emitters.
+	texture = resources.LoadTextureArray(PARTICLE_TEXTURE_FILES, PARTICLE_TEXTURE_COUNT, GL_RGBA8, GL_BGRA);
 
 	// Setup the initial uniform buffer.
 	uniform_data.model_matrix = glm::translate(origin);
+	uniform_data.texture_layer = static_cast<float>(texture_layer);
 
 	glGenBuffers(1, &uniform_buffer);
 	glBindBufferBase(GL_UNIFORM_BUFFER, UNIFORM_BINDING_INSTANCE, uniform_buffer);
@@ -111,8 +94,8 @@ void ParticleEmitter::UpdateBuffers(glm::vec3* positions)
 
 
 
-ShaftEmitter::ShaftEmitter(const glm::vec3& origin)
-	: ParticleEmitter(origin, PARTICLE_COUNT, FILE_PARTICLE_SHAFT_TEXTURE)
+ShaftEmitter::ShaftEmitter(const glm::vec3& origin, ResourceCache& resources)
+	: ParticleEmitter(origin, PARTICLE_COUNT, PARTICLE_TEXTURE_LAYER_SHAFT, resources)
 {
 	// Set initial values for the particles.
 	for (int i = 0; i < PARTICLE_COUNT; ++i)
@@ -155,8 +138,8 @@ void ShaftEmitter::GenerateNewParticle(int index)
 
 
 
-SmokeEmitter::SmokeEmitter(const glm::vec3& origin)
-	: ParticleEmitter(origin, PARTICLE_COUNT, FILE_PARTICLE_SMOKE_TEXTURE)
+SmokeEmitter::SmokeEmitter(const glm::vec3& origin, ResourceCache& resources)
+	: ParticleEmitter(origin, PARTICLE_COUNT, PARTICLE_TEXTURE_LAYER_SMOKE, resources)
 {
 	// Set initial values for the particles.
 	for (int i = 0; i < PARTICLE_COUNT; ++i)
@@ -196,8 +179,8 @@ void SmokeEmitter::GenerateNewParticle(int index)
 }
 
 
-OrbitEmitter::OrbitEmitter(const glm::vec3& origin)
-	: ParticleEmitter(origin, PARTICLE_COUNT, FILE_PARTICLE_ORBIT_TEXTURE)
+OrbitEmitter::OrbitEmitter(const glm::vec3& origin, ResourceCache& resources)
+	: ParticleEmitter(origin, PARTICLE_COUNT, PARTICLE_TEXTURE_LAYER_ORBIT, resources)
 {
 	// Set initial values for the particles.
 	for (int i = 0; i < PARTICLE_COUNT; ++i)
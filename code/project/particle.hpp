@@ -4,6 +4,8 @@
 #include <glm/glm.hpp>
 #define NOMINMAX
 #include <GL/gl3w.h>
+#include <common/resourcecache.h>
+#include <common/texture.h>
 #include "constants.hpp"
 
 /*
@@ -19,9 +21,16 @@ class ParticleEmitter
 public:
 	virtual ~ParticleEmitter();
 	virtual void Update(float dt) = 0;
+
+	/*
+		Bind the program, texture array and blend state shared by all emitters. Call it once before rendering a batch
+		of emitters with Render, and EndRender after them.
+	*/
+	void BeginRender();
 	void Render();
+	static void EndRender();
 protected:
-	ParticleEmitter(const glm::vec3& origin, int particle_count, const std::string& texture_file);
+	ParticleEmitter(const glm::vec3& origin, int particle_count, int texture_layer, ResourceCache& resources);
 
 	void GenerateBuffers(glm::vec3* positions);
 	void UpdateBuffers(glm::vec3* positions);
@@ -30,11 +39,8 @@ private:
 	UniformBufferPerInstance uniform_data;
 	GLuint position_vbo;
 	GLuint vao;
-	GLuint particle_vs;
-	GLuint particle_gs;
-	GLuint particle_fs;
-	GLuint particle_program;
-	GLuint texture;
+	ResourceHandle particle_program;
+	ResourceHandle texture;
 	GLuint sampler;
 	GLuint uniform_buffer;
 	GLuint particle_count;
@@ -46,7 +52,7 @@ private:
 class ShaftEmitter : public ParticleEmitter
 {
 public:
-	ShaftEmitter(const glm::vec3& origin);
+	ShaftEmitter(const glm::vec3& origin, ResourceCache& resources);
 
 	void Update(float dt);
 private:
@@ -67,7 +73,7 @@ private:
 class SmokeEmitter : public ParticleEmitter
 {
 public:
-	SmokeEmitter(const glm::vec3& origin);
+	SmokeEmitter(const glm::vec3& origin, ResourceCache& resources);
 
 	void Update(float dt);
 private:
@@ -87,7 +93,7 @@ private:
 class OrbitEmitter : public ParticleEmitter
 {
 public:
-	OrbitEmitter(const glm::vec3& origin);
+	OrbitEmitter(const glm::vec3& origin, ResourceCache& resources);
 
 	void Update(float dt);
 private:
@@ -49,6 +49,7 @@ Project::Project()
 	, viewport_height(VIEWPORT_HEIGHT_INITIAL)
 	, running(true)
 	, fps_camera(true)
+	, resources(DIRECTORY_PROGRAM_BINARIES)
 {
 
 }
@@ -137,6 +138,9 @@ void Project::SetupContext()
 
 void Project::SetupResources()
 {
+	// Record the files read while setting up, for the report once everything is loaded.
+	SetFileReadRecording(true);
+
 	// Setup the camera starting attributes.
 	camera_frustum = Frustum(PERSPECTIVE_NEAR, PERSPECTIVE_FAR, PERSPECTIVE_FOV, (float)viewport_width, (float)viewport_height);
 	camera.SetProjection(camera_frustum.GetPerspectiveProjection());
@@ -173,11 +177,38 @@ void Project::SetupResources()
 	glBindBufferBase(GL_UNIFORM_BUFFER, UNIFORM_BINDING_CONSTANT, uniform_buffer_constant);
 	glBufferData(GL_UNIFORM_BUFFER, sizeof(UniformBufferConstant), &uniform_data_constant, GL_STATIC_DRAW);
 	
+	// Compile all programs in one batch, so the driver can compile them in parallel. The scene objects get them from
+	// the cache while the handles are held here.
+	const ProgramFiles programs[] =
+	{
+		{ PARTICLE_SHADERS, PARTICLE_SHADER_COUNT, nullptr, 0 },
+		{ TERRAIN_SHADERS, TERRAIN_SHADER_COUNT, TERRAIN_DEFINES, TERRAIN_DEFINE_COUNT }
+	};
+	ResourceHandle program_handles[2];
+	ShaderBatchStatistics shader_statistics;
+	resources.LoadPrograms(programs, 2, program_handles, &shader_statistics);
+	std::cout << "Compiled " << shader_statistics.shader_count << " shaders" << (shader_statistics.parallel ? " in parallel" : "")
+		<< " in " << shader_statistics.total_time / 1000.0f << " ms (" << shader_statistics.submit_time / 1000.0f << " ms submitting)" << std::endl;
+
 	// Setup the scene objects.
-	terrain = std::make_unique<Terrain>();
-	emitters[0] = std::make_unique<ShaftEmitter>(glm::vec3(64.0f, 2.0f + terrain->GetHeight(64.0f, 80.0f), 80.0f));
-	emitters[1] = std::make_unique<SmokeEmitter>(glm::vec3(80.0f, 2.0f + terrain->GetHeight(80.0f, 64.0f), 64.0f));
-	emitters[2] = std::make_unique<OrbitEmitter>(glm::vec3(80.0f, 2.0f + terrain->GetHeight(80.0f, 80.0f), 80.0f));
+	terrain = std::make_unique<Terrain>(resources);
+
+	// Place the emitters on the terrain with a single query.
+	const float EMITTER_X[] = { 64.0f, 80.0f, 80.0f };
+	const float EMITTER_Z[] = { 80.0f, 64.0f, 80.0f };
+	float emitter_heights[3];
+	terrain->GetHeights(EMITTER_X, EMITTER_Z, 3, emitter_heights);
+	emitters[0] = std::make_unique<ShaftEmitter>(glm::vec3(EMITTER_X[0], 2.0f + emitter_heights[0], EMITTER_Z[0]), resources);
+	emitters[1] = std::make_unique<SmokeEmitter>(glm::vec3(EMITTER_X[1], 2.0f + emitter_heights[1], EMITTER_Z[1]), resources);
+	emitters[2] = std::make_unique<OrbitEmitter>(glm::vec3(EMITTER_X[2], 2.0f + emitter_heights[2], EMITTER_Z[2]), resources);
+
+	const ResourceCacheStatistics& statistics = resources.GetStatistics();
+	std::cout << "Resources: " << statistics.loads << " loaded, " << statistics.path_hits + statistics.content_hits << " shared, "
+		<< statistics.binary_loads << " programs loaded from binaries" << std::endl;
+
+	// Report the time spent reading each file.
+	PrintFileReads();
+	SetFileReadRecording(false);
 }
 
 void Project::Run()
@@ -200,6 +231,7 @@ void Project::Run()
 		}
 		
 		UpdateScene(dt);
+		ReloadShaders();
 		RenderScene();
 	}
 }
@@ -368,6 +400,18 @@ void Project::UpdateScene(float dt)
 		emitters[i]->Update(dt);
 }
 
+void Project::ReloadShaders()
+{
+	// Rebuild the programs whose shader files were edited. Programs that fail to build keep their previous version.
+	std::vector<std::string> errors;
+	unsigned int reloaded = resources.ReloadChangedPrograms(errors);
+	for (size_t i = 0; i < errors.size(); ++i)
+		std::cerr << errors[i] << std::endl;
+
+	if (reloaded > 0)
+		std::cout << "Reloaded " << reloaded << " shader programs" << std::endl;
+}
+
 void Project::RenderScene()
 {
 	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
@@ -379,10 +423,15 @@ void Project::RenderScene()
 	glBindBufferBase(GL_UNIFORM_BUFFER, UNIFORM_BINDING_FRAME, uniform_buffer_frame);
 	glBufferData(GL_UNIFORM_BUFFER, sizeof(UniformBufferPerFrame), &uniform_data_frame, GL_DYNAMIC_DRAW);
 
-	// Render the scene objects.
-	terrain->Render();
+	// Render the scene objects. The terrain walks its quadtree and draws the patches in the view frustum, at a level
+	// of detail chosen by their distance to the camera.
+	glm::vec4 frustum_planes[6];
+	camera.GetFrustumPlanes(frustum_planes);
+	terrain->Render(frustum_planes, camera.GetPosition());
+	emitters[0]->BeginRender();
 	for (int i = 0; i < 3; ++i)
 		emitters[i]->Render();
+	ParticleEmitter::EndRender();
 
 	// Swap the back and front buffers.
 	SDL_GL_SwapWindow(window);
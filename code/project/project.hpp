@@ -25,6 +25,8 @@
 #include <common/model.h>
 #include <common/shader.h>
 #include <common/camera.h>
+#include <common/fileio.h>
+#include <common/resourcecache.h>
 #include <SDL2/SDL.h>
 #include <GL/gl3w.h>
 #include <glm/glm.hpp>
@@ -65,6 +67,7 @@ private:
 	UniformBufferPerFrame uniform_data_frame;
 	GLuint uniform_buffer_constant;
 	GLuint uniform_buffer_frame;
+	ResourceCache resources;
 	std::unique_ptr<ParticleEmitter> emitters[3];
 	std::unique_ptr<Terrain> terrain;
 
@@ -75,5 +78,6 @@ private:
 	void UpdateCamera(float dt);
 	void UpdateCameraFPS(float dt);
 	void UpdateScene(float dt);
+	void ReloadShaders();
 	void RenderScene();
 };
\ No newline at end of file
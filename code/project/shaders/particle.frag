@@ -4,9 +4,17 @@ in vec2 gs_texcoord;
 
 out vec4 out_color;
 
-layout(binding = 0) uniform sampler2D sampler_diffuse;
+layout(binding = 2, std140) uniform PerInstance
+{
+	mat4 model_matrix;
+	mat4 normal_matrix;
+    vec4 material_specular_color;
+	float texture_layer;
+};
+
+layout(binding = 0) uniform sampler2DArray sampler_diffuse;
 
 void main()
 {
-	out_color = texture(sampler_diffuse, gs_texcoord);
+	out_color = texture(sampler_diffuse, vec3(gs_texcoord, texture_layer));
 }
\ No newline at end of file
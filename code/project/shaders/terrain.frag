@@ -1,8 +1,6 @@
 #version 440
 
-#define POINT_LIGHT_COUNT 2
-#define DIRECTIONAL_LIGHT_COUNT 2
-#define SPOT_LIGHT_COUNT 2
+// POINT_LIGHT_COUNT, DIRECTIONAL_LIGHT_COUNT and SPOT_LIGHT_COUNT are defined by the application.
 
 struct AmbientLight
 {
@@ -60,9 +58,8 @@ layout(binding = 2, std140) uniform PerInstance
 };
 
 layout(binding = 0) uniform sampler2D sampler_mask;
-layout(binding = 1) uniform sampler2D sampler_terrain_1;
-layout(binding = 2) uniform sampler2D sampler_terrain_2;
-layout(binding = 3) uniform sampler2D sampler_terrain_3;
+// One layer per channel of the mask.
+layout(binding = 1) uniform sampler2DArray sampler_terrain_layers;
 
 void AddDirectionalLightContribution(DirectionalLight light, vec3 surface_color, vec3 surface_to_camera, inout vec3 diffuse, inout vec3 specular);
 void AddPointLightContribution(PointLight light, vec3 surface_color, vec3 surface_to_camera, inout vec3 diffuse, inout vec3 specular);
@@ -74,11 +71,11 @@ void main()
     vec3 diffuse = vec3(0);
     vec3 specular = vec3(0);
 	//vec3 surface_color = vec3(1.0f, 1.0f, 1.0f);
-	//vec3 surface_color = texture(sampler_terrain_1, vs_texcoord).rgb;
+	//vec3 surface_color = texture(sampler_terrain_layers, vec3(vs_texcoord, 0)).rgb;
 	vec3 mask_value = texture(sampler_mask, vs_texcoord).rgb;
-	vec3 surface_color = texture(sampler_terrain_1, vs_texcoord).rgb * mask_value.r +
-						 texture(sampler_terrain_2, vs_texcoord).rgb * mask_value.g +
-						 texture(sampler_terrain_3, vs_texcoord).rgb * mask_value.b;
+	vec3 surface_color = texture(sampler_terrain_layers, vec3(vs_texcoord, 0)).rgb * mask_value.r +
+						 texture(sampler_terrain_layers, vec3(vs_texcoord, 1)).rgb * mask_value.g +
+						 texture(sampler_terrain_layers, vec3(vs_texcoord, 2)).rgb * mask_value.b;
     vec3 surface_to_camera = camera_position_W.xyz - vs_position_W;
     float surface_to_camera_distance = length(surface_to_camera);
 
@@ -1,8 +1,12 @@
 #version 440
 
-layout(location = 0) in vec3 in_position_M;
-layout(location = 1) in vec3 in_normal_M;
-layout(location = 2) in vec2 in_texcoord;
+// LOD_LEVEL_MAX and HEIGHT_TILE_SIZE are defined by the application.
+
+// The vertex on the patch grid, and the patch: its first sample in xy, samples between vertices in z and level in w,
+// and the layer of its height tile.
+layout(location = 0) in vec2 in_grid_position;
+layout(location = 1) in vec4 in_patch;
+layout(location = 2) in float in_height_tile;
 
 out vec3 vs_position_W;
 out vec3 vs_normal_W;
@@ -22,10 +26,41 @@ layout(binding = 2, std140) uniform PerInstance
     vec4 material_specular_color;
 };
 
+layout(binding = 3, std140) uniform TerrainLOD
+{
+	vec4 morph_ranges[LOD_LEVEL_MAX];
+	vec4 heightmap_size;
+};
+
+layout(binding = 2) uniform sampler2DArray sampler_height;
+
+// The height tile has a sample per vertex of the patch, after a sample around the patch.
+float SampleHeight(vec2 grid_position)
+{
+	return textureLod(sampler_height, vec3((grid_position + 1.5f) / HEIGHT_TILE_SIZE, in_height_tile), 0.0f).r;
+}
+
 void main()
 {
-	gl_Position = projection_matrix * view_matrix * model_matrix * vec4(in_position_M, 1.0f);
-	vs_position_W = (model_matrix * vec4(in_position_M, 1.0f)).xyz;
-	vs_normal_W = normalize(mat3(normal_matrix) * in_normal_M);
-	vs_texcoord = in_texcoord;
+	vec2 sample_position = min(in_patch.xy + in_grid_position * in_patch.z, heightmap_size.xy - 1.0f);
+	vec3 position_W = (model_matrix * vec4(sample_position.x, SampleHeight(in_grid_position), sample_position.y, 1.0f)).xyz;
+
+	// Move the odd vertices onto the grid of the next level, halfway between their even neighbours, over the end of
+	// the range of this level.
+	vec2 morph_range = morph_ranges[int(in_patch.w)].xy;
+	float morph = clamp((distance(camera_position_W.xyz, position_W) - morph_range.x) / (morph_range.y - morph_range.x), 0.0f, 1.0f);
+	vec2 odd = fract(in_grid_position * 0.5f) * 2.0f;
+	vec2 grid_position = in_grid_position - odd * morph;
+	sample_position = min(in_patch.xy + grid_position * in_patch.z, heightmap_size.xy - 1.0f);
+
+	// The same central differences as the heightmap normals, over the vertices of the patch.
+	float sx = SampleHeight(grid_position + vec2(1.0f, 0.0f)) - SampleHeight(grid_position - vec2(1.0f, 0.0f));
+	float sy = SampleHeight(grid_position + vec2(0.0f, 1.0f)) - SampleHeight(grid_position - vec2(0.0f, 1.0f));
+	vec3 position_M = vec3(sample_position.x, SampleHeight(grid_position), sample_position.y);
+	vec3 normal_M = normalize(vec3(-sx, 2.0f * in_patch.z, sy));
+
+	gl_Position = projection_matrix * view_matrix * model_matrix * vec4(position_M, 1.0f);
+	vs_position_W = (model_matrix * vec4(position_M, 1.0f)).xyz;
+	vs_normal_W = normalize(mat3(normal_matrix) * normal_M);
+	vs_texcoord = sample_position * heightmap_size.zw;
 }
\ No newline at end of file
@@ -1,248 +1,765 @@
 #include "terrain.hpp"
-#include <common/shader.h>
+#include <common/vertexformat.h>
+#include <glm/gtx/transform.hpp>
+#include <emmintrin.h>
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstring>
 #include <iostream>
+#include <iterator>
+#include <thread>
+#include <utility>
 #include <vector>
 
 const float Heightmap::LOWEST_HEIGHT = 0.0f;
 const float Heightmap::HIGHEST_HEIGHT = 20.0f;
 const float Heightmap::HEIGHT_STEP = (Heightmap::HIGHEST_HEIGHT - Heightmap::LOWEST_HEIGHT) / 255.0f;
+const float Heightmap::HEIGHT_UNORM_SCALE = (Heightmap::HIGHEST_HEIGHT - Heightmap::LOWEST_HEIGHT) / 65535.0f;
+
+/*
+	Transpose four x, y and z vectors into four consecutive positions (twelve floats).
+*/
+static inline void StoreVectors4(float* data, __m128 x, __m128 y, __m128 z)
+{
+	// xy0 = (x0 y0 x1 y1), xy1 = (x2 y2 x3 y3)
+	__m128 xy0 = _mm_unpacklo_ps(x, y);
+	__m128 xy1 = _mm_unpackhi_ps(x, y);
+
+	// a = (x0 y0 z0 x1), b = (y1 z1 x2 y2), c = (z2 x3 y3 z3)
+	_mm_storeu_ps(data, _mm_shuffle_ps(xy0, _mm_shuffle_ps(z, xy0, _MM_SHUFFLE(2, 2, 0, 0)), _MM_SHUFFLE(2, 0, 1, 0)));
+	_mm_storeu_ps(data + 4, _mm_shuffle_ps(_mm_shuffle_ps(xy0, z, _MM_SHUFFLE(1, 1, 3, 3)), xy1, _MM_SHUFFLE(1, 0, 2, 0)));
+	_mm_storeu_ps(data + 8, _mm_shuffle_ps(_mm_shuffle_ps(z, xy1, _MM_SHUFFLE(2, 2, 2, 2)), _mm_shuffle_ps(xy1, z, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(2, 0, 2, 0)));
+}
+
+/*
+	Compute and encode the normals of rows first_row to last_row, see Heightmap::ComputeNormals. The samples are
+	done 8 at a time, as two vectors of 4, and the rest of the row one at a time, both rounding to nearest even.
+*/
+static void ComputeNormalRows(const float* heights, int heights_pitch, int width, int first_row, int last_row, int8_t* normals, int normals_pitch)
+{
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 two = _mm_set1_ps(2.0f);
+	const __m128 snorm_max = _mm_set1_ps(127.0f);
+	const __m128 sign = _mm_set1_ps(-0.0f);
+	for (int y = first_row; y < last_row; ++y)
+	{
+		const float* row = heights + y * heights_pitch;
+		const float* previous_row = row - heights_pitch;
+		const float* next_row = row + heights_pitch;
+		int8_t* normal_row = normals + y * normals_pitch * 2;
+
+		int x = 0;
+		for (; x + 8 <= width; x += 8)
+		{
+			// The normal is (-sx, 2, sy), and projecting it onto the octahedron divides it by |sx| + 2 + |sy|, so it
+			// does not need normalizing first.
+			__m128i encoded[2];
+			for (int half = 0; half < 2; ++half)
+			{
+				int i = x + half * 4;
+				__m128 nx = _mm_sub_ps(zero, _mm_sub_ps(_mm_loadu_ps(row + i + 1), _mm_loadu_ps(row + i - 1)));
+				__m128 nz = _mm_sub_ps(_mm_loadu_ps(next_row + i), _mm_loadu_ps(previous_row + i));
+				__m128 l1 = _mm_add_ps(_mm_add_ps(_mm_andnot_ps(sign, nx), two), _mm_andnot_ps(sign, nz));
+				__m128 scale = _mm_div_ps(snorm_max, l1);
+				__m128i ex = _mm_cvtps_epi32(_mm_mul_ps(nx, scale));
+				__m128i ez = _mm_cvtps_epi32(_mm_mul_ps(nz, scale));
+				encoded[half] = _mm_packs_epi32(_mm_unpacklo_epi32(ex, ez), _mm_unpackhi_epi32(ex, ez));
+			}
+
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(normal_row + x * 2), _mm_packs_epi16(encoded[0], encoded[1]));
+		}
+
+		for (; x < width; ++x)
+		{
+			float sx = row[x + 1] - row[x - 1];
+			float sy = next_row[x] - previous_row[x];
+			float scale = 127.0f / (std::abs(sx) + 2.0f + std::abs(sy));
+			normal_row[x * 2 + 0] = static_cast<int8_t>(std::lrint(-sx * scale));
+			normal_row[x * 2 + 1] = static_cast<int8_t>(std::lrint(sy * scale));
+		}
+	}
+}
 
 Heightmap::Heightmap()
 {
+	std::string filepath = DIRECTORY_TEXTURES + FILE_HEIGHTMAP_TEXTURE;
+	if (!file.Open(filepath) || !ReadDDSLayout(file.GetData(), file.GetSize(), layout))
+		throw std::runtime_error("Failed to load heightmap texture: " + filepath);
 	
-	gli::storage heightmap_image = gli::load_dds((DIRECTORY_TEXTURES + FILE_HEIGHTMAP_TEXTURE).c_str());
-	
-	if (heightmap_image.dimensions(0).x != HEIGHTMAP_RESOLUTION_X || heightmap_image.dimensions(0).y != HEIGHTMAP_RESOLUTION_Y)
+	resolution_x = layout.width;
+	resolution_y = layout.height;
+	if (resolution_x < 2 || resolution_y < 2)
 		throw std::runtime_error("Heightmap texture of invalid dimensions.");
-	if (heightmap_image.format() != gli::format::FORMAT_A8_UNORM)
+
+	// A BC4 heightmap is decoded a tile of blocks at a time, and its heights read from the red channel.
+	if (layout.compressed ? layout.block_format != BLOCK_FORMAT_BC4 : layout.pixel_size != 1)
 		throw std::runtime_error("Heightmap texture of invalid format.");
-	
-	// Calculate the height values.
-	for (int y = 0; y < HEIGHTMAP_RESOLUTION_Y; ++y)
+
+	tile_count_x = (resolution_x + TILE_SIZE - 1) / TILE_SIZE;
+	tile_heights.resize((TILE_SIZE + 2) * (TILE_SIZE + 2));
+}
+
+int Heightmap::GetResolutionX() const
+{
+	return resolution_x;
+}
+
+int Heightmap::GetResolutionY() const
+{
+	return resolution_y;
+}
+
+float Heightmap::GetHeight(int x, int y) const
+{
+	return LOWEST_HEIGHT + HEIGHT_UNORM_SCALE * GetTile(x, y).heights[(y % TILE_SIZE) * TILE_SIZE + x % TILE_SIZE];
+}
+
+glm::vec3 Heightmap::GetNormal(int x, int y) const
+{
+	glm::vec3 decoded = DecodeOctahedral(GetEncodedNormal(x, y));
+	return glm::vec3(decoded.x, decoded.z, decoded.y);
+}
+
+glm::vec2 Heightmap::GetEncodedNormal(int x, int y) const
+{
+	const int8_t* normal = &GetTile(x, y).normals[((y % TILE_SIZE) * TILE_SIZE + x % TILE_SIZE) * 2];
+	return glm::vec2(normal[0], normal[1]) / 127.0f;
+}
+
+const Heightmap::Tile& Heightmap::GetTile(int x, int y) const
+{
+	int tile_x = x / TILE_SIZE;
+	int tile_y = y / TILE_SIZE;
+	int index = tile_y * tile_count_x + tile_x;
+
+	// Consecutive samples mostly fall in the tile used last.
+	if (!tiles.empty() && tiles.front().index == index)
+		return tiles.front();
+
+	auto found = tile_lookup.find(index);
+	if (found != tile_lookup.end())
 	{
-		for (int x = 0; x < HEIGHTMAP_RESOLUTION_X; ++x)
+		tiles.splice(tiles.begin(), tiles, found->second);
+		return tiles.front();
+	}
+
+	// Once the cache is full, the least recently used tile is loaded over.
+	if (tiles.size() < TILE_CACHE_SIZE)
+	{
+		tiles.emplace_front();
+	}
+	else
+	{
+		tile_lookup.erase(tiles.back().index);
+		tiles.splice(tiles.begin(), tiles, std::prev(tiles.end()));
+	}
+
+	Tile& tile = tiles.front();
+	tile.index = index;
+	LoadTile(tile_x, tile_y, tile);
+	tile_lookup[index] = tiles.begin();
+	return tile;
+}
+
+void Heightmap::ReadHeights(int x, int y, int width, int height, float* heights, int pitch) const
+{
+	const unsigned char* data = reinterpret_cast<const unsigned char*>(file.GetData()) + layout.offset;
+	if (!layout.compressed)
+	{
+		for (int row = 0; row < height; ++row)
 		{
-			int i = y * HEIGHTMAP_RESOLUTION_X + x;
-			heights[i] = LOWEST_HEIGHT + HEIGHT_STEP * heightmap_image.data()[i];
+			const unsigned char* pixels = data + size_t(y + row) * layout.pitch + x;
+			for (int column = 0; column < width; ++column)
+				heights[row * pitch + column] = LOWEST_HEIGHT + HEIGHT_STEP * pixels[column];
 		}
+
+		return;
+	}
+
+	// Gather the blocks covering the samples, so they can be decoded together.
+	int block_x = x / 4;
+	int block_y = y / 4;
+	int block_count_x = (x + width + 3) / 4 - block_x;
+	int block_count_y = (y + height + 3) / 4 - block_y;
+	size_t block_size = GetBlockSize(BLOCK_FORMAT_BC4);
+	size_t row_size = block_count_x * block_size;
+	tile_blocks.resize(block_count_y * row_size);
+	for (int row = 0; row < block_count_y; ++row)
+		std::memcpy(&tile_blocks[row * row_size], data + size_t(block_y + row) * layout.pitch + block_x * block_size, row_size);
+
+	int pixel_count_x = block_count_x * 4;
+	tile_pixels.resize(pixel_count_x * block_count_y * 4 * 4);
+	DecodeBlocks(BLOCK_FORMAT_BC4, &tile_blocks[0], pixel_count_x, block_count_y * 4, &tile_pixels[0]);
+
+	for (int row = 0; row < height; ++row)
+	{
+		const unsigned char* pixels = &tile_pixels[((y + row - block_y * 4) * pixel_count_x + x - block_x * 4) * 4];
+		for (int column = 0; column < width; ++column)
+			heights[row * pitch + column] = LOWEST_HEIGHT + HEIGHT_STEP * pixels[column * 4];
+	}
+}
+
+void Heightmap::LoadTile(int tile_x, int tile_y, Tile& tile) const
+{
+	// Read the samples of the tile and the ones around it that are in the heightmap.
+	const int PITCH = TILE_SIZE + 2;
+	int first_x = tile_x * TILE_SIZE;
+	int first_y = tile_y * TILE_SIZE;
+	int width = std::min(TILE_SIZE, resolution_x - first_x);
+	int height = std::min(TILE_SIZE, resolution_y - first_y);
+	int read_x = std::max(first_x - 1, 0);
+	int read_y = std::max(first_y - 1, 0);
+	int read_width = std::min(first_x + TILE_SIZE, resolution_x - 1) - read_x + 1;
+	int read_height = std::min(first_y + TILE_SIZE, resolution_y - 1) - read_y + 1;
+	float* origin = &tile_heights[PITCH + 1];
+	ReadHeights(read_x, read_y, read_width, read_height, origin + (read_y - first_y) * PITCH + read_x - first_x, PITCH);
+
+	// Extrapolate the samples past the edges of the heightmap.
+	for (int y = 0; y < height; ++y)
+	{
+		float* row = origin + y * PITCH;
+		if (first_x == 0)
+			row[-1] = 2.0f * row[0] - row[1];
+		if (first_x + width == resolution_x)
+			row[width] = 2.0f * row[width - 1] - row[width - 2];
+	}
+
+	for (int x = 0; x < width; ++x)
+	{
+		if (first_y == 0)
+			origin[x - PITCH] = 2.0f * origin[x] - origin[x + PITCH];
+		if (first_y + height == resolution_y)
+			origin[x + height * PITCH] = 2.0f * origin[x + (height - 1) * PITCH] - origin[x + (height - 2) * PITCH];
 	}
 
-	// Calculate the normals.
-	// Algorithm source: http://www.flipcode.com/archives/Calculating_Vertex_Normals_for_Height_Maps.shtml
-	for (int y = 0; y < HEIGHTMAP_RESOLUTION_Y; ++y)
+	tile.heights.resize(TILE_SIZE * TILE_SIZE);
+	tile.normals.resize(TILE_SIZE * TILE_SIZE * 2);
+	for (int y = 0; y < height; ++y)
 	{
-		for (int x = 0; x < HEIGHTMAP_RESOLUTION_X; ++x)
+		for (int x = 0; x < width; ++x)
 		{
-			int i = y * HEIGHTMAP_RESOLUTION_X + x;
+			float unorm = (origin[y * PITCH + x] - LOWEST_HEIGHT) / HEIGHT_UNORM_SCALE;
+			tile.heights[y * TILE_SIZE + x] = static_cast<uint16_t>(glm::round(glm::clamp(unorm, 0.0f, 65535.0f)));
+		}
+	}
+
+	ComputeNormals(origin, PITCH, width, height, &tile.normals[0], TILE_SIZE);
+}
+
+void Heightmap::ComputeNormals(const float* heights, int heights_pitch, int width, int height, int8_t* normals, int normals_pitch)
+{
+	int thread_count = std::max<int>(std::thread::hardware_concurrency(), 1);
+	thread_count = std::max(std::min(thread_count, width * height / NORMALS_MIN_PER_THREAD), 1);
+
+	// Each thread computes a contiguous band of rows.
+	std::vector<std::thread> threads;
+	for (int t = 1; t < thread_count; ++t)
+		threads.push_back(std::thread(ComputeNormalRows, heights, heights_pitch, width, height * t / thread_count, height * (t + 1) / thread_count, normals, normals_pitch));
+
+	ComputeNormalRows(heights, heights_pitch, width, 0, height / thread_count, normals, normals_pitch);
+	for (size_t t = 0; t < threads.size(); ++t)
+		threads[t].join();
+}
 
-			float sx = GetHeight((x < HEIGHTMAP_RESOLUTION_X - 1 ? x + 1 : x), y) - GetHeight((x > 0 ? x - 1 : x), y);
-			float sy = GetHeight(x, (y < HEIGHTMAP_RESOLUTION_Y - 1 ? y + 1 : y)) - GetHeight(x, (y > 0 ? y - 1 : y));
 
-			if (x == 0 || x == HEIGHTMAP_RESOLUTION_X - 1)
-				sx *= 2;
-			if (y == 0 || y == HEIGHTMAP_RESOLUTION_Y - 1)
-				sy *= 2;
 
-			normals[i] = glm::normalize(glm::vec3(-sx, 2, sy));
+const float TerrainQuadtree::LOD_RANGE_NODES = 4.0f;
+const float TerrainQuadtree::MORPH_START_RATIO = 0.7f;
+
+// Whether any point of the box is within radius of center.
+static bool IntersectsSphere(const AABB& aabb, const glm::vec3& center, float radius)
+{
+	glm::vec3 closest = glm::clamp(center, aabb.min, aabb.max);
+	glm::vec3 d = closest - center;
+	return glm::dot(d, d) <= radius * radius;
+}
+
+TerrainQuadtree::TerrainQuadtree(const Heightmap& heightmap, float sample_spacing)
+	: resolution(heightmap.GetResolutionX(), heightmap.GetResolutionY())
+	, sample_spacing(sample_spacing)
+	, level_count(0)
+{
+	// Find the lowest and highest heights of the leaf nodes, including the samples on their far edges.
+	node_counts[0] = (resolution - 1 + PATCH_QUADS - 1) / PATCH_QUADS;
+	node_heights[0].resize(node_counts[0].x * node_counts[0].y);
+	corner_heights.resize((node_counts[0].x + 1) * (node_counts[0].y + 1));
+	for (int node_y = 0; node_y < node_counts[0].y; ++node_y)
+	{
+		for (int node_x = 0; node_x < node_counts[0].x; ++node_x)
+		{
+			glm::vec2& range = node_heights[0][node_y * node_counts[0].x + node_x];
+			range = glm::vec2(heightmap.GetHeight(node_x * PATCH_QUADS, node_y * PATCH_QUADS));
+			int x_end = std::min((node_x + 1) * PATCH_QUADS, resolution.x - 1);
+			int y_end = std::min((node_y + 1) * PATCH_QUADS, resolution.y - 1);
+			for (int y = node_y * PATCH_QUADS; y <= y_end; ++y)
+			{
+				for (int x = node_x * PATCH_QUADS; x <= x_end; ++x)
+				{
+					range.x = std::min(range.x, heightmap.GetHeight(x, y));
+					range.y = std::max(range.y, heightmap.GetHeight(x, y));
+				}
+			}
+
+			for (int i = 0; i < 4; ++i)
+			{
+				int x = i % 2 ? x_end : node_x * PATCH_QUADS;
+				int y = i / 2 ? y_end : node_y * PATCH_QUADS;
+				corner_heights[(node_y + i / 2) * (node_counts[0].x + 1) + node_x + i % 2] = heightmap.GetHeight(x, y);
+			}
 		}
 	}
+
+	// Build the levels above from the ones below, up to a single root node.
+	level_count = 1;
+	while (node_counts[level_count - 1] != glm::ivec2(1, 1))
+	{
+		if (level_count == TERRAIN_LOD_LEVEL_MAX)
+			throw std::runtime_error("Heightmap too large for the terrain levels of detail.");
+
+		const glm::ivec2& child_counts = node_counts[level_count - 1];
+		const std::vector<glm::vec2>& child_heights = node_heights[level_count - 1];
+		glm::ivec2& counts = node_counts[level_count];
+		counts = (child_counts + 1) / 2;
+		node_heights[level_count].resize(counts.x * counts.y);
+		for (int node_y = 0; node_y < counts.y; ++node_y)
+		{
+			for (int node_x = 0; node_x < counts.x; ++node_x)
+			{
+				glm::vec2& range = node_heights[level_count][node_y * counts.x + node_x];
+				range = child_heights[2 * node_y * child_counts.x + 2 * node_x];
+				for (int y = 2 * node_y; y < std::min(2 * node_y + 2, child_counts.y); ++y)
+				{
+					for (int x = 2 * node_x; x < std::min(2 * node_x + 2, child_counts.x); ++x)
+					{
+						range.x = std::min(range.x, child_heights[y * child_counts.x + x].x);
+						range.y = std::max(range.y, child_heights[y * child_counts.x + x].y);
+					}
+				}
+			}
+		}
+
+		++level_count;
+	}
+
+	for (int level = 0; level < TERRAIN_LOD_LEVEL_MAX; ++level)
+		lod_ranges[level] = LOD_RANGE_NODES * PATCH_QUADS * sample_spacing * float(1 << level);
 }
 
-float Heightmap::GetHeight(int x, int y) const
+void TerrainQuadtree::Select(const glm::vec4 frustum_planes[6], const glm::vec3& camera_position, std::vector<TerrainPatch>& patches) const
+{
+	// The root covers itself when it is out of range of the top level.
+	patches.clear();
+	int top = level_count - 1;
+	if (!SelectNode(top, 0, 0, frustum_planes, camera_position, patches))
+	{
+		for (int i = 0; i < 4; ++i)
+			AddPatch(top, i % 2, i / 2, patches);
+	}
+}
+
+glm::vec2 TerrainQuadtree::GetMorphRange(int level) const
+{
+	float previous_range = level > 0 ? lod_ranges[level - 1] : 0.0f;
+	return glm::vec2(previous_range + (lod_ranges[level] - previous_range) * MORPH_START_RATIO, lod_ranges[level]);
+}
+
+float TerrainQuadtree::GetCornerHeight(int x, int y) const
+{
+	int corner_x = x < resolution.x - 1 ? x / PATCH_QUADS : node_counts[0].x;
+	int corner_y = y < resolution.y - 1 ? y / PATCH_QUADS : node_counts[0].y;
+	return corner_heights[corner_y * (node_counts[0].x + 1) + corner_x];
+}
+
+AABB TerrainQuadtree::GetNodeAABB(int level, int x, int y) const
+{
+	int size = PATCH_QUADS << level;
+	const glm::vec2& range = node_heights[level][y * node_counts[level].x + x];
+
+	AABB aabb;
+	aabb.min = glm::vec3(float(x * size) * sample_spacing, range.x, float(y * size) * sample_spacing);
+	aabb.max = glm::vec3(float(std::min((x + 1) * size, resolution.x - 1)) * sample_spacing, range.y, float(std::min((y + 1) * size, resolution.y - 1)) * sample_spacing);
+	return aabb;
+}
+
+bool TerrainQuadtree::SelectNode(int level, int x, int y, const glm::vec4 frustum_planes[6], const glm::vec3& camera_position, std::vector<TerrainPatch>& patches) const
 {
-	//return 0.0f;
-	return heights[y * HEIGHTMAP_RESOLUTION_X + x];
+	AABB aabb = GetNodeAABB(level, x, y);
+
+	// A node outside the frustum is handled, without drawing anything.
+	if (!IntersectsFrustum(aabb, frustum_planes))
+		return true;
+
+	if (!IntersectsSphere(aabb, camera_position, lod_ranges[level]))
+		return false;
+
+	// Draw the whole node at this level unless the level below is in range.
+	if (level == 0 || !IntersectsSphere(aabb, camera_position, lod_ranges[level - 1]))
+	{
+		for (int i = 0; i < 4; ++i)
+			AddPatch(level, 2 * x + i % 2, 2 * y + i / 2, patches);
+
+		return true;
+	}
+
+	// Children out of the range of their level are covered by a patch of this one.
+	for (int i = 0; i < 4; ++i)
+	{
+		int child_x = 2 * x + i % 2;
+		int child_y = 2 * y + i / 2;
+		if (child_x >= node_counts[level - 1].x || child_y >= node_counts[level - 1].y)
+			continue;
+
+		if (!SelectNode(level - 1, child_x, child_y, frustum_planes, camera_position, patches))
+			AddPatch(level, child_x, child_y, patches);
+	}
+
+	return true;
 }
 
-const glm::vec3& Heightmap::GetNormal(int x, int y) const
+void TerrainQuadtree::AddPatch(int level, int x, int y, std::vector<TerrainPatch>& patches) const
 {
-	return normals[y * HEIGHTMAP_RESOLUTION_X + x];
+	TerrainPatch patch;
+	patch.spacing = float(1 << level);
+	patch.origin = glm::vec2(float(x), float(y)) * (PATCH_GRID_QUADS * patch.spacing);
+	patch.level = float(level);
+	if (patch.origin.x >= resolution.x - 1 || patch.origin.y >= resolution.y - 1)
+		return;
+
+	patches.push_back(patch);
 }
 
 
 
-const float Terrain::TERRAIN_WIDTH = 128.0f;
-const float Terrain::TERRAIN_HEIGHT = 128.0f;
+const float Terrain::SAMPLE_SPACING = 1.0f;
 
-Terrain::Terrain()
+Terrain::Terrain(ResourceCache& resources)
+	: quadtree(heightmap, SAMPLE_SPACING)
+	, frame(0)
 {
-	// Generate the vertex data.
-	float xstride = 1.0f / Heightmap::HEIGHTMAP_RESOLUTION_X;
-	float ystride = 1.0f / Heightmap::HEIGHTMAP_RESOLUTION_Y;
-	std::vector<glm::vec3> positions(VERTEX_COUNT);
-	std::vector<glm::vec3> normals(VERTEX_COUNT);
-	std::vector<glm::vec2> texcoords(VERTEX_COUNT);
-	int count = 0;
-	for (int quady = 0; quady < Heightmap::HEIGHTMAP_RESOLUTION_Y - 1; ++quady)
+	int resolution_x = heightmap.GetResolutionX();
+	int resolution_y = heightmap.GetResolutionY();
+
+	for (int level = 0; level < TERRAIN_LOD_LEVEL_MAX; ++level)
+		lod_uniform_data.morph_ranges[level] = glm::vec4(quadtree.GetMorphRange(level), 0.0f, 0.0f);
+	lod_uniform_data.heightmap_size = glm::vec4(float(resolution_x), float(resolution_y), 1.0f / resolution_x, 1.0f / resolution_y);
+
+	// Generate the patch grid, which covers a quarter of a node. The vertices are positions on the grid, in
+	// vertices, and are placed on the heightmap by the patch instances.
+	const int GRID_SIZE = TerrainQuadtree::PATCH_GRID_QUADS + 1;
+	std::vector<glm::vec2> grid(GRID_SIZE * GRID_SIZE);
+	for (int y = 0; y < GRID_SIZE; ++y)
 	{
-		for (int quadx = 0; quadx < Heightmap::HEIGHTMAP_RESOLUTION_X - 1; ++quadx)
+		for (int x = 0; x < GRID_SIZE; ++x)
+			grid[y * GRID_SIZE + x] = glm::vec2(float(x), float(y));
+	}
+
+	std::vector<unsigned int> indices;
+	for (int y = 0; y < TerrainQuadtree::PATCH_GRID_QUADS; ++y)
+	{
+		for (int x = 0; x < TerrainQuadtree::PATCH_GRID_QUADS; ++x)
 		{
-			int x = quadx;
-			int y = quady;
-			float heights[] = { heightmap.GetHeight(x, y), heightmap.GetHeight(x + 1, y), heightmap.GetHeight(x + 1, y + 1), heightmap.GetHeight(x, y + 1) };
-			//float heights[] = { 0.0f, 0.0f, 0.0f, 0.0f };
-
-			positions[count] = glm::vec3(x * xstride * TERRAIN_WIDTH, heights[0], y * ystride * TERRAIN_HEIGHT);
-			normals[count] = heightmap.GetNormal(x, y);
-			texcoords[count] = glm::vec2(x * xstride, y * ystride);
-			count++;
-
-			y++;
-			positions[count] = glm::vec3(x * xstride * TERRAIN_WIDTH, heights[3], y * ystride * TERRAIN_HEIGHT);
-			normals[count] = heightmap.GetNormal(x, y);
-			texcoords[count] = glm::vec2(x * xstride, y * ystride);
-			count++;
-
-			x++;
-			positions[count] = glm::vec3(x * xstride * TERRAIN_WIDTH, heights[2], y * ystride * TERRAIN_HEIGHT);
-			normals[count] = heightmap.GetNormal(x, y);
-			texcoords[count] = glm::vec2(x * xstride, y * ystride);
-			count++;
-
-			y--;
-			x--;
-			positions[count] = glm::vec3(x * xstride * TERRAIN_WIDTH, heights[0], y * ystride * TERRAIN_HEIGHT);
-			normals[count] = heightmap.GetNormal(x, y);
-			texcoords[count] = glm::vec2(x * xstride, y * ystride);
-			count++;
-
-			x++;
-			y++;
-			positions[count] = glm::vec3(x * xstride * TERRAIN_WIDTH, heights[2], y * ystride * TERRAIN_HEIGHT);
-			normals[count] = heightmap.GetNormal(x, y);
-			texcoords[count] = glm::vec2(x * xstride, y * ystride);
-			count++;
-
-			y--;
-			positions[count] = glm::vec3(x * xstride * TERRAIN_WIDTH, heights[1], y * ystride * TERRAIN_HEIGHT);
-			normals[count] = heightmap.GetNormal(x, y);
-			texcoords[count] = glm::vec2(x * xstride, y * ystride);
-			count++;
+			unsigned int corner = y * GRID_SIZE + x;
+			unsigned int quad[] = { corner, corner + 1, corner + GRID_SIZE + 1, corner + GRID_SIZE };
+			unsigned int triangles[] = { quad[0], quad[3], quad[2], quad[0], quad[2], quad[1] };
+			indices.insert(indices.end(), triangles, triangles + 6);
 		}
 	}
 
-	// Generate the buffers.
+	OptimizeVertexCache(&indices[0], indices.size(), grid.size());
+	std::vector<GLushort> short_indices(indices.begin(), indices.end());
+	index_count = static_cast<GLsizei>(short_indices.size());
+
+	// Generate the buffers. The patches are streamed into their buffer every frame.
 	glGenVertexArrays(1, &vao);
 	glBindVertexArray(vao);
 	
-	glGenBuffers(1, &position_vbo);
-	glBindBuffer(GL_ARRAY_BUFFER, position_vbo);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(glm::vec3) * VERTEX_COUNT, &positions[0], GL_STATIC_DRAW);
-	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, 0);
-
-	glGenBuffers(1, &normal_vbo);
-	glBindBuffer(GL_ARRAY_BUFFER, normal_vbo);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(glm::vec3) * VERTEX_COUNT, &normals[0], GL_STATIC_DRAW);
-	glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 0, 0);
-
-	glGenBuffers(1, &texcoord_vbo);
-	glBindBuffer(GL_ARRAY_BUFFER, texcoord_vbo);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(glm::vec2) * VERTEX_COUNT, &texcoords[0], GL_STATIC_DRAW);
-	glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 0, 0);
+	glGenBuffers(1, &grid_vbo);
+	glBindBuffer(GL_ARRAY_BUFFER, grid_vbo);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(glm::vec2) * grid.size(), &grid[0], GL_STATIC_DRAW);
+	glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 0, 0);
+
+	glGenBuffers(1, &patch_vbo);
+	glBindBuffer(GL_ARRAY_BUFFER, patch_vbo);
+	glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, sizeof(TerrainPatch), 0);
+	glVertexAttribPointer(2, 1, GL_FLOAT, GL_FALSE, sizeof(TerrainPatch), reinterpret_cast<const void*>(offsetof(TerrainPatch, height_tile)));
+	glVertexAttribDivisor(1, 1);
+	glVertexAttribDivisor(2, 1);
 
 	glEnableVertexAttribArray(0);
 	glEnableVertexAttribArray(1);
 	glEnableVertexAttribArray(2);
 
+	glGenBuffers(1, &index_buffer);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, index_buffer);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(GLushort) * short_indices.size(), &short_indices[0], GL_STATIC_DRAW);
+
+	// Allocate the height tiles, which the vertex shader samples between the samples when vertices morph.
+	glGenTextures(1, &height_tile_texture);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, height_tile_texture);
+	glTexStorage3D(GL_TEXTURE_2D_ARRAY, 1, GL_R32F, TERRAIN_HEIGHT_TILE_SIZE, TERRAIN_HEIGHT_TILE_SIZE, HEIGHT_TILE_CAPACITY);
+
+	glGenSamplers(1, &height_sampler);
+	glSamplerParameteri(height_sampler, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glSamplerParameteri(height_sampler, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glSamplerParameteri(height_sampler, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glSamplerParameteri(height_sampler, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
 	// Load the program.
-	terrain_vs = CompileShaderFromFile((DIRECTORY_SHADERS + FILE_TERRAIN_VS).c_str(), GL_VERTEX_SHADER);
-	terrain_fs = CompileShaderFromFile((DIRECTORY_SHADERS + FILE_TERRAIN_FS).c_str(), GL_FRAGMENT_SHADER);
-	terrain_program = glCreateProgram();
-	glAttachShader(terrain_program, terrain_vs);
-	glAttachShader(terrain_program, terrain_fs);
-	LinkProgram(terrain_program);
-
-	// Setup the uniform buffer.
+	terrain_program = resources.LoadProgram(TERRAIN_SHADERS, TERRAIN_SHADER_COUNT, TERRAIN_DEFINES, TERRAIN_DEFINE_COUNT);
+
+	// Setup the uniform buffers. The model matrix scales the heightmap samples to world units.
 	glGenBuffers(1, &uniform_buffer);
 
+	uniform_data.model_matrix = glm::scale(glm::vec3(SAMPLE_SPACING, 1.0f, SAMPLE_SPACING));
+	uniform_data.normal_matrix = glm::transpose(glm::inverse(uniform_data.model_matrix));
 	uniform_data.material_specular_color = glm::vec4(0.4f, 0.4f, 0.4f, 1.0f);
 
 	glBindBufferBase(GL_UNIFORM_BUFFER, UNIFORM_BINDING_INSTANCE, uniform_buffer);
 	glBufferData(GL_UNIFORM_BUFFER, sizeof(UniformBufferPerInstance), &uniform_data, GL_STATIC_DRAW);
 
-	// Load the textures.
-	const std::string filenames[] = { FILE_TERRAIN_TEXTURE_1, FILE_TERRAIN_TEXTURE_2, FILE_TERRAIN_TEXTURE_3 };
-	for (int i = 0; i < 3; ++i)
-	{
-		gli::storage texture_image = gli::load_dds((DIRECTORY_TEXTURES + filenames[i]).c_str());
+	glGenBuffers(1, &lod_uniform_buffer);
+	glBindBufferBase(GL_UNIFORM_BUFFER, UNIFORM_BINDING_TERRAIN_LOD, lod_uniform_buffer);
+	glBufferData(GL_UNIFORM_BUFFER, sizeof(UniformBufferTerrainLOD), &lod_uniform_data, GL_STATIC_DRAW);
+
+	// Load the textures. The layers are sampled from one array texture, so they take a single binding.
+	layer_texture = resources.LoadTextureArray(TERRAIN_TEXTURE_FILES, TERRAIN_TEXTURE_COUNT, GL_RGB8, GL_BGR);
 
-		glGenTextures(1, &textures[i]);
-		glBindTexture(GL_TEXTURE_2D, textures[i]);
-		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB8, texture_image.dimensions(0).x, texture_image.dimensions(0).y, 0, GL_BGR, GL_UNSIGNED_BYTE, texture_image.data());
+	TextureImage mask_image;
+	if (!LoadDDSFile(DIRECTORY_TEXTURES + FILE_TERRAIN_MASK, mask_image))
+	{
+		throw std::runtime_error("Failed to load terrain mask: " + DIRECTORY_TEXTURES + FILE_TERRAIN_MASK);
 	}
 
-	gli::storage mask_image = gli::load_dds((DIRECTORY_TEXTURES + FILE_TERRAIN_MASK).c_str());
-	
-	glGenTextures(1, &mask_texture);
-	glBindTexture(GL_TEXTURE_2D, mask_texture);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB8, mask_image.dimensions(0).x, mask_image.dimensions(0).y, 0, GL_BGR, GL_UNSIGNED_BYTE, mask_image.data());
+	mask_texture = CreateTexture(mask_image, GL_RGB8, GL_BGR);
 
 	// Create the sampler.
 	glGenSamplers(1, &sampler);
-	glSamplerParameteri(sampler, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-	glSamplerParameteri(sampler, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	SetSamplerFiltering(sampler, TEXTURE_ANISOTROPY_DEFAULT);
 	glSamplerParameteri(sampler, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
 	glSamplerParameteri(sampler, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
 }
 
 Terrain::~Terrain()
 {
-
+	glDeleteVertexArrays(1, &vao);
+	glDeleteBuffers(1, &grid_vbo);
+	glDeleteBuffers(1, &patch_vbo);
+	glDeleteBuffers(1, &index_buffer);
+	glDeleteTextures(1, &height_tile_texture);
+	glDeleteTextures(1, &mask_texture);
+	glDeleteSamplers(1, &height_sampler);
+	glDeleteSamplers(1, &sampler);
+	glDeleteBuffers(1, &uniform_buffer);
+	glDeleteBuffers(1, &lod_uniform_buffer);
 }
 
-void Terrain::Render()
+void Terrain::Render(const glm::vec4 frustum_planes[6], const glm::vec3& camera_position)
 {
-	glUseProgram(terrain_program);
+	quadtree.Select(frustum_planes, camera_position, patches);
+
+	// Find or stream the height tiles of the patches.
+	++frame;
+	size_t patch_count = 0;
+	for (size_t i = 0; i < patches.size(); ++i)
+	{
+		int layer = GetHeightTile(patches[i]);
+		if (layer < 0)
+			continue;
+
+		patches[patch_count] = patches[i];
+		patches[patch_count].height_tile = float(layer);
+		++patch_count;
+	}
+	patches.resize(patch_count);
+
+	if (patches.empty())
+		return;
+
+	glUseProgram(terrain_program->name);
 
 	glActiveTexture(GL_TEXTURE0 + TEXTURE_UNIT_TERRAIN_MASK);
 	glBindSampler(TEXTURE_UNIT_TERRAIN_MASK, sampler);
 	glBindTexture(GL_TEXTURE_2D, mask_texture);
 
-	glActiveTexture(GL_TEXTURE0 + TEXTURE_UNIT_TERRAIN_1);
-	glBindSampler(TEXTURE_UNIT_TERRAIN_1, sampler);
-	glBindTexture(GL_TEXTURE_2D, textures[0]);
+	glActiveTexture(GL_TEXTURE0 + TEXTURE_UNIT_TERRAIN_LAYERS);
+	glBindSampler(TEXTURE_UNIT_TERRAIN_LAYERS, sampler);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, layer_texture->name);
 
-	glActiveTexture(GL_TEXTURE0 + TEXTURE_UNIT_TERRAIN_2);
-	glBindSampler(TEXTURE_UNIT_TERRAIN_2, sampler);
-	glBindTexture(GL_TEXTURE_2D, textures[1]);
+	glActiveTexture(GL_TEXTURE0 + TEXTURE_UNIT_TERRAIN_HEIGHT);
+	glBindSampler(TEXTURE_UNIT_TERRAIN_HEIGHT, height_sampler);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, height_tile_texture);
 
-	glActiveTexture(GL_TEXTURE0 + TEXTURE_UNIT_TERRAIN_3);
-	glBindSampler(TEXTURE_UNIT_TERRAIN_3, sampler);
-	glBindTexture(GL_TEXTURE_2D, textures[2]);
+	glBindBuffer(GL_ARRAY_BUFFER, patch_vbo);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(TerrainPatch) * patches.size(), &patches[0], GL_STREAM_DRAW);
 
 	glBindBufferBase(GL_UNIFORM_BUFFER, UNIFORM_BINDING_INSTANCE, uniform_buffer);
+	glBindBufferBase(GL_UNIFORM_BUFFER, UNIFORM_BINDING_TERRAIN_LOD, lod_uniform_buffer);
 	glBindVertexArray(vao);
-	glDrawArrays(GL_TRIANGLES, 0, VERTEX_COUNT);
+	glDrawElementsInstanced(GL_TRIANGLES, index_count, GL_UNSIGNED_SHORT, 0, static_cast<GLsizei>(patches.size()));
 }
 
-float lerp(float a, float b, float t)
+int Terrain::GetHeightTile(const TerrainPatch& patch)
 {
-	return a * t + b * (1.0f - t);
-}
+	int level = int(patch.level);
+	int spacing = 1 << level;
+	int patch_x = int(patch.origin.x) / (TerrainQuadtree::PATCH_GRID_QUADS * spacing);
+	int patch_y = int(patch.origin.y) / (TerrainQuadtree::PATCH_GRID_QUADS * spacing);
+	uint64_t key = (uint64_t(level) << 48) | (uint64_t(patch_y) << 24) | uint64_t(patch_x);
+
+	auto found = height_tile_lookup.find(key);
+	if (found != height_tile_lookup.end())
+	{
+		height_tiles.splice(height_tiles.begin(), height_tiles, found->second);
+		height_tiles.front().frame = frame;
+		return height_tiles.front().layer;
+	}
 
-float bilerp(float a, float b, float c, float d, float s, float t)
-{
-	return lerp(lerp(a, b, s), lerp(c, d, s), t);
+	// Take a free layer, or the one of the least recently drawn patch unless it is drawn this frame too.
+	int layer;
+	if (height_tiles.size() < HEIGHT_TILE_CAPACITY)
+	{
+		layer = static_cast<int>(height_tiles.size());
+		height_tiles.emplace_front();
+	}
+	else
+	{
+		if (height_tiles.back().frame == frame)
+			return -1;
+
+		layer = height_tiles.back().layer;
+		height_tile_lookup.erase(height_tiles.back().key);
+		height_tiles.splice(height_tiles.begin(), height_tiles, std::prev(height_tiles.end()));
+	}
+
+	HeightTile& tile = height_tiles.front();
+	tile.key = key;
+	tile.layer = layer;
+	tile.frame = frame;
+	height_tile_lookup[key] = height_tiles.begin();
+
+	// Sample the heights at the vertices of the patch and one vertex around it, clamped to the heightmap. Levels
+	// that only sample the corners of the leaf nodes take them from the quadtree, so coarse patches, which span
+	// most of the heightmap, do not read all of it.
+	float heights[TERRAIN_HEIGHT_TILE_SIZE * TERRAIN_HEIGHT_TILE_SIZE];
+	for (int y = 0; y < TERRAIN_HEIGHT_TILE_SIZE; ++y)
+	{
+		for (int x = 0; x < TERRAIN_HEIGHT_TILE_SIZE; ++x)
+		{
+			int sample_x = glm::clamp(int(patch.origin.x) + (x - 1) * spacing, 0, heightmap.GetResolutionX() - 1);
+			int sample_y = glm::clamp(int(patch.origin.y) + (y - 1) * spacing, 0, heightmap.GetResolutionY() - 1);
+			if (spacing >= TerrainQuadtree::PATCH_QUADS)
+				heights[y * TERRAIN_HEIGHT_TILE_SIZE + x] = quadtree.GetCornerHeight(sample_x, sample_y);
+			else
+				heights[y * TERRAIN_HEIGHT_TILE_SIZE + x] = heightmap.GetHeight(sample_x, sample_y);
+		}
+	}
+
+	glBindTexture(GL_TEXTURE_2D_ARRAY, height_tile_texture);
+	glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, layer, TERRAIN_HEIGHT_TILE_SIZE, TERRAIN_HEIGHT_TILE_SIZE, 1, GL_RED, GL_FLOAT, heights);
+	return layer;
 }
 
-float Terrain::GetHeight(float x, float z) const
+void Terrain::GetHeights(const float* x, const float* z, size_t count, float* heights, glm::vec3* normals) const
 {
-	float nx = x / TERRAIN_WIDTH;
-	float nz = z / TERRAIN_HEIGHT;
+	int resolution_x = heightmap.GetResolutionX();
+	int resolution_y = heightmap.GetResolutionY();
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 one = _mm_set1_ps(1.0f);
+	const __m128 inverse_spacing = _mm_set1_ps(1.0f / SAMPLE_SPACING);
+	const __m128 size_x = _mm_set1_ps(float(resolution_x));
+	const __m128 size_y = _mm_set1_ps(float(resolution_y));
+	const __m128 last_x = _mm_set1_ps(float(resolution_x - 1));
+	const __m128 last_y = _mm_set1_ps(float(resolution_y - 1));
+
+	for (size_t i = 0; i < count; i += 4)
+	{
+		// The last points are padded with points outside the terrain.
+		size_t lane_count = std::min<size_t>(count - i, 4);
+		float lane_x[4] = { -1.0f, -1.0f, -1.0f, -1.0f };
+		float lane_z[4] = { -1.0f, -1.0f, -1.0f, -1.0f };
+		std::memcpy(lane_x, x + i, lane_count * sizeof(float));
+		std::memcpy(lane_z, z + i, lane_count * sizeof(float));
+		__m128 sample_x = _mm_mul_ps(_mm_loadu_ps(lane_x), inverse_spacing);
+		__m128 sample_y = _mm_mul_ps(_mm_loadu_ps(lane_z), inverse_spacing);
+
+		// Every point is clamped into the heightmap and sampled, and the mask drops the ones outside it afterwards.
+		// NaNs fail the comparisons and clamp to zero.
+		__m128 inside = _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(sample_x, zero), _mm_cmplt_ps(sample_x, size_x)), _mm_and_ps(_mm_cmpge_ps(sample_y, zero), _mm_cmplt_ps(sample_y, size_y)));
+		sample_x = _mm_min_ps(_mm_max_ps(sample_x, zero), last_x);
+		sample_y = _mm_min_ps(_mm_max_ps(sample_y, zero), last_y);
+		__m128i first_x = _mm_cvttps_epi32(sample_x);
+		__m128i first_y = _mm_cvttps_epi32(sample_y);
+		__m128 tx = _mm_sub_ps(sample_x, _mm_cvtepi32_ps(first_x));
+		__m128 ty = _mm_sub_ps(sample_y, _mm_cvtepi32_ps(first_y));
+
+		// Gather the four samples around each point, and their encoded normals.
+		int x1[4], y1[4];
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(x1), first_x);
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(y1), first_y);
+		float corner_heights[4][4];
+		float corner_normals[4][2][4];
+		for (int lane = 0; lane < 4; ++lane)
+		{
+			int x2 = std::min(x1[lane] + 1, resolution_x - 1);
+			int y2 = std::min(y1[lane] + 1, resolution_y - 1);
+			int corners[4][2] = { { x1[lane], y1[lane] }, { x2, y1[lane] }, { x1[lane], y2 }, { x2, y2 } };
+			for (int c = 0; c < 4; ++c)
+			{
+				corner_heights[c][lane] = heightmap.GetHeight(corners[c][0], corners[c][1]);
+				if (normals)
+				{
+					glm::vec2 encoded = heightmap.GetEncodedNormal(corners[c][0], corners[c][1]);
+					corner_normals[c][0][lane] = encoded.x;
+					corner_normals[c][1][lane] = encoded.y;
+				}
+			}
+		}
+
+		__m128 weights[4];
+		weights[0] = _mm_mul_ps(_mm_sub_ps(one, tx), _mm_sub_ps(one, ty));
+		weights[1] = _mm_mul_ps(tx, _mm_sub_ps(one, ty));
+		weights[2] = _mm_mul_ps(_mm_sub_ps(one, tx), ty);
+		weights[3] = _mm_mul_ps(tx, ty);
 
-	if (nx < 0 || nx >= 1.0f)
-		return 0.0f;
-	if (nz < 0 || nz >= 1.0f)
-		return 0.0f;
+		__m128 height = zero;
+		for (int c = 0; c < 4; ++c)
+			height = _mm_add_ps(height, _mm_mul_ps(weights[c], _mm_loadu_ps(corner_heights[c])));
 
-	int x1 = glm::clamp(int(nx * Heightmap::HEIGHTMAP_RESOLUTION_X), 0, Heightmap::HEIGHTMAP_RESOLUTION_X - 1);
-	int x2 = glm::clamp(x1 + 1, 0, Heightmap::HEIGHTMAP_RESOLUTION_X - 1);
+		float lane_heights[4];
+		_mm_storeu_ps(lane_heights, _mm_and_ps(inside, height));
+		std::memcpy(heights + i, lane_heights, lane_count * sizeof(float));
 
-	int y1 = glm::clamp(int(nz * Heightmap::HEIGHTMAP_RESOLUTION_Y), 0, Heightmap::HEIGHTMAP_RESOLUTION_Y - 1);
-	int y2 = glm::clamp(y1 + 1, 0, Heightmap::HEIGHTMAP_RESOLUTION_Y - 1);
+		if (!normals)
+			continue;
+
+		// Decode the normals, which all point up and so are on the unfolded half of the octahedron, then blend them
+		// the same way. Points outside the terrain face up.
+		const __m128 sign = _mm_set1_ps(-0.0f);
+		__m128 normal[3] = { zero, zero, zero };
+		for (int c = 0; c < 4; ++c)
+		{
+			__m128 corner[3];
+			corner[0] = _mm_loadu_ps(corner_normals[c][0]);
+			corner[2] = _mm_loadu_ps(corner_normals[c][1]);
+			corner[1] = _mm_sub_ps(_mm_sub_ps(one, _mm_andnot_ps(sign, corner[0])), _mm_andnot_ps(sign, corner[2]));
+			__m128 corner_length_squared = _mm_add_ps(_mm_add_ps(_mm_mul_ps(corner[0], corner[0]), _mm_mul_ps(corner[1], corner[1])), _mm_mul_ps(corner[2], corner[2]));
+			__m128 corner_weight = _mm_div_ps(weights[c], _mm_sqrt_ps(corner_length_squared));
+			for (int k = 0; k < 3; ++k)
+				normal[k] = _mm_add_ps(normal[k], _mm_mul_ps(corner_weight, corner[k]));
+		}
 
-	float tx = float(x - x1);
-	float ty = float(z - y1);
+		__m128 length_squared = _mm_add_ps(_mm_add_ps(_mm_mul_ps(normal[0], normal[0]), _mm_mul_ps(normal[1], normal[1])), _mm_mul_ps(normal[2], normal[2]));
+		__m128 scale = _mm_and_ps(inside, _mm_div_ps(one, _mm_sqrt_ps(length_squared)));
+		float lane_normals[12];
+		StoreVectors4(lane_normals, _mm_mul_ps(normal[0], scale), _mm_or_ps(_mm_mul_ps(normal[1], scale), _mm_andnot_ps(inside, one)), _mm_mul_ps(normal[2], scale));
+		std::memcpy(&normals[i].x, lane_normals, lane_count * sizeof(glm::vec3));
+	}
+}
 
-	return bilerp(heightmap.GetHeight(x1, y1), heightmap.GetHeight(x1, y2), heightmap.GetHeight(x2, y1), heightmap.GetHeight(x2, y2), ty, tx);
+float Terrain::GetHeight(float x, float z) const
+{
+	float height;
+	GetHeights(&x, &z, 1, &height);
+	return height;
 }
\ No newline at end of file
@@ -4,49 +4,244 @@
 
 #include "constants.hpp"
 #include <GL/gl3w.h>
+#include <common/bounds.h>
+#include <common/fileio.h>
+#include <common/mesh.h>
+#include <common/resourcecache.h>
+#include <common/texture.h>
+#include <cstdint>
+#include <list>
+#include <unordered_map>
+#include <vector>
 
+/*
+	Heights and normals of the terrain, one sample per texel of the heightmap texture. The heightmap can be of any
+	size of at least 2x2 samples, and of 1 byte pixels or BC4 blocks.
+
+	The file stays mapped, and the samples are decoded in tiles of TILE_SIZE by TILE_SIZE when first used. At most
+	TILE_CACHE_SIZE tiles, 16 MB, are kept, the least recently used going first, so heightmaps far larger than memory
+	can be sampled. Sampling is not thread safe, as it updates the tiles.
+
+	Tiles store 4 bytes per sample: the height as a 16 bit unorm, scaled by HEIGHT_UNORM_SCALE above LOWEST_HEIGHT,
+	and the normal octahedral encoded in two 8 bit snorms. The octahedron is oriented along y, the up axis, so the
+	normals, which all point up, use its unfolded half, and a flat normal is exact.
+*/
 class Heightmap
 {
 public:
-	static const int HEIGHTMAP_RESOLUTION_X = 128;
-	static const int HEIGHTMAP_RESOLUTION_Y = 128;
 	static const float LOWEST_HEIGHT;
 	static const float HIGHEST_HEIGHT;
 	static const float HEIGHT_STEP;
+	static const float HEIGHT_UNORM_SCALE;
+	static const int TILE_SIZE = 64;
+	static const size_t TILE_CACHE_SIZE = 1024;
 	
 	Heightmap();
 
+	int GetResolutionX() const;
+	int GetResolutionY() const;
 	float GetHeight(int x, int y) const;
-	const glm::vec3& GetNormal(int x, int y) const;
+	glm::vec3 GetNormal(int x, int y) const;
+
+	/*
+		Returns the normal in its octahedral encoding, x and z of the normal divided by the sum of its absolute
+		components, for blending normals before decoding them.
+	*/
+	glm::vec2 GetEncodedNormal(int x, int y) const;
+
+	/*
+		Compute the normals of width by height samples from the central differences of their heights, encoded as in
+		the tiles with normals_pitch samples from one row to the next, for tiles and for the regions whose heights
+		are edited. heights must also have a sample on each side of the region; past the edges of the heightmap,
+		extrapolating the last two samples doubles the one-sided difference there. Samples are vectorized and, in
+		regions of NORMALS_MIN_PER_THREAD samples or more, bands of rows are split over threads.
+		Algorithm source: http://www.flipcode.com/archives/Calculating_Vertex_Normals_for_Height_Maps.shtml
+	*/
+	static void ComputeNormals(const float* heights, int heights_pitch, int width, int height, int8_t* normals, int normals_pitch);
+private:
+	// Smallest number of samples worth a thread of its own when computing normals.
+	static const int NORMALS_MIN_PER_THREAD = 65536;
+
+	struct Tile
+	{
+		int index;
+		std::vector<uint16_t> heights;
+		// Two components per sample.
+		std::vector<int8_t> normals;
+	};
+
+	MappedFile file;
+	DDSLayout layout;
+	int resolution_x;
+	int resolution_y;
+	int tile_count_x;
+	// The tiles from the most to the least recently used, and where each is in the list by its index.
+	mutable std::list<Tile> tiles;
+	mutable std::unordered_map<int, std::list<Tile>::iterator> tile_lookup;
+	// The heights a tile is built from, with a sample around it for the normals, and the blocks they are decoded from.
+	mutable std::vector<float> tile_heights;
+	mutable std::vector<unsigned char> tile_blocks;
+	mutable std::vector<unsigned char> tile_pixels;
+
+	// Returns the tile of sample x, y, loading it if it is not kept.
+	const Tile& GetTile(int x, int y) const;
+
+	/*
+		Decode the heights of samples x to x + width and y to y + height, which must be in the heightmap, into rows
+		pitch floats apart.
+	*/
+	void ReadHeights(int x, int y, int width, int height, float* heights, int pitch) const;
+
+	void LoadTile(int tile_x, int tile_y, Tile& tile) const;
+};
+
+/*
+	A part of the terrain drawn with the patch grid, as an instance of it. A patch is a quarter of a quadtree node:
+	origin is its first sample, spacing the samples between its vertices, 2^level. height_tile is the layer holding
+	its heights, which Terrain sets when it streams them.
+*/
+struct TerrainPatch
+{
+	glm::vec2 origin;
+	float spacing;
+	float level;
+	float height_tile;
+};
+
+/*
+	The quadtree of a heightmap for continuous distance-dependent levels of detail (CDLOD). All nodes have
+	PATCH_QUADS by PATCH_QUADS quads, so a node of level L has a vertex every 2^L samples, and the root covers the
+	whole heightmap. Each level has twice the range of the level below, and nodes are selected from the root down
+	while the next finer level is in range of the camera.
+*/
+class TerrainQuadtree
+{
+public:
+	static const int PATCH_QUADS = 16;
+	static const int PATCH_GRID_QUADS = PATCH_QUADS / 2;
+
+	/*
+		Build the quadtree over the samples of heightmap, which are sample_spacing world units apart.
+		Throws a std::runtime_error if the heightmap needs more than TERRAIN_LOD_LEVEL_MAX levels.
+	*/
+	TerrainQuadtree(const Heightmap& heightmap, float sample_spacing);
+
+	/*
+		Replace patches with the patches to draw for a camera at camera_position, skipping the nodes outside the
+		frustum planes.
+	*/
+	void Select(const glm::vec4 frustum_planes[6], const glm::vec3& camera_position, std::vector<TerrainPatch>& patches) const;
+
+	/*
+		Returns the distances over which vertices of level morph into the next level: start in x and end in y.
+	*/
+	glm::vec2 GetMorphRange(int level) const;
+
+	/*
+		Returns the height of a sample on a corner of the leaf nodes, x and y being multiples of PATCH_QUADS or the
+		last column and row of the heightmap. The corners are kept from the build, so levels with a vertex every
+		PATCH_QUADS samples or more can be sampled without reading the heightmap.
+	*/
+	float GetCornerHeight(int x, int y) const;
 private:
-	float heights[HEIGHTMAP_RESOLUTION_X * HEIGHTMAP_RESOLUTION_Y];
-	glm::vec3 normals[HEIGHTMAP_RESOLUTION_X * HEIGHTMAP_RESOLUTION_Y];
+	// The range of level 0 in nodes of level 0.
+	static const float LOD_RANGE_NODES;
+	// How far into the range of a level, from the range of the level below, vertices start to morph.
+	static const float MORPH_START_RATIO;
+
+	glm::ivec2 resolution;
+	float sample_spacing;
+	int level_count;
+	// The number of nodes of each level in x and y, and their lowest and highest heights row by row.
+	glm::ivec2 node_counts[TERRAIN_LOD_LEVEL_MAX];
+	std::vector<glm::vec2> node_heights[TERRAIN_LOD_LEVEL_MAX];
+	float lod_ranges[TERRAIN_LOD_LEVEL_MAX];
+	std::vector<float> corner_heights;
+
+	AABB GetNodeAABB(int level, int x, int y) const;
+
+	/*
+		Select node x, y of level and the nodes below it, adding their patches. Returns false if the node is out of
+		the range of its level, so the parent has to cover it with its own patch.
+	*/
+	bool SelectNode(int level, int x, int y, const glm::vec4 frustum_planes[6], const glm::vec3& camera_position, std::vector<TerrainPatch>& patches) const;
+
+	/*
+		Add patch x, y of level, which covers node x, y of the level below. Patches past the heightmap are skipped.
+	*/
+	void AddPatch(int level, int x, int y, std::vector<TerrainPatch>& patches) const;
 };
 
+/*
+	Terrain rendered with the levels of detail of a TerrainQuadtree. The selected patches are drawn as instances of
+	one patch grid that samples the height in the vertex shader. Vertices morph into the grid of the next coarser
+	level as they approach the end of the range of their level, so levels meet without cracks or popping. The
+	triangle count depends on the view and the level ranges, not on the heightmap size.
+
+	Neither does the memory on the GPU: the vertex shader samples the heights of each patch from its own tile, a
+	layer of an array texture, which is streamed from the heightmap when the patch is first drawn. Tiles are
+	reused from the least recently drawn patches.
+*/
 class Terrain
 {
 public:
-	Terrain();
+	Terrain(ResourceCache& resources);
 	~Terrain();
 
-	void Render();
+	/*
+		Select and draw the patches in the frustum planes, see Camera::GetFrustumPlanes, for a camera at
+		camera_position.
+	*/
+	void Render(const glm::vec4 frustum_planes[6], const glm::vec3& camera_position);
+
+	/*
+		Sample the terrain at count points, given as arrays of their x and z, interpolating the heights and, if
+		normals is not null, the normals of the four samples around each point. Points are done 4 at a time with
+		SSE. Points outside the heightmap are masked to a height of 0 and an up normal rather than branched on.
+	*/
+	void GetHeights(const float* x, const float* z, size_t count, float* heights, glm::vec3* normals = nullptr) const;
+
+	// Sample the height at a single point, as GetHeights does.
 	float GetHeight(float x, float z) const;
 private:
-	static const float TERRAIN_WIDTH;
-	static const float TERRAIN_HEIGHT;
-	static const int VERTEX_COUNT = (Heightmap::HEIGHTMAP_RESOLUTION_Y - 1) * (Heightmap::HEIGHTMAP_RESOLUTION_Y - 1) * 6;
+	// The distance in world units between two samples of the heightmap.
+	static const float SAMPLE_SPACING;
+	// The number of height tiles, at most the patches that can be drawn in a frame.
+	static const int HEIGHT_TILE_CAPACITY = 2048;
+
+	struct HeightTile
+	{
+		uint64_t key;
+		int layer;
+		unsigned int frame;
+	};
 
 	Heightmap heightmap;
+	TerrainQuadtree quadtree;
+	std::vector<TerrainPatch> patches;
 	UniformBufferPerInstance uniform_data;
-	GLuint textures[3];
+	UniformBufferTerrainLOD lod_uniform_data;
+	ResourceHandle layer_texture;
 	GLuint mask_texture;
+	GLuint height_tile_texture;
+	// The height tiles from the most to the least recently drawn, and where each is in the list by the key of its patch.
+	std::list<HeightTile> height_tiles;
+	std::unordered_map<uint64_t, std::list<HeightTile>::iterator> height_tile_lookup;
+	unsigned int frame;
 	GLuint sampler;
-	GLuint position_vbo;
-	GLuint normal_vbo;
-	GLuint texcoord_vbo;
+	GLuint height_sampler;
+	GLuint grid_vbo;
+	GLuint patch_vbo;
+	GLuint index_buffer;
+	GLsizei index_count;
 	GLuint vao;
-	GLuint terrain_vs;
-	GLuint terrain_fs;
-	GLuint terrain_program;
+	ResourceHandle terrain_program;
 	GLuint uniform_buffer;
+	GLuint lod_uniform_buffer;
+
+	/*
+		Returns the layer of the height tile of patch, streaming its heights into a tile if it has none. Returns -1
+		if every tile is taken by a patch drawn this frame.
+	*/
+	int GetHeightTile(const TerrainPatch& patch);
 };
\ No newline at end of file
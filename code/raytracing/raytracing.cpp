@@ -37,9 +37,7 @@ Raytracing::Raytracing()
 	, overlay_texture(0)
 	, overlay_position_vbo(0)
 	, overlay_vao(0)
-	, overlay_vs(0)
-	, overlay_fs(0)
-	, overlay_program(0)
+	, resources(DIRECTORY_PROGRAM_BINARIES)
 	, viewport_width(VIEWPORT_WIDTH_INITIAL)
 	, viewport_height(VIEWPORT_HEIGHT_INITIAL)
 	, running(true)
@@ -127,12 +125,12 @@ void Raytracing::SetupContext()
 void Raytracing::SetupResources()
 {
 	// Compile the shader program.
-	overlay_vs = CompileShaderFromFile((DIRECTORY_SHADERS + FILE_OVERLAY_VS).c_str(), GL_VERTEX_SHADER);
-	overlay_fs = CompileShaderFromFile((DIRECTORY_SHADERS + FILE_OVERLAY_FS).c_str(), GL_FRAGMENT_SHADER);
-	overlay_program = glCreateProgram();
-	glAttachShader(overlay_program, overlay_vs);
-	glAttachShader(overlay_program, overlay_fs);
-	LinkProgram(overlay_program);
+	const ShaderFile overlay_shaders[] =
+	{
+		{ GL_VERTEX_SHADER, DIRECTORY_SHADERS + FILE_OVERLAY_VS },
+		{ GL_FRAGMENT_SHADER, DIRECTORY_SHADERS + FILE_OVERLAY_FS }
+	};
+	overlay_program = resources.LoadProgram(overlay_shaders, sizeof(overlay_shaders) / sizeof(ShaderFile));
 
 	// Generate a texture sampler.
 	glGenSamplers(1, &sampler);
@@ -259,7 +257,7 @@ void Raytracing::RenderScene()
 	RaytraceTexture();
 
 	// Render the texture on the overlay.
-	glUseProgram(overlay_program);
+	glUseProgram(overlay_program->name);
 
 	glActiveTexture(GL_TEXTURE0 + TEXTURE_UNIT_DIFFUSE);
 	glBindSampler(TEXTURE_UNIT_DIFFUSE, sampler);
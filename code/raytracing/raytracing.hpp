@@ -18,10 +18,12 @@
 #include <SDL2/SDL.h>
 #include <common/shader.h>
 #include <common/camera.h>
+#include <common/resourcecache.h>
 #include <string>
 #include "geometry.hpp"
 
 const std::string WINDOW_TITLE = "Raytracing";
+const std::string DIRECTORY_PROGRAM_BINARIES = "./";
 const std::string DIRECTORY_SHADERS = "../../../code/raytracing/shaders/";
 const std::string FILE_OVERLAY_VS = "overlay.vert";
 const std::string FILE_OVERLAY_FS = "overlay.frag";
@@ -72,9 +74,8 @@ private:
 	GLuint overlay_position_vbo;
 	GLuint overlay_texcoord_vbo;
 	GLuint overlay_vao;
-	GLuint overlay_vs;
-	GLuint overlay_fs;
-	GLuint overlay_program;
+	ResourceCache resources;
+	ResourceHandle overlay_program;
 	unsigned int viewport_width;
 	unsigned int viewport_height;
 	bool running;
@@ -0,0 +1,24 @@
+// Shared by the mesh shaders. SPOT_LIGHT_COUNT_MAX and SPOT_LIGHT_COUNT are defined by the application.
+
+struct AmbientLight
+{
+	vec4 intensity;
+};
+
+struct SpotLight
+{
+	mat4 light_projection_view_matrix;
+	vec4 position_W;
+	vec4 direction_W;
+	vec4 intensity;
+	float cutoff;
+	float angle;
+};
+
+layout(binding = 0, std140) uniform Constant
+{
+	AmbientLight ambient_light;
+	SpotLight spot_lights[SPOT_LIGHT_COUNT_MAX];
+	mat4 bias_matrix;
+	int spot_light_count;
+};
@@ -1,38 +1,15 @@
 #version 440
 
-#define SPOT_LIGHT_COUNT_MAX 5
+#include "lights.glsl"
 #define EPSILON 0.00001
 
-struct AmbientLight
-{
-	vec4 intensity;
-};
-
-struct SpotLight
-{
-    mat4 light_projection_view_matrix;
-	vec4 position_W;
-	vec4 direction_W;
-	vec4 intensity;
-	float cutoff;
-	float angle;
-};
-
 in vec3 vs_position_W;
 in vec3 vs_normal_W;
 in vec2 vs_texcoord;
-in vec4 vs_position_L[SPOT_LIGHT_COUNT_MAX];
+in vec4 vs_position_L[SPOT_LIGHT_COUNT];
 
 out vec4 out_color;
 
-layout(binding = 0, std140) uniform Constant
-{
-	AmbientLight ambient_light;
-	SpotLight spot_lights[SPOT_LIGHT_COUNT_MAX];
-	mat4 bias_matrix;
-	int spot_light_count;
-};
-
 layout(binding = 1, std140) uniform PerFrame
 {
 	mat4 view_matrix;
@@ -65,7 +42,7 @@ void main()
     ambient = ambient_light.intensity.rgb * surface_color;
 
 	// Spot lights.
-	for (int i = 0; i < spot_light_count; ++i)
+	for (int i = 0; i < SPOT_LIGHT_COUNT; ++i)
 	{
 		AddSpotLightContribution(i, surface_color, surface_to_camera, diffuse, specular);
 	}
@@ -1,38 +1,15 @@
 #version 440
 
-#define SPOT_LIGHT_COUNT_MAX 5
-
-struct AmbientLight
-{
-	vec4 intensity;
-};
-
-struct SpotLight
-{
-    mat4 light_projection_view_matrix;
-	vec4 position_W;
-	vec4 direction_W;
-	vec4 intensity;
-	float cutoff;
-	float angle;
-};
+#include "lights.glsl"
 
 layout(location = 0) in vec3 in_position_M;
-layout(location = 1) in vec3 in_normal_M;
+layout(location = 1) in vec2 in_normal_M;	// Octahedral encoded.
 layout(location = 2) in vec2 in_texcoord;
 
 out vec3 vs_position_W;
 out vec3 vs_normal_W;
 out vec2 vs_texcoord;
-out vec4 vs_position_L[SPOT_LIGHT_COUNT_MAX];
-
-layout(binding = 0, std140) uniform Constant
-{
-	AmbientLight ambient_light;
-	SpotLight spot_lights[SPOT_LIGHT_COUNT_MAX];
-	mat4 bias_matrix;
-	int spot_light_count;
-};
+out vec4 vs_position_L[SPOT_LIGHT_COUNT];
 
 layout(binding = 1, std140) uniform PerFrame
 {
@@ -48,14 +25,23 @@ layout(binding = 2, std140) uniform PerInstance
     vec4 material_specular_color;
 };
 
+vec3 DecodeOctahedral(vec2 encoded)
+{
+	vec3 normal = vec3(encoded.xy, 1.0f - abs(encoded.x) - abs(encoded.y));
+	float t = max(-normal.z, 0.0f);
+	normal.x += normal.x >= 0.0f ? -t : t;
+	normal.y += normal.y >= 0.0f ? -t : t;
+	return normal;
+}
+
 void main()
 {
 	gl_Position = projection_matrix * view_matrix * model_matrix * vec4(in_position_M, 1.0f);
 	vs_position_W = (model_matrix * vec4(in_position_M, 1.0f)).xyz;
-	vs_normal_W = normalize(mat3(normal_matrix) * in_normal_M);
+	vs_normal_W = normalize(mat3(normal_matrix) * DecodeOctahedral(in_normal_M));
 	vs_texcoord = in_texcoord;
 
-	for (int i = 0; i < spot_light_count; ++i)
+	for (int i = 0; i < SPOT_LIGHT_COUNT; ++i)
 	{
 		vs_position_L[i] = bias_matrix * spot_lights[i].light_projection_view_matrix * model_matrix * vec4(in_position_M, 1.0f);
 	}
@@ -1,9 +1,10 @@
 #include "shadowmapping.hpp"
 #include <iostream>
-#include <gli/gli.hpp>
 #include <glm/gtx/transform.hpp>
 #include <sstream>
 #include <fstream>
+#include <cstddef>
+#include <cstring>
 
 int main(int argc, char* argv[])
 {
@@ -47,11 +48,10 @@ InputState::InputState()
 
 Entity::Entity()
 	: vertex_count(0)
-	, vbo_positions(0)
-	, vbo_normals(0)
-	, vbo_texcoords(0)
+	, index_count(0)
+	, vbo(0)
+	, ibo(0)
 	, vao(0)
-	, texture(0)
 	, uniform_buffer(0)
 {}
 
@@ -59,15 +59,10 @@ Shadowmapping::Shadowmapping()
 	: window(nullptr)
 	, glcontext(nullptr)
 	, model_angle(0.0f)
-	, mesh_vs(0)
-	, mesh_fs(0)
-	, mesh_program(0)
+	, resources(DIRECTORY_PROGRAM_BINARIES)
 	, uniform_buffer_constant(0)
 	, uniform_buffer_frame(0)
 	, diffuse_sampler(0)
-	, depth_vs(0)
-	, depth_fs(0)
-	, depth_program(0)
 	, shadowmap_texture_array(0)
 	, shadowmap_sampler(0)
 	, shadowmap_fbo(0)
@@ -88,34 +83,27 @@ Shadowmapping::Shadowmapping()
 
 Shadowmapping::~Shadowmapping()
 {
-	glDetachShader(mesh_program, mesh_vs);
-	glDetachShader(mesh_program, mesh_fs);
-	glDeleteProgram(mesh_program);
-	glDeleteShader(mesh_vs);
-	glDeleteShader(mesh_fs);
-
-	glDetachShader(depth_program, depth_vs);
-	glDetachShader(depth_program, depth_fs);
-	glDeleteProgram(depth_program);
-	glDeleteShader(depth_vs);
-	glDeleteShader(depth_fs);
+	for (int i = 0; i < SPOT_LIGHT_COUNT_MAX; ++i)
+		mesh_programs[i].reset();
+
+	depth_program.reset();
 
 	glDeleteBuffers(1, &uniform_buffer_constant);
 	glDeleteBuffers(1, &uniform_buffer_frame);
 
 	glDeleteBuffers(1, &model.uniform_buffer);
-	glDeleteBuffers(1, &model.vbo_positions);
-	glDeleteBuffers(1, &model.vbo_normals);
-	glDeleteBuffers(1, &model.vbo_texcoords);
+	glDeleteBuffers(1, &model.vbo);
+	glDeleteBuffers(1, &model.ibo);
 	glDeleteVertexArrays(1, &model.vao);
-	glDeleteTextures(1, &model.texture);
+	if (!model.textures.empty())
+		glDeleteTextures(static_cast<GLsizei>(model.textures.size()), &model.textures[0]);
 
 	glDeleteBuffers(1, &plane.uniform_buffer);
-	glDeleteBuffers(1, &plane.vbo_positions);
-	glDeleteBuffers(1, &plane.vbo_normals);
-	glDeleteBuffers(1, &plane.vbo_texcoords);
+	glDeleteBuffers(1, &plane.vbo);
+	glDeleteBuffers(1, &plane.ibo);
 	glDeleteVertexArrays(1, &plane.vao);
-	glDeleteTextures(1, &plane.texture);
+	if (!plane.textures.empty())
+		glDeleteTextures(static_cast<GLsizei>(plane.textures.size()), &plane.textures[0]);
 
 	glDeleteSamplers(1, &diffuse_sampler);
 	glDeleteSamplers(1, &shadowmap_sampler);
@@ -197,24 +185,45 @@ void Shadowmapping::SetupContext()
 void Shadowmapping::SetupResources()
 {
 	// Compile the shader programs.
-	mesh_vs = CompileShaderFromFile((DIRECTORY_SHADERS + FILE_MESH_VS).c_str(), GL_VERTEX_SHADER);
-	mesh_fs = CompileShaderFromFile((DIRECTORY_SHADERS + FILE_MESH_FS).c_str(), GL_FRAGMENT_SHADER);
-	mesh_program = glCreateProgram();
-	glAttachShader(mesh_program, mesh_vs);
-	glAttachShader(mesh_program, mesh_fs);
-	LinkProgram(mesh_program);
-
-	depth_vs = CompileShaderFromFile((DIRECTORY_SHADERS + FILE_DEPTH_VS).c_str(), GL_VERTEX_SHADER);
-	depth_fs = CompileShaderFromFile((DIRECTORY_SHADERS + FILE_DEPTH_FS).c_str(), GL_FRAGMENT_SHADER);
-	depth_program = glCreateProgram();
-	glAttachShader(depth_program, depth_vs);
-	glAttachShader(depth_program, depth_fs);
-	LinkProgram(depth_program);
+	const ShaderFile mesh_shaders[] =
+	{
+		{ GL_VERTEX_SHADER, DIRECTORY_SHADERS + FILE_MESH_VS },
+		{ GL_FRAGMENT_SHADER, DIRECTORY_SHADERS + FILE_MESH_FS }
+	};
+	const ShaderFile depth_shaders[] =
+	{
+		{ GL_VERTEX_SHADER, DIRECTORY_SHADERS + FILE_DEPTH_VS },
+		{ GL_FRAGMENT_SHADER, DIRECTORY_SHADERS + FILE_DEPTH_FS }
+	};
+
+	// Specialize the mesh program for every spot light count, so the light loops have a constant trip count.
+	ShaderDefine mesh_defines[SPOT_LIGHT_COUNT_MAX][2];
+	ProgramFiles programs[SPOT_LIGHT_COUNT_MAX + 1];
+	for (int i = 0; i < SPOT_LIGHT_COUNT_MAX; ++i)
+	{
+		mesh_defines[i][0].name = "SPOT_LIGHT_COUNT_MAX";
+		mesh_defines[i][0].value = std::to_string(SPOT_LIGHT_COUNT_MAX);
+		mesh_defines[i][1].name = "SPOT_LIGHT_COUNT";
+		mesh_defines[i][1].value = std::to_string(i + 1);
+		ProgramFiles mesh_program_files = { mesh_shaders, sizeof(mesh_shaders) / sizeof(ShaderFile), mesh_defines[i], 2 };
+		programs[i] = mesh_program_files;
+	}
+	ProgramFiles depth_program_files = { depth_shaders, sizeof(depth_shaders) / sizeof(ShaderFile), nullptr, 0 };
+	programs[SPOT_LIGHT_COUNT_MAX] = depth_program_files;
+
+	// Compile all programs in one batch, so the driver can compile them in parallel.
+	ResourceHandle program_handles[SPOT_LIGHT_COUNT_MAX + 1];
+	ShaderBatchStatistics shader_statistics;
+	resources.LoadPrograms(programs, SPOT_LIGHT_COUNT_MAX + 1, program_handles, &shader_statistics);
+	for (int i = 0; i < SPOT_LIGHT_COUNT_MAX; ++i)
+		mesh_programs[i] = program_handles[i];
+	depth_program = program_handles[SPOT_LIGHT_COUNT_MAX];
+	std::cout << "Compiled " << shader_statistics.shader_count << " shaders" << (shader_statistics.parallel ? " in parallel" : "")
+		<< " in " << shader_statistics.total_time / 1000.0f << " ms (" << shader_statistics.submit_time / 1000.0f << " ms submitting)" << std::endl;
 
 	// Generate the diffuse sampler.
 	glGenSamplers(1, &diffuse_sampler);
-	glSamplerParameteri(diffuse_sampler, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-	glSamplerParameteri(diffuse_sampler, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	SetSamplerFiltering(diffuse_sampler, TEXTURE_ANISOTROPY_DEFAULT);
 	glSamplerParameteri(diffuse_sampler, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
 	glSamplerParameteri(diffuse_sampler, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
 
@@ -258,7 +267,7 @@ void Shadowmapping::SetupResources()
 	LoadModel(FILE_MODEL.c_str(), model);
 	LoadModel(FILE_PLANE_MODEL.c_str(), plane);
 
-	plane.uniform_data.model_matrix = glm::scale(glm::vec3(25.0f, 1.0f, 25.0f)) * glm::translate(glm::vec3(0.0f, -3.0f, 0.0f));
+	plane.uniform_data.model_matrix = glm::scale(glm::vec3(25.0f, 1.0f, 25.0f)) * glm::translate(glm::vec3(0.0f, -3.0f, 0.0f)) * plane.dequantization;
 }
 
 void Shadowmapping::LoadModel(const char* filepath, Entity& entity)
@@ -270,46 +279,55 @@ void Shadowmapping::LoadModel(const char* filepath, Entity& entity)
 		throw std::runtime_error("Failed to load OBJ model: " + DIRECTORY_MODELS + filepath);
 	}
 
-	// Setup the buffers.
-	glGenVertexArrays(1, &entity.vao);
-	glBindVertexArray(entity.vao);
+	// Load the materials and make the faces of each material contiguous.
+	if (!LoadMTL((DIRECTORY_MODELS + model.mtllib).c_str(), entity.materials) || entity.materials.empty())
+	{
+		throw std::runtime_error("Failed to load material library: " + DIRECTORY_MODELS + model.mtllib);
+	}
+
+	SortOBJByMaterial(model, entity.materials);
+
+	// Index the model and optimize it for the vertex cache, overdraw and vertex fetch.
+	IndexedMesh mesh;
+	BuildIndexedMesh(model, mesh);
+	OptimizeMesh(mesh, nullptr);
+	BuildMaterialBatches(mesh.submeshes, entity.materials, entity.batches);
 
-	glGenBuffers(1, &entity.vbo_positions);
-	glBindBuffer(GL_ARRAY_BUFFER, entity.vbo_positions);
-	glBufferData(GL_ARRAY_BUFFER, model.positions.size() * sizeof(glm::vec3), &model.positions[0], GL_STATIC_DRAW);
-	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, 0);
+	// Pack the vertices into the compressed format and setup the buffers.
+	std::vector<PackedVertex> vertices;
+	PackVertices(&mesh.positions[0], &mesh.normals[0], &mesh.texcoords[0], mesh.positions.size(), vertices, entity.dequantization);
 
-	glGenBuffers(1, &entity.vbo_normals);
-	glBindBuffer(GL_ARRAY_BUFFER, entity.vbo_normals);
-	glBufferData(GL_ARRAY_BUFFER, model.normals.size() * sizeof(glm::vec3), &model.normals[0], GL_STATIC_DRAW);
-	glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 0, 0);
+	glGenVertexArrays(1, &entity.vao);
+	glBindVertexArray(entity.vao);
 
-	glGenBuffers(1, &entity.vbo_texcoords);
-	glBindBuffer(GL_ARRAY_BUFFER, entity.vbo_texcoords);
-	glBufferData(GL_ARRAY_BUFFER, model.texcoords.size() * sizeof(glm::vec2), &model.texcoords[0], GL_STATIC_DRAW);
-	glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 0, 0);
+	glGenBuffers(1, &entity.vbo);
+	glBindBuffer(GL_ARRAY_BUFFER, entity.vbo);
+	glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(PackedVertex), &vertices[0], GL_STATIC_DRAW);
+	SetupPackedVertexAttributes();
 
-	glEnableVertexAttribArray(0);
-	glEnableVertexAttribArray(1);
-	glEnableVertexAttribArray(2);
+	glGenBuffers(1, &entity.ibo);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, entity.ibo);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, mesh.indices.size() * sizeof(unsigned int), &mesh.indices[0], GL_STATIC_DRAW);
 
-	entity.vertex_count = model.positions.size();
+	entity.vertex_count = static_cast<GLuint>(mesh.positions.size());
+	entity.index_count = static_cast<GLuint>(mesh.indices.size());
 
-	// Load the material.
-	MTL material;
-	if (!LoadMTL((DIRECTORY_MODELS + model.mtllib).c_str(), material))
+	// Load the diffuse texture of each material batch.
+	entity.textures.resize(entity.batches.size());
+	for (size_t i = 0; i < entity.batches.size(); ++i)
 	{
-		throw std::runtime_error("Failed to load material library: " + DIRECTORY_MODELS + model.mtllib);
+		const MTL& material = entity.materials[entity.batches[i].material];
+		TextureImage texture_image;
+		if (!LoadDDSFile(DIRECTORY_TEXTURES + material.map_Kd, texture_image))
+		{
+			throw std::runtime_error("Failed to load texture: " + DIRECTORY_TEXTURES + material.map_Kd);
+		}
+
+		entity.textures[i] = CreateTexture(texture_image, GL_RGB8, GL_BGR);
 	}
-	
-	gli::storage texture_image = gli::load_dds((DIRECTORY_TEXTURES + material.map_Kd).c_str());
-	glGenTextures(1, &entity.texture);
-	glBindTexture(GL_TEXTURE_2D, entity.texture);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB8, texture_image.dimensions(0).x, texture_image.dimensions(0).y, 0, GL_BGR, GL_UNSIGNED_BYTE, texture_image.data());
 
-	// Setup the instance buffer.
+	// Setup the instance buffer. The material specular color is filled in per batch when rendering.
 	glGenBuffers(1, &entity.uniform_buffer);
-	entity.uniform_data.material_specular_color = glm::vec4(material.Ks, material.Ns);
 }
 
 void Shadowmapping::Run()
@@ -326,6 +344,7 @@ void Shadowmapping::Run()
 		HandleEvents();
 		UpdateCamera(dt);
 		UpdateScene(dt);
+		ReloadShaders();
 		RenderScene();
 
 		caption.str("");
@@ -442,7 +461,7 @@ void Shadowmapping::UpdateCamera(float dt)
 void Shadowmapping::UpdateScene(float dt)
 {
 	model_angle += MODEL_ROTATION_SPEED * dt;
-	model.uniform_data.model_matrix = glm::rotate(model_angle, glm::vec3(0.0f, 1.0f, 0.0f)) * glm::scale(glm::vec3(0.05f, 0.05f, 0.05f));
+	model.uniform_data.model_matrix = glm::rotate(model_angle, glm::vec3(0.0f, 1.0f, 0.0f)) * glm::scale(glm::vec3(0.05f, 0.05f, 0.05f)) * model.dequantization;
 	model.uniform_data.normal_matrix = glm::mat4(glm::transpose(glm::inverse(glm::mat3(model.uniform_data.model_matrix))));
 
 	if (input_state_current.keys[SDL_SCANCODE_P] && !input_state_previous.keys[SDL_SCANCODE_P])
@@ -491,6 +510,18 @@ void Shadowmapping::UpdateScene(float dt)
 	}
 }
 
+void Shadowmapping::ReloadShaders()
+{
+	// Rebuild the programs whose shader files were edited. Programs that fail to build keep their previous version.
+	std::vector<std::string> errors;
+	unsigned int reloaded = resources.ReloadChangedPrograms(errors);
+	for (size_t i = 0; i < errors.size(); ++i)
+		std::cerr << errors[i] << std::endl;
+
+	if (reloaded > 0)
+		std::cout << "Reloaded " << reloaded << " shader programs" << std::endl;
+}
+
 void Shadowmapping::RenderScene()
 {
 	// Time the rendering.
@@ -514,7 +545,7 @@ void Shadowmapping::RenderScene()
 	glBufferData(GL_UNIFORM_BUFFER, sizeof(UniformBufferPerFrame), &uniform_data_frame, GL_DYNAMIC_DRAW);
 
 	// Draw the entities.
-	glUseProgram(mesh_program);
+	glUseProgram(mesh_programs[uniform_data_constant.spot_light_count - 1]->name);
 
 	glActiveTexture(GL_TEXTURE0 + TEXTURE_UNIT_SHADOWMAP);
 	glBindSampler(TEXTURE_UNIT_SHADOWMAP, shadowmap_sampler);
@@ -523,19 +554,9 @@ void Shadowmapping::RenderScene()
 	glActiveTexture(GL_TEXTURE0 + TEXTURE_UNIT_DIFFUSE);
 	glBindSampler(TEXTURE_UNIT_DIFFUSE, diffuse_sampler);
 
-	// Draw the model.
-	glBindBufferBase(GL_UNIFORM_BUFFER, UNIFORM_BINDING_INSTANCE, model.uniform_buffer);
-	glBufferData(GL_UNIFORM_BUFFER, sizeof(UniformBufferPerInstance), &model.uniform_data, GL_DYNAMIC_DRAW);
-	glBindTexture(GL_TEXTURE_2D, model.texture);
-	glBindVertexArray(model.vao);
-	glDrawArrays(GL_TRIANGLES, 0, model.vertex_count);
-
-	// Draw the plane.
-	glBindBufferBase(GL_UNIFORM_BUFFER, UNIFORM_BINDING_INSTANCE, plane.uniform_buffer);
-	glBufferData(GL_UNIFORM_BUFFER, sizeof(UniformBufferPerInstance), &plane.uniform_data, GL_DYNAMIC_DRAW);
-	glBindTexture(GL_TEXTURE_2D, plane.texture);
-	glBindVertexArray(plane.vao);
-	glDrawArrays(GL_TRIANGLES, 0, plane.vertex_count);
+	// Draw the model and the plane.
+	RenderEntity(model);
+	RenderEntity(plane);
 
 	// Calculate the time the rendering took.
 	rendering_time_clock = timer.End();
@@ -548,6 +569,25 @@ void Shadowmapping::RenderScene()
 	SDL_GL_SwapWindow(window);
 }
 
+void Shadowmapping::RenderEntity(Entity& entity)
+{
+	glBindBufferBase(GL_UNIFORM_BUFFER, UNIFORM_BINDING_INSTANCE, entity.uniform_buffer);
+	glBufferData(GL_UNIFORM_BUFFER, sizeof(UniformBufferPerInstance), &entity.uniform_data, GL_DYNAMIC_DRAW);
+	glBindVertexArray(entity.vao);
+
+	// Draw the entity one material batch at a time.
+	for (size_t i = 0; i < entity.batches.size(); ++i)
+	{
+		const MaterialBatch& batch = entity.batches[i];
+		const MTL& material = entity.materials[batch.material];
+		entity.uniform_data.material_specular_color = glm::vec4(material.Ks, material.Ns);
+		glBufferSubData(GL_UNIFORM_BUFFER, offsetof(UniformBufferPerInstance, material_specular_color), sizeof(glm::vec4), &entity.uniform_data.material_specular_color);
+
+		glBindTexture(GL_TEXTURE_2D, entity.textures[i]);
+		glMultiDrawElements(GL_TRIANGLES, &batch.counts[0], GL_UNSIGNED_INT, &batch.offsets[0], static_cast<GLsizei>(batch.offsets.size()));
+	}
+}
+
 void Shadowmapping::RenderDepth()
 {
 	// Cull the front faces to avoid self-shadowing.
@@ -567,7 +607,7 @@ void Shadowmapping::RenderDepth()
 		glDrawBuffer(GL_NONE);
 		glClear(GL_DEPTH_BUFFER_BIT);
 
-		glUseProgram(depth_program);
+		glUseProgram(depth_program->name);
 
 		// Render the model. Hijack the normal matrix uniform location for the light projection view matrix.
 		UniformBufferPerInstance depth_uniform_data = model.uniform_data;
@@ -578,7 +618,7 @@ void Shadowmapping::RenderDepth()
 		glBindVertexArray(model.vao);
 		glDisableVertexAttribArray(1);
 		glDisableVertexAttribArray(2);
-		glDrawArrays(GL_TRIANGLES, 0, model.vertex_count);
+		glDrawElements(GL_TRIANGLES, model.index_count, GL_UNSIGNED_INT, nullptr);
 		glEnableVertexAttribArray(1);
 		glEnableVertexAttribArray(2);
 
@@ -591,7 +631,7 @@ void Shadowmapping::RenderDepth()
 		glBindVertexArray(plane.vao);
 		glDisableVertexAttribArray(1);
 		glDisableVertexAttribArray(2);
-		glDrawArrays(GL_TRIANGLES, 0, plane.vertex_count);
+		glDrawElements(GL_TRIANGLES, plane.index_count, GL_UNSIGNED_INT, nullptr);
 		glEnableVertexAttribArray(1);
 		glEnableVertexAttribArray(2);
 
@@ -21,17 +21,23 @@
 #define GLM_FORCE_RADIANS
 
 #include <common/model.h>
+#include <common/mesh.h>
+#include <common/vertexformat.h>
 #include <common/shader.h>
 #include <common/camera.h>
 #include <common/timer.h>
+#include <common/resourcecache.h>
+#include <common/texture.h>
 #include <SDL2/SDL.h>
 #define NOMINMAX
 #include <GL/gl3w.h>
 #include <glm/glm.hpp>
 #include <string>
+#include <vector>
 
 const std::string WINDOW_TITLE = "Shadowmapping";
 const std::string DIRECTORY_ASSETS_ROOT = "../../../assets/";
+const std::string DIRECTORY_PROGRAM_BINARIES = "./";
 const std::string DIRECTORY_SHADERS = "../../../code/shadowmapping/shaders/";
 const std::string DIRECTORY_MODELS = DIRECTORY_ASSETS_ROOT + "models/";
 const std::string DIRECTORY_TEXTURES = DIRECTORY_ASSETS_ROOT + "textures/";
@@ -123,11 +129,14 @@ struct Entity
 {
 	UniformBufferPerInstance uniform_data;
 	GLuint vertex_count;
-	GLuint vbo_positions;
-	GLuint vbo_normals;
-	GLuint vbo_texcoords;
+	GLuint index_count;
+	GLuint vbo;
+	GLuint ibo;
+	glm::mat4 dequantization;
 	GLuint vao;
-	GLuint texture;
+	std::vector<MTL> materials;
+	std::vector<MaterialBatch> batches;
+	std::vector<GLuint> textures;
 	GLuint uniform_buffer;
 
 	Entity();
@@ -150,15 +159,13 @@ private:
 	float model_angle;
 	Entity model;
 	Entity plane;
-	GLuint mesh_vs;
-	GLuint mesh_fs;
-	GLuint mesh_program;
+	ResourceCache resources;
+	// One permutation per spot light count.
+	ResourceHandle mesh_programs[SPOT_LIGHT_COUNT_MAX];
 	GLuint uniform_buffer_constant;
 	GLuint uniform_buffer_frame;
 	GLuint diffuse_sampler;
-	GLuint depth_vs;
-	GLuint depth_fs;
-	GLuint depth_program;
+	ResourceHandle depth_program;
 	GLuint shadowmap_texture_array;
 	GLuint shadowmap_sampler;
 	GLuint shadowmap_fbo;
@@ -181,7 +188,9 @@ private:
 	void HandleEvents();
 	void UpdateCamera(float dt);
 	void UpdateScene(float dt);
+	void ReloadShaders();
 	void RenderScene();
+	void RenderEntity(Entity& entity);
 	void RenderDepth();
 	void UpdateShadowmapResources(int resolution_index, int spot_light_count);
 	void UpdateReport(int64_t rendering_time);
@@ -0,0 +1,148 @@
+#include <common/blockcompression.h>
+#include <common/texture.h>
+#include <common/timer.h>
+#include <gli/gli.hpp>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+struct CookFormat
+{
+	const char* name;
+	BlockFormat block_format;
+	gli::format format;
+	// The number of channels compared when validating the result.
+	unsigned int channel_count;
+};
+
+static const CookFormat COOK_FORMATS[] =
+{
+	{ "bc1", BLOCK_FORMAT_BC1, gli::FORMAT_RGB_DXT1_UNORM, 3 },
+	{ "bc3", BLOCK_FORMAT_BC3, gli::FORMAT_RGBA_DXT5_UNORM, 4 },
+	{ "bc4", BLOCK_FORMAT_BC4, gli::FORMAT_R_ATI1N_UNORM, 1 },
+	{ "bc5", BLOCK_FORMAT_BC5, gli::FORMAT_RG_ATI2N_UNORM, 2 },
+	{ "bc7", BLOCK_FORMAT_BC7, gli::FORMAT_RGB_BP_UNORM, 4 }
+};
+
+/*
+	Expand the pixels of an uncompressed image into 4 byte RGBA. The labs upload 3 and 4 byte images as BGR and
+	BGRA, so they are swizzled here, and 1 byte images, like the heightmap, go into red.
+*/
+static std::vector<unsigned char> ExpandToRGBA(const TextureImage& image)
+{
+	std::vector<unsigned char> rgba(image.pixels.size() / image.pixel_size * 4);
+	for (size_t i = 0, j = 0; i < image.pixels.size(); i += image.pixel_size, j += 4)
+	{
+		const unsigned char* pixel = &image.pixels[i];
+		if (image.pixel_size == 1)
+		{
+			rgba[j + 0] = pixel[0];
+			rgba[j + 1] = 0;
+			rgba[j + 2] = 0;
+			rgba[j + 3] = 255;
+		}
+		else if (image.pixel_size == 2)
+		{
+			rgba[j + 0] = pixel[0];
+			rgba[j + 1] = pixel[1];
+			rgba[j + 2] = 0;
+			rgba[j + 3] = 255;
+		}
+		else
+		{
+			rgba[j + 0] = pixel[2];
+			rgba[j + 1] = pixel[1];
+			rgba[j + 2] = pixel[0];
+			rgba[j + 3] = image.pixel_size == 4 ? pixel[3] : 255;
+		}
+	}
+
+	return rgba;
+}
+
+int main(int argc, char* argv[])
+{
+	if (argc != 4)
+	{
+		std::cerr << "Usage: texturecooker <bc1|bc3|bc4|bc5|bc7> <input.dds> <output.dds>" << std::endl;
+		return 1;
+	}
+
+	const CookFormat* cook_format = nullptr;
+	for (size_t i = 0; i < sizeof(COOK_FORMATS) / sizeof(CookFormat); ++i)
+	{
+		if (std::strcmp(argv[1], COOK_FORMATS[i].name) == 0)
+			cook_format = &COOK_FORMATS[i];
+	}
+
+	if (!cook_format)
+	{
+		std::cerr << "Unknown format: " << argv[1] << std::endl;
+		return 1;
+	}
+
+	// Uncompressed files without mip levels get a complete chain from LoadDDSFile.
+	TextureImage image;
+	if (!LoadDDSFile(argv[2], image) || image.compressed)
+	{
+		std::cerr << "Failed to load uncompressed texture: " << argv[2] << std::endl;
+		return 1;
+	}
+
+	std::vector<unsigned char> rgba = ExpandToRGBA(image);
+
+	gli::storage storage(1, 1, image.levels.size(), cook_format->format, gli::storage::dim_type(image.levels[0].width, image.levels[0].height, 1));
+	unsigned char* blocks = reinterpret_cast<unsigned char*>(storage.data());
+
+	Timer timer;
+
+	std::vector<size_t> block_offsets(image.levels.size());
+	size_t block_offset = 0;
+	for (size_t i = 0; i < image.levels.size(); ++i)
+	{
+		const TextureLevel& level = image.levels[i];
+		block_offsets[i] = block_offset;
+		EncodeBlocks(cook_format->block_format, &rgba[level.offset / image.pixel_size * 4], level.width, level.height, blocks + block_offset);
+		block_offset += GetCompressedSize(cook_format->block_format, level.width, level.height);
+	}
+
+	int64_t encode_time = timer.End();
+
+	// Decode the blocks again and compare the channels the format keeps with the source.
+	double squared_error = 0.0;
+	size_t sample_count = 0;
+	for (size_t i = 0; i < image.levels.size(); ++i)
+	{
+		const TextureLevel& level = image.levels[i];
+		std::vector<unsigned char> decoded(level.width * level.height * 4);
+		if (!DecodeBlocks(cook_format->block_format, blocks + block_offsets[i], level.width, level.height, &decoded[0]))
+		{
+			std::cerr << "Failed to decode level " << i << std::endl;
+			return 1;
+		}
+
+		const unsigned char* source = &rgba[level.offset / image.pixel_size * 4];
+		for (size_t p = 0; p < decoded.size(); p += 4)
+		{
+			for (unsigned int c = 0; c < cook_format->channel_count; ++c)
+			{
+				double difference = double(decoded[p + c]) - double(source[p + c]);
+				squared_error += difference * difference;
+			}
+		}
+		sample_count += level.width * level.height * cook_format->channel_count;
+	}
+
+	gli::save_dds(storage, argv[3]);
+
+	double mean_squared_error = squared_error / sample_count;
+	double psnr = mean_squared_error > 0.0 ? 10.0 * std::log10(255.0 * 255.0 / mean_squared_error) : INFINITY;
+	std::cout << argv[2] << ": " << image.levels[0].width << "x" << image.levels[0].height << ", " << image.levels.size() << " levels" << std::endl;
+	std::cout << "Encoded " << argv[1] << " in " << encode_time / 1000.0f << " ms" << std::endl;
+	std::cout << "Size: " << image.pixels.size() / 1024 << " KB -> " << block_offset / 1024 << " KB" << std::endl;
+	std::cout << "PSNR: " << psnr << " dB" << std::endl;
+
+	return 0;
+}
@@ -65,7 +65,13 @@ solution "opengllabs"
     project "shadowmapping"
         kind "ConsoleApp"
         language "C++"
-        files { "code/shadowmapping/**.hpp", "code/shadowmapping/**.cpp", "code/shadowmapping/shaders/**.vert", "code/shadowmapping/shaders/**.frag" }
+        files { "code/shadowmapping/**.hpp", "code/shadowmapping/**.cpp", "code/shadowmapping/shaders/**.vert", "code/shadowmapping/shaders/**.frag", "code/shadowmapping/shaders/**.glsl" }
         objdir "build/shadowmapping/obj/"
         links { "opengl32", "SDL2", "SDL2main", "gl3w", "common" }
-        
\ No newline at end of file
+        
+    project "texturecooker"
+        kind "ConsoleApp"
+        language "C++"
+        files { "code/texturecooker/**.hpp", "code/texturecooker/**.cpp" }
+        objdir "build/texturecooker/obj/"
+        links { "opengl32", "gl3w", "common" }